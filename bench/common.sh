@@ -0,0 +1,146 @@
+#
+# common.sh
+#
+# Functions shared by the benchmark scripts, which source this file.
+#
+# Environment:
+#   SERVERS   server binaries to compare, run in turn
+#             (default: build/http_server)
+#   PORT      server port (default: 8080)
+#   DURATION  wrk run time per measurement (default: 10s)
+#   THREADS   wrk threads (default: 4)
+#   WRK_PREFIX  command prefix for wrk, such as "taskset -c 2-3"
+#
+
+BENCH_DIR=${BENCH_DIR:-$(cd "$(dirname "$0")" && pwd)}
+ROOT=$(dirname "$BENCH_DIR")
+SERVERS=${SERVERS:-$ROOT/build/http_server}
+PORT=${PORT:-8080}
+DURATION=${DURATION:-10s}
+THREADS=${THREADS:-4}
+WRK_PREFIX=${WRK_PREFIX:-}
+URL=http://localhost:$PORT
+SERVER_PID=
+
+WORK=$(mktemp -d)
+trap 'stop_server; rm -rf "$WORK"' EXIT
+trap 'exit 1' INT TERM
+
+# Exit unless the named commands are installed.
+require() {
+	for cmd in "$@"; do
+		if ! command -v "$cmd" >/dev/null 2>&1; then
+			echo "$(basename "$0"): $cmd is required" >&2
+			exit 1
+		fi
+	done
+}
+
+# Write a config named $1 from httpd.conf, bench.conf and the
+# remaining KEY=VALUE arguments, and print its path.
+bench_conf() {
+	conf=$WORK/$1
+	shift
+	# the server root is relative to the config, which is not in the tree
+	sed -e "s/^Port=.*/Port=$PORT/" -e "s|^ServerRoot=.*|ServerRoot=$ROOT|" \
+		"$ROOT/httpd.conf" > "$conf"
+	for setting in $(grep -v '^#' "$BENCH_DIR/bench.conf") "$@"; do
+		key=${setting%%=*}
+		if grep -q "^$key=" "$conf"; then
+			sed -i "s|^$key=.*|$setting|" "$conf"
+		else
+			echo "$setting" >> "$conf"
+		fi
+	done
+	echo "$conf"
+}
+
+# Start server binary $1 with config $2 from the repository root,
+# optionally under a command prefix such as "taskset -c 0" in
+# $3, and wait until it accepts connections.
+start_server() {
+	(cd "$ROOT" && exec $3 "$1" "$2") > "$WORK/server.log" 2>&1 &
+	SERVER_PID=$!
+	for i in $(seq 50); do
+		if curl -s -o /dev/null "$URL/"; then
+			return 0
+		fi
+		sleep 0.1
+	done
+	echo "$(basename "$0"): server did not start, see below" >&2
+	cat "$WORK/server.log" >&2
+	exit 1
+}
+
+# Stop the server started last.
+stop_server() {
+	if [ -n "$SERVER_PID" ]; then
+		kill "$SERVER_PID" 2>/dev/null
+		wait "$SERVER_PID" 2>/dev/null
+		SERVER_PID=
+	fi
+}
+
+# Run wrk with the given arguments against the server, keeping its
+# report in $WORK/wrk.out, and print requests/sec and mean latency.
+run_wrk() {
+	$WRK_PREFIX wrk -t"$THREADS" -d"$DURATION" "$@" > "$WORK/wrk.out" 2>&1
+	awk '/Requests\/sec/ { rps = $2 }
+	     /^ *Latency/ { lat = $2 }
+	     /requests in/ { n = $1 }
+	     /Non-2xx|Socket errors/ { err = err " " $0 }
+	     END { printf "%12s req/s %10s avg latency %10s requests%s\n", rps, lat, n, err }' "$WORK/wrk.out"
+}
+
+# Print the number of requests in the last wrk report.
+wrk_requests() {
+	awk '/requests in/ { print $1 }' "$WORK/wrk.out"
+}
+
+# Print the user+system CPU ticks used so far by the server.
+server_cpu_ticks() {
+	# fields after the parenthesized command name; utime and stime are 14 and 15
+	sed 's/^.*) //' "/proc/$SERVER_PID/stat" | awk '{ print $12 + $13 }'
+}
+
+# Print a field of /proc/<pid>/status of the server, such as VmHWM.
+server_status() {
+	awk -v field="$1:" '$1 == field { sub(/^[^:]*:[ \t]*/, ""); print }' "/proc/$SERVER_PID/status"
+}
+
+# Run wrk with the given arguments while strace counts the system
+# calls of all server threads, and print the calls per request,
+# in total and for the most frequent calls.
+run_wrk_strace() {
+	strace -f -c -o "$WORK/strace.out" -p "$SERVER_PID" 2>/dev/null &
+	strace_pid=$!
+	sleep 1  # attached to every thread before the load starts
+	$WRK_PREFIX wrk -t"$THREADS" -d"$DURATION" "$@" > "$WORK/wrk.out" 2>&1
+	kill "$strace_pid"  # detaches and writes the summary
+	wait "$strace_pid" 2>/dev/null
+	# columns are % time, seconds, usecs/call, calls, [errors,] syscall
+	awk -v n="$(wrk_requests)" '
+		$1 ~ /^[0-9.]+$/ && $NF == "total" { total = $4 }
+		$1 ~ /^[0-9.]+$/ && $NF != "total" { calls[$NF] = $4 }
+		END {
+			if (n == 0) { print "no requests"; exit }
+			printf "%8.2f syscalls/request:", total / n
+			for (i = 0; i < 6; i++) {
+				top = ""
+				for (c in calls) if (top == "" || calls[c] > calls[top]) top = c
+				if (top == "") break
+				printf " %s %.2f", top, calls[top] / n
+				delete calls[top]
+			}
+			printf "\n"
+		}' "$WORK/strace.out"
+}
+
+# Run wrk with the given arguments, and print requests/sec and the
+# server CPU time per request in microseconds.
+run_wrk_cpu() {
+	ticks=$(server_cpu_ticks)
+	run_wrk "$@" | awk '{ printf "%12s req/s ", $1 }'
+	awk -v ticks=$(($(server_cpu_ticks) - ticks)) -v hz="$(getconf CLK_TCK)" \
+		-v n="$(wrk_requests)" 'BEGIN { printf "%8.2f us CPU/request\n", (n > 0) ? ticks * 1e6 / hz / n : 0 }'
+}
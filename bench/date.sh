@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# date.sh
+#
+# Measure the per-request cost of the Date and Last-Modified headers:
+# server CPU time per request for small cached files, with the server
+# pinned to CPU 0 and pipelined minimal requests, so that header
+# formatting is a visible part of each request. Run it for builds
+# before and after a change to the clock by listing both in SERVERS.
+#
+# Usage: bench/date.sh [paths]
+#   paths     the requested paths (default: /index.html /favicon.ico)
+#   DEPTH     pipelining depth (default: 16)
+#   CONNS     persistent connections (default: 64)
+#
+. "$(dirname "$0")/common.sh"
+require wrk curl taskset
+
+paths=${*:-/index.html /favicon.ico}
+DEPTH=${DEPTH:-16}
+CONNS=${CONNS:-64}
+ncpus=$(nproc)
+if [ "$ncpus" -lt 2 ]; then
+	echo "$(basename "$0"): needs a CPU for the server and one for wrk" >&2
+	exit 1
+fi
+WRK_PREFIX="taskset -c 1-$((ncpus - 1))"
+
+for server in $SERVERS; do
+	echo "== $server"
+	start_server "$server" "$(bench_conf date.conf MaxPipelineDepth=$DEPTH)" "taskset -c 0"
+	for path in $paths; do
+		printf '%-14s ' "$path"
+		run_wrk_cpu -c"$CONNS" -s "$BENCH_DIR/requests.lua" "$URL$path" -- "$DEPTH" minimal
+	done
+	stop_server
+done
@@ -0,0 +1,33 @@
+#!/bin/sh
+#
+# event_loop.sh
+#
+# Compare the epoll event loop with the blocking accept loop:
+# connections/sec with a new connection per request, requests/sec
+# over many persistent connections, and the memory the server used.
+#
+# Usage: bench/event_loop.sh [path]
+#   path      the requested path (default: /index.html)
+#   ENGINES   the IoEngine settings to compare (default: blocking epoll)
+#   CONNS     persistent connections (default: 1000)
+#
+. "$(dirname "$0")/common.sh"
+require wrk curl
+
+path=${1:-/index.html}
+ENGINES=${ENGINES:-blocking epoll}
+CONNS=${CONNS:-1000}
+
+for server in $SERVERS; do
+	echo "== $server"
+	for engine in $ENGINES; do
+		start_server "$server" "$(bench_conf "$engine.conf" IoEngine=$engine)"
+		printf '%-10s close      ' "$engine"
+		run_wrk -c64 -H "Connection: close" "$URL$path"
+		printf '%-10s keep-alive ' "$engine"
+		run_wrk -c"$CONNS" "$URL$path"
+		printf '%-10s memory     peak %s, resident %s, %s threads\n' "$engine" \
+			"$(server_status VmHWM)" "$(server_status VmRSS)" "$(server_status Threads)"
+		stop_server
+	done
+done
@@ -0,0 +1,42 @@
+#!/bin/sh
+#
+# io_uring.sh
+#
+# Compare the io_uring engine with the epoll and blocking engines:
+# requests/sec for a small and a large file, and system calls per
+# request counted with strace in a separate, slower run.
+#
+# Usage: bench/io_uring.sh
+#   ENGINES   the IoEngine settings to compare (default: blocking epoll io_uring)
+#   CONNS     persistent connections (default: 64)
+#   LARGE_KB  size of the large file in KB (default: 1024)
+#
+. "$(dirname "$0")/common.sh"
+require wrk curl strace
+
+ENGINES=${ENGINES:-blocking epoll io_uring}
+CONNS=${CONNS:-64}
+LARGE_KB=${LARGE_KB:-1024}
+
+# the large file is not cached in memory, so GET reads it each time
+files="$ROOT/content/_bench"
+mkdir -p "$files"
+trap 'stop_server; rm -rf "$WORK" "$files"' EXIT
+head -c "${LARGE_KB}K" /dev/urandom > "$files/large.bin"
+
+for server in $SERVERS; do
+	echo "== $server"
+	for engine in $ENGINES; do
+		start_server "$server" "$(bench_conf "$engine.conf" IoEngine=$engine)"
+		if [ "$engine" = io_uring ] && grep -q "falls back\|not available" "$WORK/server.log"; then
+			echo "$engine: not available on this kernel"
+		fi
+		for path in /index.html /_bench/large.bin; do
+			printf '%-10s %-18s ' "$engine" "$path"
+			run_wrk -c"$CONNS" "$URL$path"
+			printf '%-10s %-18s ' "$engine" "$path"
+			run_wrk_strace -c"$CONNS" "$URL$path"
+		done
+		stop_server
+	done
+done
@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# parse.sh
+#
+# Measure the request parsing rate of one core: the server is pinned
+# to CPU 0 while wrk runs on the other CPUs, and requests are
+# pipelined so that parsing rather than system calls dominates.
+# Reports requests/sec and server CPU time per request for a minimal,
+# a browser and an API client header set.
+#
+# Usage: bench/parse.sh [path]
+#   path      the requested path (default: /index.html)
+#   HEADERS   the header sets (default: minimal browser api)
+#   DEPTH     pipelining depth (default: 16)
+#   CONNS     persistent connections (default: 64)
+#
+. "$(dirname "$0")/common.sh"
+require wrk curl taskset
+
+path=${1:-/index.html}
+HEADERS=${HEADERS:-minimal browser api}
+DEPTH=${DEPTH:-16}
+CONNS=${CONNS:-64}
+ncpus=$(nproc)
+if [ "$ncpus" -lt 2 ]; then
+	echo "$(basename "$0"): needs a CPU for the server and one for wrk" >&2
+	exit 1
+fi
+WRK_PREFIX="taskset -c 1-$((ncpus - 1))"
+
+for server in $SERVERS; do
+	echo "== $server"
+	start_server "$server" "$(bench_conf parse.conf MaxPipelineDepth=$DEPTH)" "taskset -c 0"
+	for headers in $HEADERS; do
+		printf '%-8s ' "$headers"
+		run_wrk_cpu -c"$CONNS" -s "$BENCH_DIR/requests.lua" "$URL$path" -- "$DEPTH" "$headers"
+	done
+	stop_server
+done
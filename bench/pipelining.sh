@@ -0,0 +1,29 @@
+#!/bin/sh
+#
+# pipelining.sh
+#
+# Measure requests/sec with requests pipelined at depth 1, 8 and 32
+# on each persistent connection.
+#
+# Usage: bench/pipelining.sh [path]
+#   path      the requested path (default: /index.html)
+#   DEPTHS    the pipelining depths (default: 1 8 32)
+#   CONNS     persistent connections (default: 64)
+#
+. "$(dirname "$0")/common.sh"
+require wrk curl
+
+path=${1:-/index.html}
+DEPTHS=${DEPTHS:-1 8 32}
+CONNS=${CONNS:-64}
+
+for server in $SERVERS; do
+	echo "== $server"
+	# responses to the deepest pipeline are sent together
+	start_server "$server" "$(bench_conf pipelining.conf MaxPipelineDepth=32)"
+	for depth in $DEPTHS; do
+		printf 'depth %-4s ' "$depth"
+		run_wrk -c"$CONNS" -s "$BENCH_DIR/requests.lua" "$URL$path" -- "$depth"
+	done
+	stop_server
+done
@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# response.sh
+#
+# Measure how responses are written: system calls per response,
+# counted with strace, and TCP segments per response, counted with
+# nstat. Segments are counted for the whole host, so they include
+# the requests and acknowledgements of wrk on loopback; compare
+# builds rather than reading the numbers as absolute.
+#
+# Usage: bench/response.sh [paths]
+#   paths     the requested paths (default: /index.html /northeastern.png)
+#   CONNS     persistent connections (default: 16)
+#
+. "$(dirname "$0")/common.sh"
+require wrk curl strace nstat
+
+paths=${*:-/index.html /northeastern.png}
+CONNS=${CONNS:-16}
+
+# Print the TCP segments sent by the host since boot.
+out_segments() {
+	nstat -az TcpOutSegs | awk '$1 == "TcpOutSegs" { print $2 }'
+}
+
+for server in $SERVERS; do
+	echo "== $server"
+	start_server "$server" "$(bench_conf response.conf)"
+	for path in $paths; do
+		printf '%-18s ' "$path"
+		segs=$(out_segments)
+		run_wrk -c"$CONNS" "$URL$path" | awk '{ printf "%12s req/s ", $1 }'
+		awk -v segs=$(($(out_segments) - segs)) -v n="$(wrk_requests)" \
+			'BEGIN { printf "%8.2f segments/response\n", (n > 0) ? segs / n : 0 }'
+		printf '%-18s ' "$path"
+		run_wrk_strace -c"$CONNS" "$URL$path"
+	done
+	stop_server
+done
@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# scan.sh
+#
+# Compare the vectorized request head scanning with the scalar
+# functions, for typical browser headers and for a header block
+# that nearly fills the 8 KB receive buffer. A scalar server is
+# built from the tree with -DNO_X86_SIMD and measured after each
+# server in SERVERS, pinned to CPU 0 as in parse.sh.
+#
+# Usage: bench/scan.sh [path]
+#   path      the requested path (default: /index.html)
+#   HEADERS   the header sets (default: browser 8k)
+#   DEPTH     pipelining depth (default: 16)
+#   CONNS     persistent connections (default: 64)
+#   CFLAGS, LDFLAGS  also used for the scalar build
+#
+. "$(dirname "$0")/common.sh"
+require wrk curl taskset cmake
+
+path=${1:-/index.html}
+HEADERS=${HEADERS:-browser 8k}
+DEPTH=${DEPTH:-16}
+CONNS=${CONNS:-64}
+ncpus=$(nproc)
+if [ "$ncpus" -lt 2 ]; then
+	echo "$(basename "$0"): needs a CPU for the server and one for wrk" >&2
+	exit 1
+fi
+WRK_PREFIX="taskset -c 1-$((ncpus - 1))"
+
+echo "building the scalar server"
+cmake -S "$ROOT" -B "$WORK/scalar" -DCMAKE_BUILD_TYPE=Release -DCMAKE_C_FLAGS=-DNO_X86_SIMD > "$WORK/build.log" &&
+cmake --build "$WORK/scalar" --target http_server >> "$WORK/build.log" 2>&1 || {
+	cat "$WORK/build.log" >&2
+	exit 1
+}
+
+for server in $SERVERS "$WORK/scalar/http_server"; do
+	echo "== $server"
+	start_server "$server" "$(bench_conf scan.conf MaxPipelineDepth=$DEPTH)" "taskset -c 0"
+	for headers in $HEADERS; do
+		printf '%-8s ' "$headers"
+		run_wrk_cpu -c"$CONNS" -s "$BENCH_DIR/requests.lua" "$URL$path" -- "$DEPTH" "$headers"
+	done
+	stop_server
+done
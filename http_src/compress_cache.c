@@ -0,0 +1,452 @@
+/*
+ * compress_cache.c
+ *
+ * Functions that compress response bodies of compressible
+ * media types on the fly, and cache the compressed variants
+ * of files.
+ *
+ * Bodies are compressed with gzip by zlib. A compressed variant
+ * of a file is cached by path with the entity tag of the file it
+ * was compressed from, so a file is compressed once for each of
+ * its versions; variants of changed files are replaced when next
+ * requested, or evicted. Like the content cache, the cache is
+ * split into shards by path hash, each with an equal share of
+ * the byte limit and a least-recently-used list.
+ *
+ * The compression level adapts to the load average of the system:
+ * the configured level while the CPUs are mostly idle, and lower
+ * levels as they get busy, so compression does not take CPU time
+ * from serving requests.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+#include "compress_cache.h"
+#include "file_util.h"
+#include "file_cache.h"
+#include "time_util.h"
+#include "server_stats.h"
+
+/** number of cache shards (power of 2) */
+#define COMPRESS_CACHE_SHARDS 16
+
+/** number of hash buckets per shard (power of 2) */
+#define COMPRESS_CACHE_BUCKETS 64
+
+/** maximum compressible media types */
+#define MAX_COMPRESS_TYPES 32
+
+/** milliseconds between samples of the load average */
+#define LOAD_SAMPLE_MS 1000
+
+/** Definition of a cache shard */
+typedef struct CompressCacheShard {
+	pthread_mutex_t lock;         /** lock of shard */
+	CompressedBody *buckets[COMPRESS_CACHE_BUCKETS];  /** hash buckets of entries */
+	size_t nbytes;                /** bytes of cached variants */
+	size_t max_bytes;             /** maximum bytes of cached variants */
+	CompressedBody *lru_head;     /** most recently used entry */
+	CompressedBody *lru_tail;     /** least recently used entry */
+} CompressCacheShard;
+
+/** cache shards */
+static CompressCacheShard shards[COMPRESS_CACHE_SHARDS];
+
+/** compressible media types, with subtype "*" for all subtypes */
+static char compress_types[MAX_COMPRESS_TYPES][MAXBUF];
+static int ncompress_types = 0;
+
+/** length of the smallest body compressed */
+static size_t compress_min_size = 0;
+
+/** length of the largest file compressed */
+static size_t compress_max_size = 0;
+
+/** compression level while the CPUs are idle */
+static int compress_max_level = 0;
+
+/** compression level for the current load, and when it was sampled */
+static atomic_int compress_level = 0;
+static atomic_llong compress_level_sampled = 0;
+
+/**
+ * Initialize compression on the fly. Until called, or if there
+ * are no compressible types or zlib is not available, nothing
+ * is compressed.
+ *
+ * @param types the compressible media types separated by spaces,
+ *   each a type such as "text/html", or with subtype "*" for all subtypes
+ * @param min_size the length of the smallest body compressed
+ * @param cache_bytes maximum bytes of compressed variants cached,
+ *   which also limits the length of a file that is compressed
+ * @param max_level the compression level while the CPUs are idle
+ * @return true if successful, false if out of memory
+ */
+bool initCompression(const char *types, size_t min_size, size_t cache_bytes, int max_level) {
+	compress_min_size = min_size;
+	compress_max_size = cache_bytes / COMPRESS_CACHE_SHARDS;
+	compress_max_level = max_level;
+	atomic_store(&compress_level, max_level);
+	for (int i = 0; i < COMPRESS_CACHE_SHARDS; i++) {
+		CompressCacheShard *shard = &shards[i];
+		pthread_mutex_init(&shard->lock, NULL);
+		memset(shard->buckets, 0, sizeof(shard->buckets));
+		shard->nbytes = 0;
+		shard->max_bytes = compress_max_size;
+		shard->lru_head = shard->lru_tail = NULL;
+	}
+
+#if defined(HAVE_ZLIB)
+	ncompress_types = 0;
+	for (const char *p = types; *p != '\0'; ) {
+		p += strspn(p, " \t,");
+		size_t len = strcspn(p, " \t,");
+		if ((len > 0) && (len < MAXBUF) && (ncompress_types < MAX_COMPRESS_TYPES)) {
+			memcpy(compress_types[ncompress_types], p, len);
+			compress_types[ncompress_types++][len] = '\0';
+		}
+		p += len;
+	}
+#else
+	(void)types;
+#endif
+	return true;
+}
+
+/**
+ * Determines whether a body of a media type and length is
+ * compressed on the fly.
+ *
+ * @param mediaType the media type
+ * @param len the length of the body
+ * @return true if the body is compressed
+ */
+bool isCompressible(const char *mediaType, long long len) {
+	if ((len < (long long)compress_min_size) || (len > (long long)compress_max_size)) {
+		return false;
+	}
+	size_t typeLen = strcspn(mediaType, " ;");
+	for (int i = 0; i < ncompress_types; i++) {
+		const char *type = compress_types[i];
+		size_t n = strlen(type);
+		if ((n >= 2) && (strcmp(type + n - 2, "/*") == 0)) {
+			if (strncasecmp(mediaType, type, n - 1) == 0) {
+				return true;  // any subtype
+			}
+		} else if ((n == typeLen) && (strncasecmp(mediaType, type, n) == 0)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+#if defined(HAVE_ZLIB)
+
+/**
+ * Returns the compression level for the load average of the
+ * system, sampled at most once a second: the configured level
+ * while under half the CPUs are busy, a middle level until all
+ * are busy, and the fastest level beyond that.
+ *
+ * @return the compression level
+ */
+static int currentCompressLevel(void) {
+	long long now = monotonicMilliTime();
+	long long sampled = atomic_load_explicit(&compress_level_sampled, memory_order_relaxed);
+	if (   (now - sampled >= LOAD_SAMPLE_MS)
+		&& atomic_compare_exchange_strong(&compress_level_sampled, &sampled, now)) {
+		double load;
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		int level = compress_max_level;
+		if ((getloadavg(&load, 1) == 1) && (ncpus > 0)) {
+			if (load >= ncpus) {
+				level = Z_BEST_SPEED;
+			} else if (load >= ncpus / 2.0) {
+				level = (compress_max_level + Z_BEST_SPEED + 1) / 2;
+			}
+		}
+		atomic_store_explicit(&compress_level, level, memory_order_relaxed);
+	}
+	return atomic_load_explicit(&compress_level, memory_order_relaxed);
+}
+
+/**
+ * Compress bytes in memory with gzip.
+ *
+ * @param bytes the bytes
+ * @param len the number of bytes
+ * @param clen output length of the compressed bytes
+ * @return the compressed bytes to free, or NULL if not smaller
+ */
+static char *compressBytes(const char *bytes, size_t len, size_t *clen) {
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	// window bits 15 with 16 added for a gzip header and trailer
+	if (deflateInit2(&zs, currentCompressLevel(), Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return NULL;
+	}
+	size_t size = deflateBound(&zs, len);
+	char *cbytes = malloc(size);
+	if (cbytes == NULL) {
+		deflateEnd(&zs);
+		return NULL;
+	}
+	zs.next_in = (Bytef*)bytes;
+	zs.avail_in = len;
+	zs.next_out = (Bytef*)cbytes;
+	zs.avail_out = size;
+	int status = deflate(&zs, Z_FINISH);
+	*clen = zs.total_out;
+	deflateEnd(&zs);
+	if ((status != Z_STREAM_END) || (*clen >= len)) {
+		free(cbytes);  // failed or does not compress
+		return NULL;
+	}
+	return cbytes;
+}
+
+/**
+ * Compress bytes of a file that is not cached, such as a
+ * generated directory listing.
+ *
+ * @param fd the file
+ * @param len the number of bytes from offset 0
+ * @param clen output length of the compressed bytes
+ * @return the compressed bytes to free, or NULL if not compressed
+ */
+char *compressFileBytes(int fd, long long len, size_t *clen) {
+	char *bytes = malloc((len > 0) ? len : 1);
+	if (bytes == NULL) {
+		return NULL;
+	}
+	char *cbytes = NULL;
+	if (readFileBytes(fd, 0, bytes, len) == 0) {
+		cbytes = compressBytes(bytes, len, clen);
+	}
+	free(bytes);
+	return cbytes;
+}
+
+/**
+ * Unlink an entry from the least-recently-used list of a locked shard.
+ *
+ * @param shard the shard
+ * @param variant the entry
+ */
+static void unlinkLru(CompressCacheShard *shard, CompressedBody *variant) {
+	if (variant->lru_prev != NULL) {
+		variant->lru_prev->lru_next = variant->lru_next;
+	} else {
+		shard->lru_head = variant->lru_next;
+	}
+	if (variant->lru_next != NULL) {
+		variant->lru_next->lru_prev = variant->lru_prev;
+	} else {
+		shard->lru_tail = variant->lru_prev;
+	}
+	variant->lru_prev = variant->lru_next = NULL;
+}
+
+/**
+ * Link an entry as most recently used in a locked shard.
+ *
+ * @param shard the shard
+ * @param variant the entry
+ */
+static void linkLru(CompressCacheShard *shard, CompressedBody *variant) {
+	variant->lru_prev = NULL;
+	variant->lru_next = shard->lru_head;
+	if (shard->lru_head != NULL) {
+		shard->lru_head->lru_prev = variant;
+	} else {
+		shard->lru_tail = variant;
+	}
+	shard->lru_head = variant;
+}
+
+/**
+ * Free an entry that is no longer cached or used.
+ *
+ * @param variant the entry
+ */
+static void freeCompressedBody(CompressedBody *variant) {
+	free(variant->body);
+	free(variant);
+}
+
+/**
+ * Remove an entry from a locked shard, dropping the reference
+ * of the cache. The entry is freed if no request is using it.
+ *
+ * @param shard the shard
+ * @param variant the entry
+ */
+static void removeCompressedBody(CompressCacheShard *shard, CompressedBody *variant) {
+	CompressedBody **link = &shard->buckets[(variant->hash / COMPRESS_CACHE_SHARDS) % COMPRESS_CACHE_BUCKETS];
+	while (*link != variant) {
+		link = &(*link)->next;
+	}
+	*link = variant->next;
+	unlinkLru(shard, variant);
+	shard->nbytes -= variant->len;
+	if (--variant->refs == 0) {
+		freeCompressedBody(variant);
+	}
+}
+
+/**
+ * Find the entry for a path in a locked shard.
+ *
+ * @param shard the shard
+ * @param path the resolved path
+ * @param hash the hash of the path
+ * @return the entry, or NULL if none
+ */
+static CompressedBody *findCompressedBody(CompressCacheShard *shard, const char *path, size_t hash) {
+	CompressedBody *variant = shard->buckets[(hash / COMPRESS_CACHE_SHARDS) % COMPRESS_CACHE_BUCKETS];
+	while ((variant != NULL) && ((variant->hash != hash) || (strcmp(variant->path, path) != 0))) {
+		variant = variant->next;
+	}
+	return variant;
+}
+
+/**
+ * Find or make the compressed variant of a compressible file. A
+ * variant is compressed once for each version of the file, as
+ * identified by its entity tag. The caller must close the variant
+ * with closeCompressedBody().
+ *
+ * @param path the resolved path
+ * @param etag the entity tag of the file
+ * @param len the length of the file
+ * @param fd the open file, read if the body is not in memory
+ * @param body the file body in memory, or NULL to read the file
+ * @return the variant, or NULL if the file cannot be compressed
+ */
+CompressedBody *compressFileBody(const char *path, const char *etag, long long len, int fd, const char *body) {
+	size_t hash = hashCachedPath(path);
+	CompressCacheShard *shard = &shards[hash % COMPRESS_CACHE_SHARDS];
+	pthread_mutex_lock(&shard->lock);
+	CompressedBody *variant = findCompressedBody(shard, path, hash);
+	if ((variant != NULL) && (strcmp(variant->fileEtag, etag) == 0)) {
+		variant->refs++;
+		unlinkLru(shard, variant);
+		linkLru(shard, variant);
+		pthread_mutex_unlock(&shard->lock);
+		STAT_INCR(compress_cache_hits);
+		return variant;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	// compress without holding the lock
+	STAT_INCR(compress_cache_misses);
+	size_t pathLen = strlen(path);
+	variant = malloc(sizeof(CompressedBody) + pathLen + 1);
+	if (variant == NULL) {
+		return NULL;
+	}
+	if (body != NULL) {
+		variant->body = compressBytes(body, len, &variant->len);
+	} else {
+		variant->body = compressFileBytes(fd, len, &variant->len);
+	}
+	if (variant->body == NULL) {
+		free(variant);
+		return NULL;
+	}
+	memcpy(variant->path, path, pathLen + 1);
+	strcpy(variant->fileEtag, etag);
+	snprintf(variant->contentLength, sizeof(variant->contentLength), "%zu", variant->len);
+	// entity tag of the variant differs from that of the file
+	snprintf(variant->etag, sizeof(variant->etag), "%.*s-gz\"", (int)strlen(etag) - 1, etag);
+	variant->hash = hash;
+	variant->refs = 1;
+	variant->next = variant->lru_prev = variant->lru_next = NULL;
+	if ((*etag == 'W') || (variant->len > shard->max_bytes)) {
+		return variant;  // file is still changing, or too large to cache
+	}
+
+	// replace a variant of another version or one added meanwhile
+	pthread_mutex_lock(&shard->lock);
+	CompressedBody *stale = findCompressedBody(shard, path, hash);
+	if (stale != NULL) {
+		removeCompressedBody(shard, stale);
+	}
+	while ((shard->nbytes + variant->len > shard->max_bytes) && (shard->lru_tail != NULL)) {
+		removeCompressedBody(shard, shard->lru_tail);
+	}
+	CompressedBody **bucket = &shard->buckets[(hash / COMPRESS_CACHE_SHARDS) % COMPRESS_CACHE_BUCKETS];
+	variant->next = *bucket;
+	*bucket = variant;
+	linkLru(shard, variant);
+	shard->nbytes += variant->len;
+	variant->refs++;
+	pthread_mutex_unlock(&shard->lock);
+	return variant;
+}
+
+/**
+ * Release a variant returned by compressFileBody(). The variant
+ * is freed once it is no longer cached or used.
+ *
+ * @param variant the variant
+ */
+void closeCompressedBody(CompressedBody *variant) {
+	CompressCacheShard *shard = &shards[variant->hash % COMPRESS_CACHE_SHARDS];
+	pthread_mutex_lock(&shard->lock);
+	bool unused = (--variant->refs == 0);
+	pthread_mutex_unlock(&shard->lock);
+	if (unused) {
+		freeCompressedBody(variant);
+	}
+}
+
+#else
+
+/**
+ * Find or make the compressed variant of a compressible file.
+ * Not available without zlib.
+ *
+ * @param path the resolved path
+ * @param etag the entity tag of the file
+ * @param len the length of the file
+ * @param fd the open file, read if the body is not in memory
+ * @param body the file body in memory, or NULL to read the file
+ * @return NULL since the file cannot be compressed
+ */
+CompressedBody *compressFileBody(const char *path, const char *etag, long long len, int fd, const char *body) {
+	return NULL;
+}
+
+/**
+ * Release a variant returned by compressFileBody().
+ * Not available without zlib.
+ *
+ * @param variant the variant
+ */
+void closeCompressedBody(CompressedBody *variant) {
+}
+
+/**
+ * Compress bytes of a file that is not cached.
+ * Not available without zlib.
+ *
+ * @param fd the file
+ * @param len the number of bytes from offset 0
+ * @param clen output length of the compressed bytes
+ * @return NULL since the bytes cannot be compressed
+ */
+char *compressFileBytes(int fd, long long len, size_t *clen) {
+	return NULL;
+}
+
+#endif
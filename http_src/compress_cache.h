@@ -0,0 +1,94 @@
+/*
+ * compress_cache.h
+ *
+ * Functions that compress response bodies of compressible
+ * media types on the fly, and cache the compressed variants
+ * of files.
+ *
+ */
+
+#ifndef COMPRESS_CACHE_H_
+#define COMPRESS_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** index of the encoding compressed on the fly in precompressedEncodings */
+#define COMPRESSED_ENCODING 2
+
+/** Definition of a compressed variant of a file body */
+typedef struct CompressedBody {
+	char *body;                   /** gzip compressed body */
+	size_t len;                   /** length of compressed body */
+	char contentLength[24];       /** Content-Length header value */
+	char etag[72];                /** ETag header value of the variant */
+	char fileEtag[64];            /** ETag of the file that was compressed */
+
+	int refs;                     /** references by cache and requests */
+	size_t hash;                  /** hash of path */
+	struct CompressedBody *next;      /** next entry in hash bucket */
+	struct CompressedBody *lru_prev;  /** more recently used entry */
+	struct CompressedBody *lru_next;  /** less recently used entry */
+	char path[];                  /** resolved path */
+} CompressedBody;
+
+/**
+ * Initialize compression on the fly. Until called, or if there
+ * are no compressible types or zlib is not available, nothing
+ * is compressed.
+ *
+ * @param types the compressible media types separated by spaces,
+ *   each a type such as "text/html", or with subtype "*" for all subtypes
+ * @param min_size the length of the smallest body compressed
+ * @param cache_bytes maximum bytes of compressed variants cached,
+ *   which also limits the length of a file that is compressed
+ * @param max_level the compression level while the CPUs are idle
+ * @return true if successful, false if out of memory
+ */
+bool initCompression(const char *types, size_t min_size, size_t cache_bytes, int max_level);
+
+/**
+ * Determines whether a body of a media type and length is
+ * compressed on the fly.
+ *
+ * @param mediaType the media type
+ * @param len the length of the body
+ * @return true if the body is compressed
+ */
+bool isCompressible(const char *mediaType, long long len);
+
+/**
+ * Find or make the compressed variant of a compressible file. A
+ * variant is compressed once for each version of the file, as
+ * identified by its entity tag. The caller must close the variant
+ * with closeCompressedBody().
+ *
+ * @param path the resolved path
+ * @param etag the entity tag of the file
+ * @param len the length of the file
+ * @param fd the open file, read if the body is not in memory
+ * @param body the file body in memory, or NULL to read the file
+ * @return the variant, or NULL if the file cannot be compressed
+ */
+CompressedBody *compressFileBody(const char *path, const char *etag, long long len, int fd, const char *body);
+
+/**
+ * Release a variant returned by compressFileBody(). The variant
+ * is freed once it is no longer cached or used.
+ *
+ * @param variant the variant
+ */
+void closeCompressedBody(CompressedBody *variant);
+
+/**
+ * Compress bytes of a file that is not cached, such as a
+ * generated directory listing.
+ *
+ * @param fd the file
+ * @param len the number of bytes from offset 0
+ * @param clen output length of the compressed bytes
+ * @return the compressed bytes to free, or NULL if not compressed
+ */
+char *compressFileBytes(int fd, long long len, size_t *clen);
+
+#endif /* COMPRESS_CACHE_H_ */
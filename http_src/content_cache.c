@@ -0,0 +1,621 @@
+/*
+ * content_cache.c
+ *
+ * Functions that keep the bodies of small files in memory,
+ * invalidated by the server's own changes and by file
+ * system watches on the content tree.
+ *
+ * Like the open file cache, the cache is split into shards by
+ * path hash, each with its own lock, hash table and least-recently-
+ * used list, and entries are reference counted while requests
+ * send them. Each shard holds an equal share of the byte limit.
+ *
+ * On Linux, an inotify watch on every directory of the content
+ * tree invalidates a body as soon as its file changes, so a body
+ * is used without reading the file system until then. Elsewhere,
+ * or if a directory cannot be watched, such as beyond the inotify
+ * watch limit, a body is read again after the open file validation
+ * interval.
+ *
+ * Each body is stored after the head of its 200 response, in one
+ * block, so the common keep-alive response is copied to the stream
+ * as it is, except for the date.
+ *
+ */
+#if defined(__linux__)
+#define _GNU_SOURCE  // for DT_DIR
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#if defined(__linux__)
+#include <dirent.h>
+#include <sys/inotify.h>
+#endif
+#include "content_cache.h"
+#include "compress_cache.h"
+#include "listing_cache.h"
+#include "server_stats.h"
+#include "file_util.h"
+#include "http_codes.h"
+
+/** number of cache shards (power of 2) */
+#define CONTENT_CACHE_SHARDS 16
+
+/** Definition of a cache shard */
+typedef struct ContentCacheShard {
+	pthread_mutex_t lock;         /** lock of shard */
+	CachedContent **buckets;      /** hash buckets of entries */
+	size_t nbuckets;              /** number of buckets (power of 2) */
+	size_t nbytes;                /** bytes of cached bodies */
+	size_t max_bytes;             /** maximum bytes of cached bodies */
+	long long invalidated;        /** monotonic ms of last invalidation */
+	CachedContent *lru_head;      /** most recently used entry */
+	CachedContent *lru_tail;      /** least recently used entry */
+} ContentCacheShard;
+
+/** cache shards, with no buckets if caching is disabled */
+static ContentCacheShard shards[CONTENT_CACHE_SHARDS];
+
+/** maximum length of a cached body */
+static size_t content_cache_max_file = 0;
+
+/** milliseconds a body is used before it is read again if not watched */
+static int content_cache_valid_ms = 0;
+
+/** true once the content tree is watched for changes */
+static atomic_bool content_watched = false;
+
+/**
+ * Initialize the content cache. Until called, or if the maximum
+ * is 0, no bodies are cached.
+ *
+ * @param max_bytes maximum bytes of bodies in memory
+ * @param max_file maximum length of a cached body
+ * @param valid_ms milliseconds a body is used before it is read
+ *   again, unless file system watches invalidate it
+ * @return true if successful, false if out of memory
+ */
+bool initContentCache(size_t max_bytes, size_t max_file, int valid_ms) {
+	content_cache_max_file = max_file;
+	content_cache_valid_ms = valid_ms;
+	size_t shard_bytes = max_bytes / CONTENT_CACHE_SHARDS;
+	// enough buckets for bodies of a quarter of the maximum
+	size_t nbuckets = 16;
+	while ((max_file > 0) && (nbuckets < 8*shard_bytes/max_file)) {
+		nbuckets <<= 1;
+	}
+	for (int i = 0; i < CONTENT_CACHE_SHARDS; i++) {
+		ContentCacheShard *shard = &shards[i];
+		pthread_mutex_init(&shard->lock, NULL);
+		shard->nbytes = 0;
+		shard->max_bytes = shard_bytes;
+		shard->invalidated = 0;
+		shard->lru_head = shard->lru_tail = NULL;
+		shard->nbuckets = nbuckets;
+		shard->buckets = NULL;
+		if ((shard_bytes > 0) && (max_file > 0)) {
+			shard->buckets = calloc(nbuckets, sizeof(CachedContent*));
+			if (shard->buckets == NULL) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Free an entry that is no longer cached or used.
+ *
+ * @param content the entry
+ */
+static void freeCachedContent(CachedContent *content) {
+	free(content->response);
+	free(content);
+}
+
+/**
+ * Format the head of the 200 response for a file, with the Server
+ * and Date headers that every keep-alive response has, and the
+ * current date as a placeholder for the date of each response.
+ *
+ * @param file the open file
+ * @param vary true if the response varies by Accept-Encoding
+ * @param buf the buffer for the head
+ * @param size the size of the buffer
+ * @param dateOffset output offset of the Date value in the head
+ * @return the length of the head, or 0 if it does not fit
+ */
+static size_t formatResponseHead(const CachedFile *file, bool vary, char *buf, size_t size, size_t *dateOffset) {
+	int n = snprintf(buf, size, "%s %d %s %sServer: %s%sDate: ",
+					 server.server_protocol, Http_OK, httpCodeStr(Http_OK), CRLF,
+					 server.server_name, CRLF);
+	if ((n < 0) || ((size_t)n >= size)) {
+		return 0;
+	}
+	*dateOffset = n;
+	char date[RFC_1123_DATE_LEN];
+	int m = snprintf(buf + n, size - n,
+					 "%s%sContent-Length: %s%sLast-Modified: %s%sETag: %s%sAccept-Ranges: bytes%s"
+					 "%sContent-type: %s%s%s",
+					 currentRFC_1123_Date_Time(date), CRLF, file->contentLength, CRLF,
+					 file->lastModified, CRLF, file->etag, CRLF, CRLF,
+					 vary ? "Vary: Accept-Encoding" CRLF : "",
+					 file->mediaType, CRLF, CRLF);
+	if ((m < 0) || ((size_t)m >= size - n)) {
+		return 0;
+	}
+	return n + m;
+}
+
+/**
+ * Returns the hash bucket of a hash in a shard.
+ *
+ * @param shard the shard
+ * @param hash the hash of a path
+ * @return the bucket
+ */
+static CachedContent **contentBucket(ContentCacheShard *shard, size_t hash) {
+	return &shard->buckets[(hash / CONTENT_CACHE_SHARDS) & (shard->nbuckets - 1)];
+}
+
+/**
+ * Unlink an entry from the least-recently-used list of a locked shard.
+ *
+ * @param shard the shard
+ * @param content the entry
+ */
+static void unlinkLru(ContentCacheShard *shard, CachedContent *content) {
+	if (content->lru_prev != NULL) {
+		content->lru_prev->lru_next = content->lru_next;
+	} else {
+		shard->lru_head = content->lru_next;
+	}
+	if (content->lru_next != NULL) {
+		content->lru_next->lru_prev = content->lru_prev;
+	} else {
+		shard->lru_tail = content->lru_prev;
+	}
+	content->lru_prev = content->lru_next = NULL;
+}
+
+/**
+ * Link an entry as most recently used in a locked shard.
+ *
+ * @param shard the shard
+ * @param content the entry
+ */
+static void linkLru(ContentCacheShard *shard, CachedContent *content) {
+	content->lru_prev = NULL;
+	content->lru_next = shard->lru_head;
+	if (shard->lru_head != NULL) {
+		shard->lru_head->lru_prev = content;
+	} else {
+		shard->lru_tail = content;
+	}
+	shard->lru_head = content;
+}
+
+/**
+ * Find the entry for a path in a locked shard.
+ *
+ * @param shard the shard
+ * @param path the resolved path
+ * @param hash the hash of the path
+ * @return the entry, or NULL if none
+ */
+static CachedContent *findContent(ContentCacheShard *shard, const char *path, size_t hash) {
+	CachedContent *content = *contentBucket(shard, hash);
+	while ((content != NULL) && ((content->hash != hash) || (strcmp(content->path, path) != 0))) {
+		content = content->next;
+	}
+	return content;
+}
+
+/**
+ * Remove an entry from a locked shard, dropping the reference
+ * of the cache. The entry is freed if no request is using it.
+ *
+ * @param shard the shard
+ * @param content the entry
+ */
+static void removeContent(ContentCacheShard *shard, CachedContent *content) {
+	CachedContent **link = contentBucket(shard, content->hash);
+	while (*link != content) {
+		link = &(*link)->next;
+	}
+	*link = content->next;
+	unlinkLru(shard, content);
+	shard->nbytes -= content->len;
+	if (--content->refs == 0) {
+		freeCachedContent(content);
+	}
+}
+
+/**
+ * Find the cached body for a resolved path. The caller must
+ * close the entry with closeCachedContent().
+ *
+ * @param path the resolved path
+ * @return the entry, or NULL if the body is not cached
+ */
+CachedContent *findCachedContent(const char *path) {
+	size_t hash = hashCachedPath(path);
+	ContentCacheShard *shard = &shards[hash % CONTENT_CACHE_SHARDS];
+	if (shard->buckets == NULL) {
+		return NULL;  // caching disabled
+	}
+
+	pthread_mutex_lock(&shard->lock);
+	CachedContent *content = findContent(shard, path, hash);
+	if (   (content != NULL) && !atomic_load_explicit(&content_watched, memory_order_relaxed)
+		&& (monotonicMilliTime() - content->validated >= content_cache_valid_ms)) {
+		// without watches, the file may have changed
+		removeContent(shard, content);
+		content = NULL;
+	}
+	if (content != NULL) {
+		content->refs++;
+		unlinkLru(shard, content);
+		linkLru(shard, content);
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	if (content != NULL) {
+		STAT_INCR(content_cache_hits);
+	} else {
+		STAT_INCR(content_cache_misses);
+	}
+	return content;
+}
+
+/**
+ * Cache the body of a small regular file that was not found in
+ * the cache. A file with a weak entity tag was modified too recently
+ * to be cached. The caller must close the entry with closeCachedContent().
+ *
+ * @param path the resolved path
+ * @param file the open file for the path
+ * @return the entry, or NULL if the body is not cached
+ */
+CachedContent *cacheFileContent(const char *path, const CachedFile *file) {
+	size_t hash = hashCachedPath(path);
+	ContentCacheShard *shard = &shards[hash % CONTENT_CACHE_SHARDS];
+	size_t len = (size_t)file->sb.st_size;
+	if (   (shard->buckets == NULL) || (file->fd == -1) || (*file->etag == 'W')
+		|| (len > content_cache_max_file) || (len > shard->max_bytes)) {
+		return NULL;
+	}
+
+	// read the body without holding the lock
+	size_t pathLen = strlen(path);
+	CachedContent *content = malloc(sizeof(CachedContent) + pathLen + 1);
+	if (content == NULL) {
+		return NULL;
+	}
+	// a file with precompressed siblings or compressed on the fly
+	// varies by Accept-Encoding
+	content->vary = (file->siblings != 0) || isCompressible(file->mediaType, len);
+	char head[4*MAXBUF];
+	content->headLen = formatResponseHead(file, content->vary, head, sizeof(head), &content->dateOffset);
+	content->response = (content->headLen > 0) ? malloc(content->headLen + len) : NULL;
+	if (content->response == NULL) {
+		free(content);
+		return NULL;
+	}
+	memcpy(content->response, head, content->headLen);
+	content->body = content->response + content->headLen;
+	if (readFileBytes(file->fd, 0, content->body, len) != 0) {
+		freeCachedContent(content);  // file is shorter than its status
+		return NULL;
+	}
+	content->len = len;
+	memcpy(content->path, path, pathLen + 1);
+	strcpy(content->mediaType, file->mediaType);
+	strcpy(content->contentLength, file->contentLength);
+	strcpy(content->lastModified, file->lastModified);
+	strcpy(content->etag, file->etag);
+	content->modified = file->sb.st_mtime;
+	content->siblings = file->siblings;
+	content->validated = file->validated;
+	content->hash = hash;
+	content->refs = 1;
+	content->next = content->lru_prev = content->lru_next = NULL;
+
+	pthread_mutex_lock(&shard->lock);
+	if (content->validated <= shard->invalidated) {
+		// a file in the shard changed since the status was read
+		pthread_mutex_unlock(&shard->lock);
+		freeCachedContent(content);
+		return NULL;
+	}
+	CachedContent *stale = findContent(shard, path, hash);
+	if (stale != NULL) {
+		removeContent(shard, stale);
+	}
+	while ((shard->nbytes + len > shard->max_bytes) && (shard->lru_tail != NULL)) {
+		removeContent(shard, shard->lru_tail);
+		STAT_INCR(content_cache_evictions);
+	}
+	CachedContent **bucket = contentBucket(shard, hash);
+	content->next = *bucket;
+	*bucket = content;
+	linkLru(shard, content);
+	shard->nbytes += len;
+	content->refs++;
+	pthread_mutex_unlock(&shard->lock);
+	return content;
+}
+
+/**
+ * Send the precomputed response for a cached body with the date
+ * of this response. The head has only the response headers Server
+ * and Date, so it applies only when no other header is needed.
+ *
+ * @param ostream the output socket stream
+ * @param content the entry
+ * @param date the Date header value
+ * @param sendBody true to send the body (GET)
+ * @return true if the response was written to the stream
+ */
+bool sendCachedResponse(FILE *ostream, const CachedContent *content, const char *date, bool sendBody) {
+	size_t dateEnd = content->dateOffset + RFC_1123_DATE_LEN - 1;
+	size_t restLen = content->headLen - dateEnd + (sendBody ? content->len : 0);
+	return    (fwrite(content->response, 1, content->dateOffset, ostream) == content->dateOffset)
+		   && (fwrite(date, 1, RFC_1123_DATE_LEN - 1, ostream) == RFC_1123_DATE_LEN - 1)
+		   && (fwrite(content->response + dateEnd, 1, restLen, ostream) == restLen);
+}
+
+/**
+ * Release an entry returned by findCachedContent() or
+ * cacheFileContent(). The body is freed once the entry is
+ * no longer cached or used.
+ *
+ * @param content the entry
+ */
+void closeCachedContent(CachedContent *content) {
+	ContentCacheShard *shard = &shards[content->hash % CONTENT_CACHE_SHARDS];
+	pthread_mutex_lock(&shard->lock);
+	bool unused = (--content->refs == 0);
+	pthread_mutex_unlock(&shard->lock);
+	if (unused) {
+		freeCachedContent(content);
+	}
+}
+
+/**
+ * Remove the cached body for a path after its file changes.
+ * The body of the original of a precompressed sibling is also
+ * removed.
+ *
+ * @param path the resolved path
+ */
+void invalidateCachedContent(const char *path) {
+	char original[PATH_MAX];
+	if (precompressedOriginal(path, original, sizeof(original))) {
+		invalidateCachedContent(original);  // its siblings changed
+	}
+
+	size_t hash = hashCachedPath(path);
+	ContentCacheShard *shard = &shards[hash % CONTENT_CACHE_SHARDS];
+	if (shard->buckets == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&shard->lock);
+	shard->invalidated = monotonicMilliTime();
+	CachedContent *content = findContent(shard, path, hash);
+	if (content != NULL) {
+		removeContent(shard, content);
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
+
+/**
+ * Determines whether the content tree is watched for changes,
+ * so cached bodies and listings are used until they change.
+ *
+ * @return true if the content tree is watched
+ */
+bool isContentWatched(void) {
+	return atomic_load_explicit(&content_watched, memory_order_relaxed);
+}
+
+#if defined(__linux__)
+
+/** changes to a watched directory that invalidate cached bodies */
+#define CONTENT_WATCH_MASK \
+	(  IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE \
+	 | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+
+/** inotify instance watching the content tree */
+static int watch_fd = -1;
+
+/** paths of watched directories by watch descriptor */
+static char **watch_dirs = NULL;
+static int nwatch_dirs = 0;
+
+/**
+ * Remove every cached body, when changes cannot be matched
+ * to paths, such as a directory that moved.
+ */
+static void clearContentCache(void) {
+	for (int i = 0; i < CONTENT_CACHE_SHARDS; i++) {
+		ContentCacheShard *shard = &shards[i];
+		pthread_mutex_lock(&shard->lock);
+		shard->invalidated = monotonicMilliTime();
+		while (shard->lru_tail != NULL) {
+			removeContent(shard, shard->lru_tail);
+		}
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+/**
+ * Watch a directory and its subdirectories. A directory that is
+ * already watched keeps its watch descriptor with its new path.
+ * Watching stops at the first directory that cannot be watched,
+ * for example beyond the inotify watch limit, since changes to it
+ * would go unnoticed.
+ *
+ * @param dir the directory path
+ * @return true if the directory and all its subdirectories are watched
+ */
+static bool addContentWatches(const char *dir) {
+	int wd = inotify_add_watch(watch_fd, dir, CONTENT_WATCH_MASK);
+	if (wd < 0) {
+		perror("inotify_add_watch");
+		return false;
+	}
+	if (wd >= nwatch_dirs) {
+		int n = 2*wd + 16;
+		char **dirs = realloc(watch_dirs, n * sizeof(char*));
+		if (dirs == NULL) {
+			return false;
+		}
+		memset(dirs + nwatch_dirs, 0, (n - nwatch_dirs) * sizeof(char*));
+		watch_dirs = dirs;
+		nwatch_dirs = n;
+	}
+	free(watch_dirs[wd]);
+	watch_dirs[wd] = strdup(dir);
+
+	DIR *openDir = opendir(dir);
+	if ((watch_dirs[wd] == NULL) || (openDir == NULL)) {
+		if (openDir != NULL) {
+			closedir(openDir);
+		}
+		return false;
+	}
+	bool watched = true;
+	struct dirent *entry;
+	while (watched && ((entry = readdir(openDir)) != NULL)) {
+		if (   (entry->d_type == DT_DIR)
+			&& (strcmp(entry->d_name, ".") != 0) && (strcmp(entry->d_name, "..") != 0)) {
+			char path[PATH_MAX];
+			snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+			watched = addContentWatches(path);
+		}
+	}
+	closedir(openDir);
+	return watched;
+}
+
+/**
+ * Read changes to the content tree and invalidate the cached
+ * bodies and open files of the changed paths.
+ *
+ * @param arg unused
+ * @return NULL when the watches can no longer be read
+ */
+static void *runContentWatch(void *arg) {
+	(void)arg;
+	char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+	for (;;) {
+		ssize_t nread = read(watch_fd, buf, sizeof(buf));
+		if (nread <= 0) {
+			if ((nread < 0) && (errno == EINTR)) {
+				continue;
+			}
+			perror("runContentWatch");
+			break;
+		}
+		for (char *p = buf; p < buf + nread; ) {
+			const struct inotify_event *event = (const struct inotify_event*)p;
+			p += sizeof(struct inotify_event) + event->len;
+			if (event->mask & IN_Q_OVERFLOW) {
+				clearContentCache();  // changes were lost
+				clearListingCache();
+				continue;
+			}
+			if ((event->wd < 0) || (event->wd >= nwatch_dirs) || (watch_dirs[event->wd] == NULL)) {
+				continue;
+			}
+			if (event->mask & IN_IGNORED) {
+				free(watch_dirs[event->wd]);
+				watch_dirs[event->wd] = NULL;
+				continue;
+			}
+			if (event->len == 0) {
+				continue;  // change to the directory itself
+			}
+
+			char path[PATH_MAX];
+			snprintf(path, sizeof(path), "%s/%s", watch_dirs[event->wd], event->name);
+			invalidateCachedListing(path);
+			if (event->mask & IN_ISDIR) {
+				if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+					if (!addContentWatches(path) && atomic_exchange(&content_watched, false)) {
+						// bodies are validated by time from now on
+						fprintf(stderr, "Not watching %s: content changes are found by time\n", path);
+					}
+				} else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+					clearContentCache();  // bodies under the directory
+				}
+			} else {
+				invalidateCachedContent(path);
+				invalidateCachedFile(path);
+			}
+		}
+	}
+	atomic_store(&content_watched, false);
+	return NULL;
+}
+
+/**
+ * Watch the content tree for changes that invalidate cached
+ * bodies and open files, so that bodies are used until their
+ * files change. The watches are read by a thread of their own.
+ *
+ * @param content_base the content base directory
+ * @return true if every directory of the content tree is watched
+ */
+bool watchContentCache(const char *content_base) {
+	if (shards[0].buckets == NULL) {
+		return false;  // caching disabled
+	}
+	watch_fd = inotify_init1(IN_CLOEXEC);
+	if (watch_fd == -1) {
+		perror("inotify_init1");
+		return false;
+	}
+	if (!addContentWatches(content_base)) {
+		// bodies under an unwatched directory could be used after
+		// they change, so all bodies are validated by time instead
+		fprintf(stderr, "Not watching %s: content changes are found by time\n", content_base);
+		close(watch_fd);
+		watch_fd = -1;
+		return false;
+	}
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, runContentWatch, NULL) != 0) {
+		perror("pthread_create");
+		close(watch_fd);
+		return false;
+	}
+	pthread_detach(thread);
+	atomic_store(&content_watched, true);
+	return true;
+}
+
+#else
+
+/**
+ * Watch the content tree for changes that invalidate cached
+ * bodies. Not available on this system, so bodies are read
+ * again after the validation interval.
+ *
+ * @param content_base the content base directory
+ * @return false since the content tree is not watched
+ */
+bool watchContentCache(const char *content_base) {
+	return false;
+}
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * content_cache.h
+ *
+ * Functions that keep the bodies of small files in memory,
+ * invalidated by the server's own changes and by file
+ * system watches on the content tree.
+ *
+ */
+
+#ifndef CONTENT_CACHE_H_
+#define CONTENT_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "file_cache.h"
+
+/**
+ * Definition of a file body cached in memory. The body follows the
+ * head of its complete 200 response, so a keep-alive response is
+ * sent as one block with only the date filled in.
+ */
+typedef struct CachedContent {
+	char *response;               /** response head followed by body */
+	size_t headLen;               /** length of response head */
+	size_t dateOffset;            /** offset of Date value in response head */
+	char *body;                   /** file body, following the head */
+	size_t len;                   /** length of body */
+	char mediaType[MAXBUF];       /** media type of the file */
+	char contentLength[24];       /** Content-Length header value */
+	char lastModified[RFC_1123_DATE_LEN];  /** Last-Modified header value */
+	char etag[64];                /** ETag header value */
+	time_t modified;              /** modification time of the file */
+	unsigned siblings;            /** bit for each precompressed sibling found */
+	bool vary;                    /** true if the response varies by Accept-Encoding */
+
+	long long validated;          /** monotonic ms when file status was read */
+	int refs;                     /** references by cache and requests */
+	size_t hash;                  /** hash of path */
+	struct CachedContent *next;   /** next entry in hash bucket */
+	struct CachedContent *lru_prev;  /** more recently used entry */
+	struct CachedContent *lru_next;  /** less recently used entry */
+	char path[];                  /** resolved path */
+} CachedContent;
+
+/**
+ * Initialize the content cache. Until called, or if the maximum
+ * is 0, no bodies are cached.
+ *
+ * @param max_bytes maximum bytes of bodies in memory
+ * @param max_file maximum length of a cached body
+ * @param valid_ms milliseconds a body is used before it is read
+ *   again, unless file system watches invalidate it
+ * @return true if successful, false if out of memory
+ */
+bool initContentCache(size_t max_bytes, size_t max_file, int valid_ms);
+
+/**
+ * Watch the content tree for changes that invalidate cached
+ * bodies and open files, so that bodies are used until their
+ * files change. The watches are read by a thread of their own.
+ *
+ * @param content_base the content base directory
+ * @return true if every directory of the content tree is watched
+ */
+bool watchContentCache(const char *content_base);
+
+/**
+ * Determines whether the content tree is watched for changes,
+ * so cached bodies and listings are used until they change.
+ *
+ * @return true if the content tree is watched
+ */
+bool isContentWatched(void);
+
+/**
+ * Find the cached body for a resolved path. The caller must
+ * close the entry with closeCachedContent().
+ *
+ * @param path the resolved path
+ * @return the entry, or NULL if the body is not cached
+ */
+CachedContent *findCachedContent(const char *path);
+
+/**
+ * Cache the body of a small regular file that was not found in
+ * the cache. A file with a weak entity tag was modified too recently
+ * to be cached. The caller must close the entry with closeCachedContent().
+ *
+ * @param path the resolved path
+ * @param file the open file for the path
+ * @return the entry, or NULL if the body is not cached
+ */
+CachedContent *cacheFileContent(const char *path, const CachedFile *file);
+
+/**
+ * Send the precomputed response for a cached body with the date
+ * of this response. The head has only the response headers Server
+ * and Date, so it applies only when no other header is needed.
+ *
+ * @param ostream the output socket stream
+ * @param content the entry
+ * @param date the Date header value
+ * @param sendBody true to send the body (GET)
+ * @return true if the response was written to the stream
+ */
+bool sendCachedResponse(FILE *ostream, const CachedContent *content, const char *date, bool sendBody);
+
+/**
+ * Release an entry returned by findCachedContent() or
+ * cacheFileContent(). The body is freed once the entry is
+ * no longer cached or used.
+ *
+ * @param content the entry
+ */
+void closeCachedContent(CachedContent *content);
+
+/**
+ * Remove the cached body for a path after its file changes.
+ * The body of the original of a precompressed sibling is also
+ * removed.
+ *
+ * @param path the resolved path
+ */
+void invalidateCachedContent(const char *path);
+
+#endif /* CONTENT_CACHE_H_ */
@@ -0,0 +1,582 @@
+/*
+ * event_loop.c
+ *
+ * Functions that implement the event loop that accepts
+ * connections and dispatches ready requests to workers.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <poll.h>
+#endif
+#include "event_loop.h"
+#include "http_connection.h"
+#include "io_uring_util.h"
+#include "network_util.h"
+#include "http_server.h"
+#include "http_util.h"
+#include "server_stats.h"
+#include "time_util.h"
+#include "timer_wheel.h"
+#include "thpool.h"
+
+#if defined(__linux__)
+
+/** maximum milliseconds between checks for expired timers */
+#define MAX_TIMER_WAIT 1000
+
+#if defined(HAVE_IO_URING)
+/** io_uring submission entries */
+#define URING_ENTRIES 1024
+
+/** io_uring provided receive buffers */
+#define URING_BUFFERS 256
+
+/** io_uring buffer group of receive buffers */
+#define URING_BUF_GROUP 0
+
+/** operation tags in low bits of io_uring user data */
+#define URING_ACCEPT 1
+#define URING_RECV 2
+#define URING_POLL 3
+#define URING_TAG_MASK 3
+#endif
+
+/** Definition of an event loop */
+struct EventLoop {
+	enum IoEngine engine;         /** epoll or io_uring */
+	int epoll_fd;                 /** epoll instance */
+	int listen_sock_fd;           /** non-blocking listener socket */
+	int listener;                 /** index of the listener socket */
+	threadpool thpool;            /** workers that process requests */
+	void (*handler)(HttpConnection*);  /** worker function */
+
+	pthread_mutex_t timer_lock;   /** guards connection timers */
+	TimerWheel timers;            /** deadlines of waiting connections */
+
+#if defined(HAVE_IO_URING)
+	IoUring ring;                 /** io_uring instance */
+	IoUringBufRing bufring;       /** receive buffers provided to the ring */
+	pthread_mutex_t sq_lock;      /** guards submissions; taken after timer_lock */
+#endif
+};
+
+/**
+ * Start the deadline of a connection waiting in the event loop
+ * for its next request or the rest of a partial request.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ */
+static void add_connection_timer(EventLoop *loop, HttpConnection *conn) {
+	pthread_mutex_lock(&loop->timer_lock);
+	timer_wheel_add(&loop->timers, &conn->timer, connectionDeadline(conn));
+	pthread_mutex_unlock(&loop->timer_lock);
+}
+
+/**
+ * Stop the deadline of a connection if it has not expired.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ */
+static void remove_connection_timer(EventLoop *loop, HttpConnection *conn) {
+	pthread_mutex_lock(&loop->timer_lock);
+	timer_wheel_remove(&loop->timers, &conn->timer);
+	pthread_mutex_unlock(&loop->timer_lock);
+}
+
+/**
+ * Close connections whose deadline has passed and return the
+ * milliseconds until timers need to be checked again.
+ *
+ * @param loop the event loop
+ * @return wait timeout in milliseconds
+ */
+static int expire_connections(EventLoop *loop) {
+	long long now = monotonicMilliTime();
+
+	pthread_mutex_lock(&loop->timer_lock);
+	Timer *timer = timer_wheel_expire(&loop->timers, now);
+	while (timer != NULL) {
+		HttpConnection *conn = timer_entry(timer, HttpConnection, timer);
+		timer = timer->next;
+		timeoutConnection(conn);
+		if (loop->engine == IoEngine_IoUring) {
+			// a receive is still pending: shutting down the socket completes
+			// it, and the connection is deleted with its completion
+			shutdown(conn->sock_fd, SHUT_RDWR);
+		} else {
+			// closing the socket also removes it from epoll
+			deleteHttpConnection(conn);
+		}
+	}
+	int timeout = timer_wheel_timeout(&loop->timers, now);
+	pthread_mutex_unlock(&loop->timer_lock);
+
+	// workers add timers while the loop waits, so check at least this often
+	if ((timeout < 0) || (timeout > MAX_TIMER_WAIT)) {
+		timeout = MAX_TIMER_WAIT;
+	}
+	return timeout;
+}
+
+/**
+ * Admit a newly accepted connection, or shed it while the job
+ * queue is full, since a new connection would only wait behind
+ * the connections already queued for a worker.
+ *
+ * @param loop the event loop
+ * @param sock_fd the peer socket
+ * @return the connection or NULL if shed or unavailable
+ */
+static HttpConnection *admit_connection(EventLoop *loop, int sock_fd) {
+	STAT_INCR(connections_accepted);
+	STAT_INCR(listener_accepted[loop->listener]);
+	if (   (server.max_queued_connections > 0)
+		&& (thpool_num_jobs_queued(loop->thpool) >= server.max_queued_connections)) {
+		shedConnection(sock_fd);
+		return NULL;
+	}
+	HttpConnection *conn = newHttpConnection(sock_fd);
+	if (conn != NULL) {
+		conn->loop = loop;
+	}
+	return conn;
+}
+
+/**
+ * Hand a connection with request bytes to a worker. The
+ * connection is closed if the job cannot be queued, since
+ * nothing else would serve or close it.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ */
+static void dispatch_connection(EventLoop *loop, HttpConnection *conn) {
+	if (thpool_add_work(loop->thpool, (void*)loop->handler, conn) != 0) {
+		deleteHttpConnection(conn);
+	}
+}
+
+/**
+ * Arm the connection for a single read-ready notification.
+ *
+ * @param loop the event loop
+ * @param conn the connection
+ * @param op EPOLL_CTL_ADD or EPOLL_CTL_MOD
+ * @return 0 if successful, -1 if error
+ */
+static int arm_connection(EventLoop *loop, HttpConnection *conn, int op) {
+	// one-shot: disarmed once dispatched until worker is done
+	struct epoll_event ev = {
+		.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT,
+		.data.ptr = conn
+	};
+	return epoll_ctl(loop->epoll_fd, op, conn->sock_fd, &ev);
+}
+
+/**
+ * Accept all pending connections on the edge-triggered listener
+ * and register each one to wait for its first request.
+ *
+ * @param loop the event loop
+ */
+static void accept_connections(EventLoop *loop) {
+	int sock_fd;
+	while ((sock_fd = accept_pending_connection(loop->listen_sock_fd)) != 0) {
+		HttpConnection *conn = admit_connection(loop, sock_fd);
+		if (conn == NULL) {
+			continue;
+		}
+		add_connection_timer(loop, conn);
+		if (arm_connection(loop, conn, EPOLL_CTL_ADD) != 0) {
+			perror("epoll_ctl");
+			remove_connection_timer(loop, conn);
+			deleteHttpConnection(conn);
+		}
+	}
+}
+
+#if defined(HAVE_IO_URING)
+
+/**
+ * Submit an io_uring operation for the event loop. Workers
+ * submit while the event loop waits, so submission is locked.
+ *
+ * @param loop the event loop
+ * @param conn the connection or NULL for accept
+ * @param tag the operation: URING_ACCEPT, URING_RECV or URING_POLL
+ * @return 0 if successful, -1 if error
+ */
+static int submit_uring_op(EventLoop *loop, HttpConnection *conn, int tag) {
+	pthread_mutex_lock(&loop->sq_lock);
+	struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+	if (sqe == NULL) {
+		pthread_mutex_unlock(&loop->sq_lock);
+		errno = EBUSY;
+		return -1;
+	}
+	switch (tag) {
+	case URING_ACCEPT:
+		// multishot: completes once per connection until it fails
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->fd = loop->listen_sock_fd;
+		sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+		break;
+	case URING_RECV: {
+		// kernel picks a provided buffer only once bytes arrive,
+		// so idle connections do not hold receive buffers; receive
+		// no more than the connection buffer can take
+		size_t nfree = connectionBufferSpace(conn);
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = conn->sock_fd;
+		sqe->len = (unsigned)((nfree < loop->bufring.buf_size) ? nfree : loop->bufring.buf_size);
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = loop->bufring.bgid;
+		break;
+	}
+	case URING_POLL:
+		// readiness only: the worker receives the request itself
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = conn->sock_fd;
+		sqe->poll_events = POLLIN;
+		break;
+	}
+	sqe->user_data = (uintptr_t)conn | tag;
+	int ret = uring_submit_and_wait(&loop->ring, 0, 0);
+	if (ret <= 0) {
+		// an entry left queued would be submitted with the next one,
+		// after the caller deleted the connection
+		uring_unqueue_sqes(&loop->ring);
+	}
+	pthread_mutex_unlock(&loop->sq_lock);
+	if (ret <= 0) {
+		errno = (ret < 0) ? -ret : EBUSY;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Handle an io_uring completion: register accepted connections,
+ * and hand connections with received request bytes to a worker.
+ *
+ * @param loop the event loop
+ * @param cqe the completion
+ */
+static void complete_uring_op(EventLoop *loop, const struct io_uring_cqe *cqe) {
+	int tag = (int)(cqe->user_data & URING_TAG_MASK);
+	HttpConnection *conn = (HttpConnection*)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_TAG_MASK);
+
+	switch (tag) {
+	case URING_ACCEPT:
+		if (cqe->res >= 0) {
+			conn = admit_connection(loop, cqe->res);
+			if (conn != NULL) {
+				add_connection_timer(loop, conn);
+				if (submit_uring_op(loop, conn, URING_RECV) != 0) {
+					perror("submit_uring_op");
+					remove_connection_timer(loop, conn);
+					deleteHttpConnection(conn);
+				}
+			}
+		}
+		if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+			// multishot accept ended: submit it again
+			if (submit_uring_op(loop, NULL, URING_ACCEPT) != 0) {
+				perror("submit_uring_op");
+			}
+		}
+		break;
+
+	case URING_RECV:
+		remove_connection_timer(loop, conn);
+		if (cqe->res > 0) {
+			// request bytes are ready: hand the connection to a worker
+			size_t nappended = appendConnectionBytes(conn, uring_buf(&loop->bufring, cqe->flags), cqe->res);
+			uring_recycle_buf(&loop->bufring, cqe->flags);
+			if (nappended == (size_t)cqe->res) {
+				dispatch_connection(loop, conn);
+			} else {
+				// receive was sized to the free space, so this is
+				// not expected; closing beats losing request bytes
+				deleteHttpConnection(conn);
+			}
+		} else if (cqe->res == -ENOBUFS) {
+			// all receive buffers in use: wait for readiness instead
+			add_connection_timer(loop, conn);
+			if (submit_uring_op(loop, conn, URING_POLL) != 0) {
+				perror("submit_uring_op");
+				remove_connection_timer(loop, conn);
+				deleteHttpConnection(conn);
+			}
+		} else {
+			// peer closed, error, or shut down when its timer expired
+			deleteHttpConnection(conn);
+		}
+		break;
+
+	case URING_POLL:
+		remove_connection_timer(loop, conn);
+		if ((cqe->res > 0) && (cqe->res & POLLIN)) {
+			dispatch_connection(loop, conn);
+		} else {
+			deleteHttpConnection(conn);
+		}
+		break;
+	}
+}
+
+/**
+ * Run the event loop on io_uring. Connections are accepted by
+ * one multishot accept, and each idle connection has one receive
+ * pending into a shared ring of provided buffers, so a worker
+ * starts with the first request bytes already buffered.
+ *
+ * @param loop the event loop
+ * @return -1 if io_uring is not available
+ */
+static int run_uring_loop(EventLoop *loop) {
+	if (uring_init(&loop->ring, URING_ENTRIES) != 0) {
+		perror("io_uring_setup");
+		return -1;
+	}
+	if (   ((loop->ring.features & IORING_FEAT_EXT_ARG) == 0)
+		|| (uring_setup_buf_ring(&loop->ring, &loop->bufring, URING_BUF_GROUP,
+								 URING_BUFFERS, CONN_BUFSIZE) != 0)) {
+		fprintf(stderr, "run_event_loop: io_uring features not available on this system\n");
+		uring_exit(&loop->ring);
+		return -1;
+	}
+	pthread_mutex_init(&loop->sq_lock, NULL);
+	if (submit_uring_op(loop, NULL, URING_ACCEPT) != 0) {
+		perror("submit_uring_op");
+		uring_exit(&loop->ring);
+		return -1;
+	}
+
+	int timeout = -1;
+	while (true) {
+		int ret = uring_wait(&loop->ring, 1, timeout);
+		if ((ret < 0) && (ret != -ETIME)) {
+			fprintf(stderr, "io_uring_enter: %s\n", strerror(-ret));
+			break;
+		}
+
+		struct io_uring_cqe *cqe;
+		while ((cqe = uring_peek_cqe(&loop->ring)) != NULL) {
+			// free the completion slot before handling it
+			struct io_uring_cqe done = *cqe;
+			uring_cqe_seen(&loop->ring);
+			complete_uring_op(loop, &done);
+		}
+
+		// expiring only shuts down sockets, so a completion still
+		// in the ring never refers to a deleted connection
+		timeout = expire_connections(loop);
+	}
+
+	uring_exit(&loop->ring);
+	return 0;
+}
+
+#else
+
+/**
+ * Run the event loop on io_uring.
+ * Not available on this system.
+ *
+ * @param loop the event loop
+ * @return -1 since io_uring is not available on this system
+ */
+static int run_uring_loop(EventLoop *loop) {
+	(void)loop;
+	fprintf(stderr, "run_event_loop: io_uring not available on this system\n");
+	return -1;
+}
+
+#endif
+
+/**
+ * Return a connection to its event loop to wait
+ * for the next request or the rest of a partial
+ * request. If a complete request head is already
+ * buffered, the connection is queued for a worker.
+ *
+ * @param conn the connection
+ */
+void resume_connection(HttpConnection *conn) {
+	EventLoop *loop = conn->loop;
+
+	// a complete request head is already buffered, so no event
+	// will arrive for it: queue behind other work
+	if (hasRequestHead(conn)) {
+		dispatch_connection(loop, conn);
+		return;
+	}
+
+	// timer must be pending before an event can be delivered, and
+	// the loop must not expire the connection before it is armed,
+	// so both happen under the timer lock; once it is released the
+	// connection belongs to the loop
+	pthread_mutex_lock(&loop->timer_lock);
+	timer_wheel_add(&loop->timers, &conn->timer, connectionDeadline(conn));
+	int status;
+#if defined(HAVE_IO_URING)
+	if (loop->engine == IoEngine_IoUring) {
+		status = submit_uring_op(loop, conn, URING_RECV);
+	} else
+#endif
+	status = arm_connection(loop, conn, EPOLL_CTL_MOD);
+	if (status != 0) {
+		timer_wheel_remove(&loop->timers, &conn->timer);
+	}
+	pthread_mutex_unlock(&loop->timer_lock);
+	if (status != 0) {
+		perror("resume_connection");
+		deleteHttpConnection(conn);
+	}
+}
+
+/**
+ * Run an epoll reactor on the listener socket. The listener
+ * is edge-triggered, and each accepted connection is handed
+ * to a worker in the thread pool only once it has request
+ * bytes ready to read, so idle connections and the accept
+ * itself never occupy a worker thread.
+ *
+ * The worker either deletes the connection or returns it
+ * to the event loop with resume_connection(). A connection
+ * waiting in the event loop has a deadline on a timer wheel:
+ * the keep-alive timeout between requests, or the request line
+ * and header timeouts once a request has started. The event
+ * loop answers 408 and closes connections that miss it.
+ *
+ * With the io_uring engine, connections are accepted and
+ * their first request bytes received on an io_uring instead,
+ * falling back to epoll if io_uring is not available.
+ *
+ * Each listener sharing the server port runs its own event
+ * loop, and all of them hand connections to the same workers.
+ *
+ * @param listen_sock_fd the listener socket
+ * @param listener the index of the listener socket
+ * @param thpool the thread pool that processes requests
+ * @param handler the worker function called with the connection
+ * @return -1 if the event loop is not available on this system
+ */
+int run_event_loop(int listen_sock_fd, int listener, threadpool thpool, void (*handler)(HttpConnection*)) {
+	EventLoop loop = {
+		.engine = server.io_engine,
+		.listen_sock_fd = listen_sock_fd,
+		.listener = listener,
+		.thpool = thpool,
+		.handler = handler
+	};
+	pthread_mutex_init(&loop.timer_lock, NULL);
+	timer_wheel_init(&loop.timers, monotonicMilliTime());
+
+	if (loop.engine == IoEngine_IoUring) {
+		if (run_uring_loop(&loop) == 0) {
+			return 0;
+		}
+		fprintf(stderr, "Falling back to epoll I/O engine\n");
+		loop.engine = server.io_engine = IoEngine_Epoll;
+	}
+
+	loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop.epoll_fd == -1) {
+		perror("epoll_create1");
+		return -1;
+	}
+
+	// edge-triggered accept requires a non-blocking listener;
+	// the listener is the only registration without a connection
+	struct epoll_event ev = {.events = EPOLLIN | EPOLLET, .data.ptr = NULL};
+	if (   (set_socket_nonblocking(listen_sock_fd, true) != 0)
+		|| (epoll_ctl(loop.epoll_fd, EPOLL_CTL_ADD, listen_sock_fd, &ev) != 0)) {
+		perror("run_event_loop");
+		close(loop.epoll_fd);
+		return -1;
+	}
+
+	struct epoll_event events[MAX_EVENTS];
+	int timeout = -1;
+	while (true) {
+		int nevents = epoll_wait(loop.epoll_fd, events, MAX_EVENTS, timeout);
+		if (nevents == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("epoll_wait");
+			break;
+		}
+
+		for (int i = 0; i < nevents; i++) {
+			HttpConnection *conn = events[i].data.ptr;
+			if (conn == NULL) {
+				accept_connections(&loop);
+				continue;
+			}
+
+			remove_connection_timer(&loop, conn);
+			if ((events[i].events & EPOLLIN) == 0) {
+				// error or hangup without a request to read
+				deleteHttpConnection(conn);
+			} else {
+				// request bytes are ready: hand the connection to a worker
+				dispatch_connection(&loop, conn);
+			}
+		}
+
+		// events are handled before expiring so none refers to a closed connection
+		timeout = expire_connections(&loop);
+	}
+
+	close(loop.epoll_fd);
+	return 0;
+}
+
+#else
+
+/**
+ * Run an epoll reactor on the listener socket.
+ * Not available on this system.
+ *
+ * @param listen_sock_fd the listener socket
+ * @param listener the index of the listener socket
+ * @param thpool the thread pool that processes requests
+ * @param handler the worker function called with the connection
+ * @return -1 since the event loop is not available on this system
+ */
+int run_event_loop(int listen_sock_fd, int listener, threadpool thpool, void (*handler)(HttpConnection*)) {
+	(void)listen_sock_fd;
+	(void)listener;
+	(void)thpool;
+	(void)handler;
+	fprintf(stderr, "run_event_loop: epoll not available on this system\n");
+	return -1;
+}
+
+/**
+ * Return a connection to its event loop.
+ * Not available on this system.
+ *
+ * @param conn the connection
+ */
+void resume_connection(HttpConnection *conn) {
+	deleteHttpConnection(conn);
+}
+
+#endif
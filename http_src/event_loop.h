@@ -0,0 +1,60 @@
+/*
+ * event_loop.h
+ *
+ * Functions that implement the event loop that accepts
+ * connections and dispatches ready requests to workers.
+ *
+ */
+
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include "http_connection.h"
+#include "thpool.h"
+
+/** maximum number of events returned by one wait */
+#define MAX_EVENTS 64
+
+/** Declaration of EventLoop as opaque type */
+typedef struct EventLoop EventLoop;
+
+/**
+ * Run an epoll reactor on the listener socket. The listener
+ * is edge-triggered, and each accepted connection is handed
+ * to a worker in the thread pool only once it has request
+ * bytes ready to read, so idle connections and the accept
+ * itself never occupy a worker thread.
+ *
+ * The worker either deletes the connection or returns it
+ * to the event loop with resume_connection(). A connection
+ * waiting in the event loop has a deadline on a timer wheel:
+ * the keep-alive timeout between requests, or the request line
+ * and header timeouts once a request has started. The event
+ * loop answers 408 and closes connections that miss it.
+ *
+ * With the io_uring engine, connections are accepted and
+ * their first request bytes received on an io_uring instead,
+ * falling back to epoll if io_uring is not available.
+ *
+ * Each listener sharing the server port runs its own event
+ * loop, and all of them hand connections to the same workers.
+ *
+ * @param listen_sock_fd the listener socket
+ * @param listener the index of the listener socket
+ * @param thpool the thread pool that processes requests
+ * @param handler the worker function called with the connection
+ * @return -1 if the event loop is not available on this system
+ */
+int run_event_loop(int listen_sock_fd, int listener, threadpool thpool, void (*handler)(HttpConnection*));
+
+/**
+ * Return a connection to its event loop to wait
+ * for the next request or the rest of a partial
+ * request. If a complete request head is already
+ * buffered, the connection is queued for a worker.
+ *
+ * @param conn the connection
+ */
+void resume_connection(HttpConnection *conn);
+
+#endif /* EVENT_LOOP_H_ */
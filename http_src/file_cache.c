@@ -0,0 +1,380 @@
+/*
+ * file_cache.c
+ *
+ * Functions that cache open files and their metadata by
+ * resolved path, including paths that were not found.
+ *
+ * The cache is split into shards by path hash, each with its
+ * own lock, hash table and least-recently-used list, so workers
+ * serving different files rarely wait for each other. An entry
+ * is reference counted: one reference while it is cached and
+ * one for each request using it, so an evicted or replaced file
+ * stays open until the last request sending it is done.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "file_cache.h"
+#include "media_util.h"
+#include "server_stats.h"
+
+/** number of cache shards (power of 2) */
+#define FILE_CACHE_SHARDS 16
+
+/** Definition of a cache shard */
+typedef struct FileCacheShard {
+	pthread_mutex_t lock;         /** lock of shard */
+	CachedFile **buckets;         /** hash buckets of entries */
+	size_t nbuckets;              /** number of buckets (power of 2) */
+	size_t nentries;              /** number of entries */
+	size_t max_entries;           /** maximum entries */
+	CachedFile *lru_head;         /** most recently used entry */
+	CachedFile *lru_tail;         /** least recently used entry */
+} FileCacheShard;
+
+/** cache shards, with no buckets if caching is disabled */
+static FileCacheShard shards[FILE_CACHE_SHARDS];
+
+/** precompressed encodings in order of preference */
+const PrecompressedEncoding precompressedEncodings[NUM_PRECOMPRESSED] = {
+	{"br", ".br"},
+	{"zstd", ".zst"},
+	{"gzip", ".gz"}
+};
+
+/** milliseconds an entry is used before its status is read again */
+static int file_cache_valid_ms = 0;
+
+/**
+ * Returns the FNV-1a hash of a path, which also selects
+ * its shard in caches keyed by path.
+ *
+ * @param path the path
+ * @return the hash
+ */
+size_t hashCachedPath(const char *path) {
+	size_t hash = 14695981039346656037ULL;
+	for (const unsigned char *p = (const unsigned char*)path; *p != '\0'; p++) {
+		hash = (hash ^ *p) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**
+ * Initialize the open file cache. Until called, or if the
+ * maximum is 0, every lookup reads the file system.
+ *
+ * @param max_entries maximum entries kept open
+ * @param valid_ms milliseconds an entry is used before its
+ *   file status is read again
+ * @return true if successful, false if out of memory
+ */
+bool initFileCache(size_t max_entries, int valid_ms) {
+	file_cache_valid_ms = valid_ms;
+	size_t shard_entries = (max_entries + FILE_CACHE_SHARDS - 1) / FILE_CACHE_SHARDS;
+	size_t nbuckets = 1;
+	while (nbuckets < 2*shard_entries) {
+		nbuckets <<= 1;
+	}
+	for (int i = 0; i < FILE_CACHE_SHARDS; i++) {
+		FileCacheShard *shard = &shards[i];
+		pthread_mutex_init(&shard->lock, NULL);
+		shard->nentries = 0;
+		shard->max_entries = shard_entries;
+		shard->lru_head = shard->lru_tail = NULL;
+		shard->nbuckets = nbuckets;
+		shard->buckets = NULL;
+		if (shard_entries > 0) {
+			shard->buckets = calloc(nbuckets, sizeof(CachedFile*));
+			if (shard->buckets == NULL) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Read the status of the file at a path and open it if
+ * it is a regular file, formatting its header values.
+ *
+ * @param path the resolved path
+ * @param hash the hash of the path
+ * @return the new entry with one reference, or NULL if out of memory
+ */
+static CachedFile *newCachedFile(const char *path, size_t hash) {
+	size_t pathLen = strlen(path);
+	CachedFile *file = malloc(sizeof(CachedFile) + pathLen + 1);
+	if (file == NULL) {
+		return NULL;
+	}
+	memcpy(file->path, path, pathLen + 1);
+	file->hash = hash;
+	file->refs = 1;
+	file->next = file->lru_prev = file->lru_next = NULL;
+	file->validated = monotonicMilliTime();
+	file->error = 0;
+	file->fd = -1;
+	file->siblings = 0;
+
+	if (stat(path, &file->sb) != 0) {
+		file->error = errno;
+		return file;
+	}
+	if (S_ISREG(file->sb.st_mode)) {
+		file->fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (file->fd == -1) {
+			file->error = errno;
+			return file;
+		}
+	}
+
+	// precompressed siblings are found with the status of the
+	// file, so negotiating an encoding reads no file status
+	char sibling[PATH_MAX];
+	struct stat sb;
+	if (server.precompressed && S_ISREG(file->sb.st_mode)) {
+		for (int i = 0; i < NUM_PRECOMPRESSED; i++) {
+			snprintf(sibling, sizeof(sibling), "%s%s", path, precompressedEncodings[i].ext);
+			if ((stat(sibling, &sb) == 0) && S_ISREG(sb.st_mode)) {
+				file->siblings |= 1u << i;
+			}
+		}
+	}
+
+	getMediaType(path, file->mediaType);
+	snprintf(file->contentLength, sizeof(file->contentLength), "%lld", (long long)file->sb.st_size);
+	cachedTimeToRFC_1123_Date_Time(file->sb.st_mtime, file->lastModified);
+	// entity tag from inode, length and modification time; weak while
+	// the file may still change within the second it was modified
+	bool weak = (file->sb.st_mtime >= time(NULL) - 1);
+	snprintf(file->etag, sizeof(file->etag), "%s\"%llx-%llx-%llx\"", weak ? "W/" : "",
+			 (unsigned long long)file->sb.st_ino, (unsigned long long)file->sb.st_size,
+			 (unsigned long long)file->sb.st_mtime);
+	return file;
+}
+
+/**
+ * Free an entry that is no longer cached or used.
+ *
+ * @param file the entry
+ */
+static void freeCachedFile(CachedFile *file) {
+	if (file->fd != -1) {
+		close(file->fd);
+	}
+	free(file);
+}
+
+/**
+ * Find the entry for a path in a locked shard.
+ *
+ * @param shard the shard
+ * @param path the resolved path
+ * @param hash the hash of the path
+ * @return the entry, or NULL if none
+ */
+static CachedFile *findCachedFile(FileCacheShard *shard, const char *path, size_t hash) {
+	CachedFile *file = shard->buckets[(hash / FILE_CACHE_SHARDS) & (shard->nbuckets - 1)];
+	while ((file != NULL) && ((file->hash != hash) || (strcmp(file->path, path) != 0))) {
+		file = file->next;
+	}
+	return file;
+}
+
+/**
+ * Unlink an entry from the least-recently-used list of a locked shard.
+ *
+ * @param shard the shard
+ * @param file the entry
+ */
+static void unlinkLru(FileCacheShard *shard, CachedFile *file) {
+	if (file->lru_prev != NULL) {
+		file->lru_prev->lru_next = file->lru_next;
+	} else {
+		shard->lru_head = file->lru_next;
+	}
+	if (file->lru_next != NULL) {
+		file->lru_next->lru_prev = file->lru_prev;
+	} else {
+		shard->lru_tail = file->lru_prev;
+	}
+	file->lru_prev = file->lru_next = NULL;
+}
+
+/**
+ * Link an entry as most recently used in a locked shard.
+ *
+ * @param shard the shard
+ * @param file the entry
+ */
+static void linkLru(FileCacheShard *shard, CachedFile *file) {
+	file->lru_prev = NULL;
+	file->lru_next = shard->lru_head;
+	if (shard->lru_head != NULL) {
+		shard->lru_head->lru_prev = file;
+	} else {
+		shard->lru_tail = file;
+	}
+	shard->lru_head = file;
+}
+
+/**
+ * Remove an entry from a locked shard, dropping the reference
+ * of the cache. The entry is freed if no request is using it.
+ *
+ * @param shard the shard
+ * @param file the entry
+ */
+static void removeCachedFile(FileCacheShard *shard, CachedFile *file) {
+	CachedFile **link = &shard->buckets[(file->hash / FILE_CACHE_SHARDS) & (shard->nbuckets - 1)];
+	while (*link != file) {
+		link = &(*link)->next;
+	}
+	*link = file->next;
+	unlinkLru(shard, file);
+	shard->nentries--;
+	if (--file->refs == 0) {
+		freeCachedFile(file);
+	}
+}
+
+/**
+ * Add an entry to a locked shard with a reference for the
+ * cache, evicting least recently used entries over the maximum.
+ *
+ * @param shard the shard
+ * @param file the entry
+ */
+static void insertCachedFile(FileCacheShard *shard, CachedFile *file) {
+	while ((shard->nentries >= shard->max_entries) && (shard->lru_tail != NULL)) {
+		removeCachedFile(shard, shard->lru_tail);
+	}
+	CachedFile **bucket = &shard->buckets[(file->hash / FILE_CACHE_SHARDS) & (shard->nbuckets - 1)];
+	file->next = *bucket;
+	*bucket = file;
+	linkLru(shard, file);
+	shard->nentries++;
+	file->refs++;
+}
+
+/**
+ * Open the file at a resolved path, using the cached entry while
+ * it is valid. A file that was not found is cached too, with its
+ * error. The caller must close the entry with closeCachedFile().
+ *
+ * @param path the resolved path
+ * @return the entry, or NULL if out of memory
+ */
+CachedFile *openCachedFile(const char *path) {
+	size_t hash = hashCachedPath(path);
+	FileCacheShard *shard = &shards[hash % FILE_CACHE_SHARDS];
+	if (shard->buckets == NULL) {
+		return newCachedFile(path, hash);  // caching disabled
+	}
+
+	pthread_mutex_lock(&shard->lock);
+	CachedFile *file = findCachedFile(shard, path, hash);
+	if ((file != NULL) && (monotonicMilliTime() - file->validated < file_cache_valid_ms)) {
+		file->refs++;
+		unlinkLru(shard, file);
+		linkLru(shard, file);
+		pthread_mutex_unlock(&shard->lock);
+		STAT_INCR(file_cache_hits);
+		return file;
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	// read the file system without holding the lock
+	STAT_INCR(file_cache_misses);
+	file = newCachedFile(path, hash);
+	if (file == NULL) {
+		return NULL;
+	}
+
+	// replace a stale entry or one added meanwhile
+	pthread_mutex_lock(&shard->lock);
+	CachedFile *stale = findCachedFile(shard, path, hash);
+	if (stale != NULL) {
+		removeCachedFile(shard, stale);
+	}
+	insertCachedFile(shard, file);
+	pthread_mutex_unlock(&shard->lock);
+	return file;
+}
+
+/**
+ * Release an entry returned by openCachedFile(). The file is
+ * closed once the entry is no longer cached or used.
+ *
+ * @param file the entry
+ */
+void closeCachedFile(CachedFile *file) {
+	FileCacheShard *shard = &shards[file->hash % FILE_CACHE_SHARDS];
+	if (shard->buckets == NULL) {
+		freeCachedFile(file);
+		return;
+	}
+	pthread_mutex_lock(&shard->lock);
+	bool unused = (--file->refs == 0);
+	pthread_mutex_unlock(&shard->lock);
+	if (unused) {
+		freeCachedFile(file);
+	}
+}
+
+/**
+ * Returns the path of the file that a path is the precompressed
+ * sibling of, which is cached with the encodings it has.
+ *
+ * @param path the path
+ * @param original the buffer for the original path
+ * @param size the size of the buffer
+ * @return true if the path ends with a precompressed extension
+ */
+bool precompressedOriginal(const char *path, char *original, size_t size) {
+	size_t len = strlen(path);
+	for (int i = 0; i < NUM_PRECOMPRESSED; i++) {
+		size_t extLen = strlen(precompressedEncodings[i].ext);
+		if ((len > extLen) && (len - extLen < size)
+			&& (strcmp(path + len - extLen, precompressedEncodings[i].ext) == 0)) {
+			memcpy(original, path, len - extLen);
+			original[len - extLen] = '\0';
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Remove the entry for a path from the cache after the
+ * server changes the file. The entry of the original of a
+ * precompressed sibling is also removed.
+ *
+ * @param path the resolved path
+ */
+void invalidateCachedFile(const char *path) {
+	char original[PATH_MAX];
+	if (precompressedOriginal(path, original, sizeof(original))) {
+		invalidateCachedFile(original);  // its siblings changed
+	}
+
+	size_t hash = hashCachedPath(path);
+	FileCacheShard *shard = &shards[hash % FILE_CACHE_SHARDS];
+	if (shard->buckets == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&shard->lock);
+	CachedFile *file = findCachedFile(shard, path, hash);
+	if (file != NULL) {
+		removeCachedFile(shard, file);
+	}
+	pthread_mutex_unlock(&shard->lock);
+}
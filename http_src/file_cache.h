@@ -0,0 +1,108 @@
+/*
+ * file_cache.h
+ *
+ * Functions that cache open files and their metadata by
+ * resolved path, including paths that were not found.
+ *
+ */
+
+#ifndef FILE_CACHE_H_
+#define FILE_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include "http_server.h"
+#include "time_util.h"
+
+/** number of precompressed encodings */
+#define NUM_PRECOMPRESSED 3
+
+/** Definition of an encoding of precompressed siblings of files */
+typedef struct PrecompressedEncoding {
+	const char *name;             /** content coding (RFC 7231 3.1.2.1) */
+	const char *ext;              /** extension added to the file name */
+} PrecompressedEncoding;
+
+/** precompressed encodings in order of preference */
+extern const PrecompressedEncoding precompressedEncodings[NUM_PRECOMPRESSED];
+
+/** Definition of a cached file */
+typedef struct CachedFile {
+	int error;                    /** errno of failed stat or open, 0 if found */
+	int fd;                       /** file opened for reading, -1 if not a regular file */
+	struct stat sb;               /** file status if found */
+	char mediaType[MAXBUF];       /** media type of the file */
+	char contentLength[24];       /** Content-Length header value */
+	char lastModified[RFC_1123_DATE_LEN];  /** Last-Modified header value */
+	char etag[64];                /** ETag header value */
+	unsigned siblings;            /** bit for each precompressed sibling found */
+
+	long long validated;          /** monotonic ms when status was read */
+	int refs;                     /** references by cache and requests */
+	size_t hash;                  /** hash of path */
+	struct CachedFile *next;      /** next entry in hash bucket */
+	struct CachedFile *lru_prev;  /** more recently used entry */
+	struct CachedFile *lru_next;  /** less recently used entry */
+	char path[];                  /** resolved path */
+} CachedFile;
+
+/**
+ * Returns the FNV-1a hash of a path, which also selects
+ * its shard in caches keyed by path.
+ *
+ * @param path the path
+ * @return the hash
+ */
+size_t hashCachedPath(const char *path);
+
+/**
+ * Initialize the open file cache. Until called, or if the
+ * maximum is 0, every lookup reads the file system.
+ *
+ * @param max_entries maximum entries kept open
+ * @param valid_ms milliseconds an entry is used before its
+ *   file status is read again
+ * @return true if successful, false if out of memory
+ */
+bool initFileCache(size_t max_entries, int valid_ms);
+
+/**
+ * Open the file at a resolved path, using the cached entry while
+ * it is valid. A file that was not found is cached too, with its
+ * error. The caller must close the entry with closeCachedFile().
+ *
+ * @param path the resolved path
+ * @return the entry, or NULL if out of memory
+ */
+CachedFile *openCachedFile(const char *path);
+
+/**
+ * Release an entry returned by openCachedFile(). The file is
+ * closed once the entry is no longer cached or used.
+ *
+ * @param file the entry
+ */
+void closeCachedFile(CachedFile *file);
+
+/**
+ * Returns the path of the file that a path is the precompressed
+ * sibling of, which is cached with the encodings it has.
+ *
+ * @param path the path
+ * @param original the buffer for the original path
+ * @param size the size of the buffer
+ * @return true if the path ends with a precompressed extension
+ */
+bool precompressedOriginal(const char *path, char *original, size_t size);
+
+/**
+ * Remove the entry for a path from the cache after the
+ * server changes the file. The entry of the original of a
+ * precompressed sibling is also removed.
+ *
+ * @param path the resolved path
+ */
+void invalidateCachedFile(const char *path);
+
+#endif /* FILE_CACHE_H_ */
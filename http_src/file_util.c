@@ -5,25 +5,17 @@
  *
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <sys/param.h>
 #include "http_server.h"
 #include "file_util.h"
 
-/**
- * This function creates a temporary stream for this string.
- * When the FILE is closed, it will be automatically removed.
- *
- * @param contentStr the content of the file
- * @return the FILE for this string
- */
-FILE *tmpStringFile(const char *contentStr) {
-	FILE *tmpstream = tmpfile();
-	fwrite(contentStr, 1, strlen(contentStr), tmpstream);
-	rewind(tmpstream);
-	return tmpstream;
-}
+/** file mode creation mask of the process */
+static mode_t creationMask = 022;
 
 /**
  * This function calls fstat() on the file descriptor of the
@@ -44,24 +36,84 @@ int fileStat(FILE *stream, struct stat *buf) {
  * @param istream the input stream
  * @param ostream the output stream
  * @param nbytes the number of bytes to send
- * @param return 0 if successful
+ * @return 0 if successful, -1 if error or the input ended first
  */
-int copyFileStreamBytes(FILE *istream, FILE *ostream, int nbytes) {
-	char *buf[MAXBUF];
-    while ((nbytes > 0) && !feof(istream)) {
-    	int ntoread = (nbytes < MAXBUF) ? nbytes : MAXBUF;
+int copyFileStreamBytes(FILE *istream, FILE *ostream, long long nbytes) {
+	char buf[8192];
+    while (nbytes > 0) {
+    	size_t ntoread = (nbytes < (long long)sizeof(buf)) ? (size_t)nbytes : sizeof(buf);
         size_t nread = fread(buf, sizeof(char), ntoread, istream);
-        if (nread > 0) {
-			if (fwrite(buf, sizeof(char), nread, ostream) < nread) {
-				perror("copyFileStreamBytes");
-				return -1;
-			}
-			nbytes -= nread;
-		}
+        if (nread == 0) {
+            return -1;  // error or end of input
+        }
+        if (fwrite(buf, sizeof(char), nread, ostream) < nread) {
+            perror("copyFileStreamBytes");
+            return -1;
+        }
+        nbytes -= nread;
     }
     return 0;
 }
 
+/**
+ * Copy bytes from a file descriptor at an offset to an output
+ * stream. The file position is not used, so threads can share
+ * the descriptor.
+ *
+ * @param fd the file descriptor
+ * @param offset the offset of the first byte
+ * @param ostream the output stream
+ * @param nbytes the number of bytes to copy
+ * @return 0 if successful, -1 if error
+ */
+int copyFileBytes(int fd, long long offset, FILE *ostream, long long nbytes) {
+	char buf[8192];
+	while (nbytes > 0) {
+		size_t ntoread = (nbytes < (long long)sizeof(buf)) ? (size_t)nbytes : sizeof(buf);
+		ssize_t nread = pread(fd, buf, ntoread, offset);
+		if (nread <= 0) {
+			if ((nread < 0) && (errno == EINTR)) {
+				continue;
+			}
+			return -1;  // error or file is shorter than expected
+		}
+		if (fwrite(buf, sizeof(char), nread, ostream) < (size_t)nread) {
+			perror("copyFileBytes");
+			return -1;
+		}
+		offset += nread;
+		nbytes -= nread;
+	}
+	return 0;
+}
+
+/**
+ * Read bytes from a file descriptor at an offset into memory.
+ * The file position is not used, so threads can share the
+ * descriptor.
+ *
+ * @param fd the file descriptor
+ * @param offset the offset of the first byte
+ * @param buf the buffer for the bytes
+ * @param nbytes the number of bytes to read
+ * @return 0 if successful, -1 if error
+ */
+int readFileBytes(int fd, long long offset, char *buf, long long nbytes) {
+	while (nbytes > 0) {
+		ssize_t nread = pread(fd, buf, nbytes, offset);
+		if (nread <= 0) {
+			if ((nread < 0) && (errno == EINTR)) {
+				continue;
+			}
+			return -1;  // error or file is shorter than expected
+		}
+		buf += nread;
+		offset += nread;
+		nbytes -= nread;
+	}
+	return 0;
+}
+
 /**
  * Returns path component of the file path without trailing
  * path separator. If no path component, returns NULL.
@@ -161,3 +213,56 @@ int mkdirs(const char *path, mode_t mode) {
 	}
 	return 0;
 }
+
+/**
+ * Record the file mode creation mask of the process. Must be
+ * called before other threads start, since reading the mask
+ * briefly changes it.
+ */
+void initFileCreationMask(void) {
+	creationMask = umask(0);
+	umask(creationMask);
+}
+
+/**
+ * Returns the permissions of a new file created with fopen(),
+ * 0666 less the file mode creation mask.
+ *
+ * @return the permissions
+ */
+mode_t fileCreationMode(void) {
+	return 0666 & ~creationMask;
+}
+
+/**
+ * Create a temporary file in the directory of a file path, to be
+ * renamed over the path once it is completely written, so that
+ * the file at the path is replaced whole or not at all.
+ *
+ * @param filePath the path of the file that will be replaced
+ * @param tempPath return buffer of at least MAXPATHLEN bytes
+ *   for the path of the temporary file
+ * @param mode the permissions of the temporary file
+ * @return the stream for the temporary file, or NULL if error
+ */
+FILE *createTempFile(const char *filePath, char *tempPath, mode_t mode) {
+	char pathOfFile[MAXPATHLEN];
+	if (getPath(filePath, pathOfFile) == NULL) {
+		strcpy(pathOfFile, ".");
+	}
+	if (snprintf(tempPath, MAXPATHLEN, "%s/.upload.XXXXXX", pathOfFile) >= MAXPATHLEN) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+	int fd = mkstemp(tempPath);
+	if (fd == -1) {
+		return NULL;
+	}
+	// mkstemp creates the file readable only by its owner
+	FILE *stream = (fchmod(fd, mode) == 0) ? fdopen(fd, "w") : NULL;
+	if (stream == NULL) {
+		close(fd);
+		unlink(tempPath);
+	}
+	return stream;
+}
@@ -18,15 +18,6 @@
 #define st_atim st_atimespec
 #endif
 
-/**
- * This function creates a temporary stream for this string.
- * When the FILE is closed, it will be automatically removed.
- *
- * @param contentStr the content of the file
- * @return the FILE for this string
- */
-FILE *tmpStringFile(const char *contentStr);
-
 /**
  * This function calls fstat() on the file descriptor of the
  * specified stream.
@@ -42,9 +33,35 @@ int fileStat(FILE *stream, struct stat *buf);
  * @param istream the input stream
  * @param ostream the output stream
  * @param nbytes the number of bytes to send
- * @param return 0 if successful
+ * @return 0 if successful, -1 if error or the input ended first
+ */
+int copyFileStreamBytes(FILE *istream, FILE *ostream, long long nbytes);
+
+/**
+ * Copy bytes from a file descriptor at an offset to an output
+ * stream. The file position is not used, so threads can share
+ * the descriptor.
+ *
+ * @param fd the file descriptor
+ * @param offset the offset of the first byte
+ * @param ostream the output stream
+ * @param nbytes the number of bytes to copy
+ * @return 0 if successful, -1 if error
+ */
+int copyFileBytes(int fd, long long offset, FILE *ostream, long long nbytes);
+
+/**
+ * Read bytes from a file descriptor at an offset into memory.
+ * The file position is not used, so threads can share the
+ * descriptor.
+ *
+ * @param fd the file descriptor
+ * @param offset the offset of the first byte
+ * @param buf the buffer for the bytes
+ * @param nbytes the number of bytes to read
+ * @return 0 if successful, -1 if error
  */
-int copyFileStreamBytes(FILE *istream, FILE *ostream, int nbytes);
+int readFileBytes(int fd, long long offset, char *buf, long long nbytes);
 
 /**
  * Returns path component of the file path without trailing
@@ -96,4 +113,32 @@ char *makeFilePath(const char *path, const char *name, char *filepath);
  */
 int mkdirs(const char *path, mode_t mode);
 
+/**
+ * Record the file mode creation mask of the process. Must be
+ * called before other threads start, since reading the mask
+ * briefly changes it.
+ */
+void initFileCreationMask(void);
+
+/**
+ * Returns the permissions of a new file created with fopen(),
+ * 0666 less the file mode creation mask.
+ *
+ * @return the permissions
+ */
+mode_t fileCreationMode(void);
+
+/**
+ * Create a temporary file in the directory of a file path, to be
+ * renamed over the path once it is completely written, so that
+ * the file at the path is replaced whole or not at all.
+ *
+ * @param filePath the path of the file that will be replaced
+ * @param tempPath return buffer of at least MAXPATHLEN bytes
+ *   for the path of the temporary file
+ * @param mode the permissions of the temporary file
+ * @return the stream for the temporary file, or NULL if error
+ */
+FILE *createTempFile(const char *filePath, char *tempPath, mode_t mode);
+
 #endif /* FILE_UTIL_H_ */
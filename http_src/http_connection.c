@@ -0,0 +1,530 @@
+/*
+ * http_connection.c
+ *
+ * Functions that manage the state of a client connection
+ * across the requests served on it.
+ *
+ */
+#if defined(__linux__)
+#define _GNU_SOURCE  // for fopencookie
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "http_connection.h"
+#include "http_server.h"
+#include "network_util.h"
+#include "time_util.h"
+
+/**
+ * Returns the milliseconds left of a timeout that bounds a whole
+ * phase of a request, such as its body, rather than each wait.
+ *
+ * @param start monotonic ms when the phase began, 0 if not started
+ * @param timeout the timeout in seconds
+ * @return milliseconds left, 0 if the time is up
+ */
+static int phaseTimeLeft(long long start, int timeout) {
+	if (start == 0) {
+		return timeout*1000;
+	}
+	long long left = start + timeout*1000LL - monotonicMilliTime();
+	return (left > 0) ? (int)left : 0;
+}
+
+#if defined(__linux__)
+/**
+ * Send bytes from the response stream of a connection. Until the
+ * stream is flushed at the end of a batch, more bytes follow, so
+ * the kernel holds a partial segment for them rather than sending
+ * the status line, headers and body in separate packets.
+ *
+ * @param cookie the connection
+ * @param buf the bytes to send
+ * @param nbytes the number of bytes
+ * @return number of bytes sent, -1 if error
+ */
+static ssize_t sendConnectionStream(void *cookie, const char *buf, size_t nbytes) {
+	HttpConnection *conn = cookie;
+	int flags = MSG_NOSIGNAL | MSG_DONTWAIT | (conn->flushing ? 0 : MSG_MORE);
+	size_t nsent = 0;
+	while (nsent < nbytes) {
+		ssize_t n = send(conn->sock_fd, buf + nsent, nbytes - nsent, flags);
+		if (n > 0) {
+			nsent += n;
+		} else if ((n == -1) && (errno == EINTR)) {
+			continue;
+		} else if ((n == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+			// wait no longer than the write timeout of the response body
+			int left = phaseTimeLeft(conn->write_start, server.write_timeout);
+			if ((left == 0) || !wait_socket_writable(conn->sock_fd, left)) {
+				errno = EAGAIN;
+				break;
+			}
+		} else {
+			break;
+		}
+	}
+	if (nsent > 0) {
+		conn->held = !conn->flushing;
+	}
+	return (nsent > 0) ? (ssize_t)nsent : -1;
+}
+
+/**
+ * Close the socket of the response stream of a connection.
+ *
+ * @param cookie the connection
+ * @return 0 if successful, -1 if error
+ */
+static int closeConnectionStream(void *cookie) {
+	HttpConnection *conn = cookie;
+	return close(conn->sock_fd);
+}
+#endif
+
+/**
+ * Open the socket of a connection as a buffered response stream.
+ *
+ * @param conn the connection
+ * @return the stream or NULL if error
+ */
+static FILE *openConnectionStream(HttpConnection *conn) {
+#if defined(__linux__)
+	cookie_io_functions_t io = {
+		.read = NULL, .write = sendConnectionStream, .seek = NULL, .close = closeConnectionStream
+	};
+	return fopencookie(conn, "w", io);
+#else
+	return fdopen(conn->sock_fd, "w");
+#endif
+}
+
+/**
+ * Create a new connection for a peer socket.
+ * The connection owns the socket from now on.
+ *
+ * @param sock_fd the peer socket
+ * @return the connection or NULL if unavailable
+ */
+HttpConnection *newHttpConnection(int sock_fd) {
+	HttpConnection *conn = malloc(sizeof(HttpConnection));
+	if (conn == NULL) {
+		close(sock_fd);
+		return NULL;
+	}
+	conn->sock_fd = sock_fd;
+	conn->in_start = conn->in_end = 0;
+	initRequestParser(&conn->parser, CONN_BUFSIZE, MAXBUF-1);
+	conn->nrequests = 0;
+	conn->keep_alive = false;
+	conn->chunked = false;
+	conn->body_remaining = 0;
+	conn->body_chunked = false;
+	conn->expect_continue = false;
+	conn->flushing = conn->held = false;
+	conn->idle_start = monotonicMilliTime();
+	conn->request_start = 0;
+	conn->body_start = conn->write_start = 0;
+	conn->loop = NULL;
+	timer_init(&conn->timer);
+
+	// open socket as a response stream
+	conn->stream = openConnectionStream(conn);
+	if (conn->stream == NULL) {
+		perror("openConnectionStream");
+		close(sock_fd);
+		free(conn);
+		return NULL;
+	}
+	// queue responses to pipelined requests until flushed; each flush
+	// is a complete batch, so send it without waiting on delayed acks
+	setvbuf(conn->stream, NULL, _IOFBF, CONN_BUFSIZE);
+	set_socket_nodelay(sock_fd, true);
+
+#if defined(__linux__)
+	// reads and writes wait with the time left of the body and write
+	// timeouts, which bound the whole body however slowly it moves
+	set_socket_nonblocking(sock_fd, true);
+#else
+	// writes through the stream can only be bounded by a send timeout
+	set_socket_timeouts(sock_fd, server.body_timeout*1000, server.write_timeout*1000);
+#endif
+
+	return conn;
+}
+
+/**
+ * Delete a connection, flushing and closing its socket.
+ *
+ * @param conn the connection
+ */
+void deleteHttpConnection(HttpConnection *conn) {
+	// closing the stream also closes the socket
+	flushConnection(conn);
+	fclose(conn->stream);
+	free(conn);
+}
+
+/**
+ * Record the arrival of bytes of a request.
+ *
+ * @param conn the connection
+ */
+static void startRequest(HttpConnection *conn) {
+	if (conn->request_start == 0) {
+		conn->request_start = monotonicMilliTime();
+	}
+}
+
+/**
+ * Receive bytes of the request body from the peer, waiting no
+ * longer than the body timeout allows from the start of the body.
+ *
+ * @param conn the connection
+ * @param buf the buffer for the bytes
+ * @param nbytes the maximum number of bytes to receive
+ * @return number of bytes received, 0 if peer closed, -1 if error
+ *   (EAGAIN if the body timed out)
+ */
+static ssize_t receiveBodyBytes(HttpConnection *conn, void *buf, size_t nbytes) {
+	for (;;) {
+		ssize_t nread = recv(conn->sock_fd, buf, nbytes, MSG_DONTWAIT);
+		if (nread >= 0) {
+			return nread;
+		}
+		if (errno == EINTR) {
+			continue;
+		}
+		if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+			return -1;
+		}
+		int left = phaseTimeLeft(conn->body_start, server.body_timeout);
+		if ((left == 0) || !wait_socket_readable(conn->sock_fd, left)) {
+			errno = EAGAIN;
+			return -1;
+		}
+	}
+}
+
+/**
+ * Receive more bytes from the peer into the receive buffer,
+ * first moving unread bytes to the start of the buffer.
+ *
+ * @param conn the connection
+ * @param flags recv flags: MSG_DONTWAIT not to wait, or 0 to
+ *   wait for bytes of the request body
+ * @return number of bytes received, 0 if peer closed or
+ *   buffer full, -1 if error
+ */
+static ssize_t fillConnection(HttpConnection *conn, int flags) {
+	// send queued responses before waiting for the peer
+	flushConnection(conn);
+
+	if (conn->in_start > 0) {
+		memmove(conn->in_buf, conn->in_buf + conn->in_start, conn->in_end - conn->in_start);
+		conn->in_end -= conn->in_start;
+		conn->in_start = 0;
+	}
+	if (conn->in_end == CONN_BUFSIZE) {
+		return 0;
+	}
+
+	ssize_t nread;
+	if ((flags & MSG_DONTWAIT) == 0) {
+		nread = receiveBodyBytes(conn, conn->in_buf + conn->in_end, CONN_BUFSIZE - conn->in_end);
+	} else {
+		while (((nread = recv(conn->sock_fd, conn->in_buf + conn->in_end,
+				              CONN_BUFSIZE - conn->in_end, flags)) == -1) && (errno == EINTR)) {}
+	}
+	if (nread > 0) {
+		conn->in_end += nread;
+		startRequest(conn);
+	}
+	return nread;
+}
+
+/**
+ * Reads up to nbytes from the connection, using buffered
+ * bytes first. Queued responses are flushed before waiting
+ * for more bytes from the peer.
+ *
+ * @param conn the connection
+ * @param buf the buffer for the bytes
+ * @param nbytes the maximum number of bytes to read
+ * @return number of bytes read, 0 if peer closed, -1 if error
+ */
+ssize_t readConnectionBytes(HttpConnection *conn, void *buf, size_t nbytes) {
+	size_t navail = conn->in_end - conn->in_start;
+	if (navail > 0) {
+		size_t ncopy = (nbytes < navail) ? nbytes : navail;
+		memcpy(buf, conn->in_buf + conn->in_start, ncopy);
+		conn->in_start += ncopy;
+		return ncopy;
+	}
+
+	// nothing buffered: receive directly into caller buffer
+	flushConnection(conn);
+	return receiveBodyBytes(conn, buf, nbytes);
+}
+
+/**
+ * Reads a line from the connection through the receive
+ * buffer, without its line ending (LF or CRLF). Queued
+ * responses are flushed before waiting for more bytes
+ * from the peer.
+ *
+ * @param conn the connection
+ * @param line the buffer for the null-terminated line
+ * @param size the size of the buffer
+ * @return length of the line, or -1 if error, if peer closed
+ *   (ECONNRESET), or if the line does not fit (EMSGSIZE)
+ */
+ssize_t readConnectionLine(HttpConnection *conn, char *line, size_t size) {
+	for (;;) {
+		char *start = conn->in_buf + conn->in_start;
+		size_t navail = conn->in_end - conn->in_start;
+		char *eol = memchr(start, '\n', navail);
+		if (eol != NULL) {
+			size_t len = eol - start;
+			conn->in_start += len + 1;
+			if ((len > 0) && (start[len-1] == '\r')) {
+				len--;
+			}
+			if (len >= size) {
+				errno = EMSGSIZE;
+				return -1;
+			}
+			memcpy(line, start, len);
+			line[len] = '\0';
+			return len;
+		}
+		if (navail >= size) {
+			errno = EMSGSIZE;  // CR may not be counted, but neither fits
+			return -1;
+		}
+		ssize_t nread = fillConnection(conn, 0);
+		if (nread <= 0) {
+			if (nread == 0) {
+				errno = ECONNRESET;
+			}
+			return -1;
+		}
+	}
+}
+
+/**
+ * Start reading the request body on the connection. The body
+ * timeout bounds the whole body from now on rather than each
+ * receive, so a body that trickles in is still cut off; reads
+ * that time out fail with EAGAIN.
+ *
+ * @param conn the connection
+ */
+void startRequestBody(HttpConnection *conn) {
+	if (conn->body_start == 0) {
+		conn->body_start = monotonicMilliTime();
+	}
+}
+
+/**
+ * Returns the milliseconds left to send the response body. The
+ * write timeout bounds the whole body rather than each send, so
+ * a client that reads slowly is still cut off. The first call
+ * for a response starts the wait.
+ *
+ * @param conn the connection
+ * @return milliseconds left, 0 if the time is up
+ */
+int responseBodyTimeLeft(HttpConnection *conn) {
+	if (conn->write_start == 0) {
+		conn->write_start = monotonicMilliTime();
+	}
+	return phaseTimeLeft(conn->write_start, server.write_timeout);
+}
+
+/**
+ * Returns the number of bytes the receive buffer can take,
+ * counting the space freed by bytes already read.
+ *
+ * @param conn the connection
+ * @return number of bytes that can be appended
+ */
+size_t connectionBufferSpace(HttpConnection *conn) {
+	return CONN_BUFSIZE - (conn->in_end - conn->in_start);
+}
+
+/**
+ * Appends bytes received for the connection by its event
+ * loop to the receive buffer, first moving unread bytes to
+ * the start of the buffer. Bytes beyond the space returned
+ * by connectionBufferSpace() are not appended.
+ *
+ * @param conn the connection
+ * @param buf the received bytes
+ * @param nbytes the number of received bytes
+ * @return number of bytes appended
+ */
+size_t appendConnectionBytes(HttpConnection *conn, const void *buf, size_t nbytes) {
+	if (conn->in_start > 0) {
+		memmove(conn->in_buf, conn->in_buf + conn->in_start, conn->in_end - conn->in_start);
+		conn->in_end -= conn->in_start;
+		conn->in_start = 0;
+	}
+	size_t nfree = CONN_BUFSIZE - conn->in_end;
+	size_t ncopy = (nbytes < nfree) ? nbytes : nfree;
+	memcpy(conn->in_buf + conn->in_end, buf, ncopy);
+	conn->in_end += ncopy;
+	if (ncopy > 0) {
+		startRequest(conn);
+	}
+	return ncopy;
+}
+
+/**
+ * Returns true if a request can be processed without waiting:
+ * its head is completely buffered and parsed, or it was rejected
+ * by the parser, for example because it does not fit the buffer.
+ * Parsing resumes with the bytes received since the last call.
+ *
+ * @param conn the connection
+ * @return true if a request head is buffered
+ */
+bool hasRequestHead(HttpConnection *conn) {
+	parseRequestHead(&conn->parser, conn->in_buf + conn->in_start, conn->in_end - conn->in_start);
+	return requestParseFinished(&conn->parser);
+}
+
+/**
+ * Take the parsed request head from the receive buffer, so that
+ * reads continue with the request body. The head stays in place
+ * until the next request is received, so its slices remain valid
+ * while the request is processed.
+ *
+ * @param conn the connection
+ * @return the request head, or NULL if the head was rejected
+ *   or is not completely buffered
+ */
+HttpRequestHead *takeRequestHead(HttpConnection *conn) {
+	if (!hasRequestHead(conn) || (conn->parser.state != RequestParse_Done)) {
+		return NULL;
+	}
+	conn->in_start += conn->parser.head_len;
+	return &conn->parser.head;
+}
+
+/**
+ * Returns the error status of a request head rejected by the parser.
+ *
+ * @param conn the connection
+ * @return the error status, or 0 if the head was not rejected
+ */
+int requestHeadStatus(const HttpConnection *conn) {
+	return (conn->parser.state == RequestParse_Error) ? conn->parser.status : 0;
+}
+
+/**
+ * Receive the bytes the peer has already sent, without waiting,
+ * until the head of the next request is buffered.
+ *
+ * @param conn the connection
+ * @return 1 if a request head is buffered, 0 if more bytes are
+ *   needed, -1 if the peer closed or error
+ */
+int receiveRequestHead(HttpConnection *conn) {
+	while (!hasRequestHead(conn)) {
+		ssize_t nread = fillConnection(conn, MSG_DONTWAIT);
+		if (nread == 0) {
+			return -1;
+		}
+		if (nread < 0) {
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Returns the deadline for the request the connection is waiting
+ * for: the request line timeout for a new connection, the
+ * keep-alive timeout between requests, and once a request has
+ * started, the request line and then the header timeout from
+ * its first byte.
+ *
+ * @param conn the connection
+ * @return the monotonic deadline in milliseconds
+ */
+long long connectionDeadline(const HttpConnection *conn) {
+	if (conn->request_start == 0) {
+		int timeout = (conn->nrequests == 0) ? server.request_line_timeout : server.keep_alive_timeout;
+		return conn->idle_start + timeout*1000LL;
+	}
+	if (conn->parser.state == RequestParse_RequestLine) {
+		return conn->request_start + server.request_line_timeout*1000LL;
+	}
+	return conn->request_start + server.header_timeout*1000LL;
+}
+
+/**
+ * Mark the end of a request on the connection, which starts
+ * the wait for the next one and resets the parser for its head.
+ *
+ * @param conn the connection
+ */
+void finishConnectionRequest(HttpConnection *conn) {
+	conn->idle_start = monotonicMilliTime();
+	initRequestParser(&conn->parser, CONN_BUFSIZE, MAXBUF-1);
+	// a pipelined request has already started
+	conn->request_start = hasPipelinedRequest(conn) ? conn->idle_start : 0;
+	conn->body_start = conn->write_start = 0;
+}
+
+/**
+ * Returns true if bytes of a pipelined request are already
+ * buffered, so the next request can start without waiting.
+ *
+ * @param conn the connection
+ * @return true if request bytes are buffered
+ */
+bool hasPipelinedRequest(const HttpConnection *conn) {
+	return conn->in_start < conn->in_end;
+}
+
+/**
+ * Send the responses queued on the connection in request order.
+ *
+ * @param conn the connection
+ * @return 0 if successful, EOF if error
+ */
+int flushConnection(HttpConnection *conn) {
+	conn->flushing = true;
+	int status = fflush(conn->stream);
+	conn->flushing = false;
+	if (conn->held) {
+		// the stream ended on a full buffer already sent as held;
+		// setting TCP_NODELAY again pushes the partial segment
+		set_socket_nodelay(conn->sock_fd, true);
+		conn->held = false;
+	}
+	return status;
+}
+
+/**
+ * Send the status line and headers queued on the connection
+ * ahead of a response body sent directly to the socket. The
+ * kernel holds a partial segment of them for the body, so the
+ * body must follow with a send that pushes it out.
+ *
+ * @param conn the connection
+ * @return 0 if successful, EOF if error
+ */
+int flushResponseHead(HttpConnection *conn) {
+	int status = fflush(conn->stream);
+	// the body pushes the held bytes
+	conn->held = false;
+	return status;
+}
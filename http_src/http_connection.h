@@ -0,0 +1,225 @@
+/*
+ * http_connection.h
+ *
+ * Functions that manage the state of a client connection
+ * across the requests served on it.
+ *
+ */
+
+#ifndef HTTP_CONNECTION_H_
+#define HTTP_CONNECTION_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include "http_parser.h"
+#include "timer_wheel.h"
+
+/** size of connection receive and send buffers */
+#define CONN_BUFSIZE 8192
+
+/** event loop that owns the connection while it is idle */
+struct EventLoop;
+
+/** Definition of a client connection */
+typedef struct HttpConnection {
+	int sock_fd;                  /** peer socket */
+	FILE *stream;                 /** buffered response stream */
+	char in_buf[CONN_BUFSIZE];    /** received bytes not yet parsed */
+	size_t in_start;              /** offset of first unread byte */
+	size_t in_end;                /** offset past last unread byte */
+	RequestParser parser;         /** parser of request head at first unread byte */
+	int nrequests;                /** requests started on this connection */
+	bool keep_alive;              /** keep connection open after response */
+	bool chunked;                 /** response bodies may use the chunked transfer coding */
+	long long body_remaining;     /** unread request body bytes, of the chunk if chunked */
+	bool body_chunked;            /** request body has unread chunks */
+	bool expect_continue;         /** client waits for 100 Continue before the body */
+	bool flushing;                /** response stream is flushed at end of batch */
+	bool held;                    /** kernel holds sent bytes for more to follow */
+
+	long long idle_start;         /** monotonic ms when wait for next request began */
+	long long request_start;      /** monotonic ms when first byte of request arrived, 0 if none */
+	long long body_start;         /** monotonic ms when reading of request body began, 0 if none */
+	long long write_start;        /** monotonic ms when sending of response body began, 0 if none */
+
+	struct EventLoop *loop;       /** event loop of connection or NULL */
+	Timer timer;                  /** deadline while waiting in event loop */
+} HttpConnection;
+
+/**
+ * Create a new connection for a peer socket.
+ * The connection owns the socket from now on.
+ *
+ * @param sock_fd the peer socket
+ * @return the connection or NULL if unavailable
+ */
+HttpConnection *newHttpConnection(int sock_fd);
+
+/**
+ * Delete a connection, flushing and closing its socket.
+ *
+ * @param conn the connection
+ */
+void deleteHttpConnection(HttpConnection *conn);
+
+/**
+ * Reads up to nbytes from the connection, using buffered
+ * bytes first. Queued responses are flushed before waiting
+ * for more bytes from the peer.
+ *
+ * @param conn the connection
+ * @param buf the buffer for the bytes
+ * @param nbytes the maximum number of bytes to read
+ * @return number of bytes read, 0 if peer closed, -1 if error
+ */
+ssize_t readConnectionBytes(HttpConnection *conn, void *buf, size_t nbytes);
+
+/**
+ * Reads a line from the connection through the receive
+ * buffer, without its line ending (LF or CRLF). Queued
+ * responses are flushed before waiting for more bytes
+ * from the peer.
+ *
+ * @param conn the connection
+ * @param line the buffer for the null-terminated line
+ * @param size the size of the buffer
+ * @return length of the line, or -1 if error, if peer closed
+ *   (ECONNRESET), or if the line does not fit (EMSGSIZE)
+ */
+ssize_t readConnectionLine(HttpConnection *conn, char *line, size_t size);
+
+/**
+ * Start reading the request body on the connection. The body
+ * timeout bounds the whole body from now on rather than each
+ * receive, so a body that trickles in is still cut off; reads
+ * that time out fail with EAGAIN.
+ *
+ * @param conn the connection
+ */
+void startRequestBody(HttpConnection *conn);
+
+/**
+ * Returns the milliseconds left to send the response body. The
+ * write timeout bounds the whole body rather than each send, so
+ * a client that reads slowly is still cut off. The first call
+ * for a response starts the wait.
+ *
+ * @param conn the connection
+ * @return milliseconds left, 0 if the time is up
+ */
+int responseBodyTimeLeft(HttpConnection *conn);
+
+/**
+ * Returns the number of bytes the receive buffer can take,
+ * counting the space freed by bytes already read.
+ *
+ * @param conn the connection
+ * @return number of bytes that can be appended
+ */
+size_t connectionBufferSpace(HttpConnection *conn);
+
+/**
+ * Appends bytes received for the connection by its event
+ * loop to the receive buffer, first moving unread bytes to
+ * the start of the buffer. Bytes beyond the space returned
+ * by connectionBufferSpace() are not appended.
+ *
+ * @param conn the connection
+ * @param buf the received bytes
+ * @param nbytes the number of received bytes
+ * @return number of bytes appended
+ */
+size_t appendConnectionBytes(HttpConnection *conn, const void *buf, size_t nbytes);
+
+/**
+ * Returns true if a request can be processed without waiting:
+ * its head is completely buffered and parsed, or it was rejected
+ * by the parser, for example because it does not fit the buffer.
+ * Parsing resumes with the bytes received since the last call.
+ *
+ * @param conn the connection
+ * @return true if a request head is buffered
+ */
+bool hasRequestHead(HttpConnection *conn);
+
+/**
+ * Take the parsed request head from the receive buffer, so that
+ * reads continue with the request body. The head stays in place
+ * until the next request is received, so its slices remain valid
+ * while the request is processed.
+ *
+ * @param conn the connection
+ * @return the request head, or NULL if the head was rejected
+ *   or is not completely buffered
+ */
+HttpRequestHead *takeRequestHead(HttpConnection *conn);
+
+/**
+ * Returns the error status of a request head rejected by the parser.
+ *
+ * @param conn the connection
+ * @return the error status, or 0 if the head was not rejected
+ */
+int requestHeadStatus(const HttpConnection *conn);
+
+/**
+ * Receive the bytes the peer has already sent, without waiting,
+ * until the head of the next request is buffered.
+ *
+ * @param conn the connection
+ * @return 1 if a request head is buffered, 0 if more bytes are
+ *   needed, -1 if the peer closed or error
+ */
+int receiveRequestHead(HttpConnection *conn);
+
+/**
+ * Returns the deadline for the request the connection is waiting
+ * for: the request line timeout for a new connection, the
+ * keep-alive timeout between requests, and once a request has
+ * started, the request line and then the header timeout from
+ * its first byte.
+ *
+ * @param conn the connection
+ * @return the monotonic deadline in milliseconds
+ */
+long long connectionDeadline(const HttpConnection *conn);
+
+/**
+ * Mark the end of a request on the connection, which starts
+ * the wait for the next one and resets the parser for its head.
+ *
+ * @param conn the connection
+ */
+void finishConnectionRequest(HttpConnection *conn);
+
+/**
+ * Returns true if bytes of a pipelined request are already
+ * buffered, so the next request can start without waiting.
+ *
+ * @param conn the connection
+ * @return true if request bytes are buffered
+ */
+bool hasPipelinedRequest(const HttpConnection *conn);
+
+/**
+ * Send the responses queued on the connection in request order.
+ *
+ * @param conn the connection
+ * @return 0 if successful, EOF if error
+ */
+int flushConnection(HttpConnection *conn);
+
+/**
+ * Send the status line and headers queued on the connection
+ * ahead of a response body sent directly to the socket. The
+ * kernel holds a partial segment of them for the body, so the
+ * body must follow with a send that pushes it out.
+ *
+ * @param conn the connection
+ * @return 0 if successful, EOF if error
+ */
+int flushResponseHead(HttpConnection *conn);
+
+#endif /* HTTP_CONNECTION_H_ */
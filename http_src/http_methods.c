@@ -8,6 +8,7 @@
 
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <string.h>
 #include <time.h>
@@ -25,239 +26,797 @@
 #include "properties.h"
 #include "string_util.h"
 #include "file_util.h"
+#include "file_cache.h"
+#include "content_cache.h"
+#include "compress_cache.h"
+#include "listing_cache.h"
+#include "http_connection.h"
+#include "io_uring_util.h"
+#include "network_util.h"
+#include "server_stats.h"
 
 /**
- * This function is responsible for listing the contents of a directory as a formatted HTML page (extension of GET).
- * Since the specified path to the file is a directory (pathDir), the function generates the listing of the
- * directory as a temporary file and returns a FILE* type.
- * @param pathDir specified path to directory
- * @param uri the request URI
- * @return returns a temporary file stream of type FILE* representing the listing of directories
+ * Send bytes of a response body from memory or from a file. Bytes
+ * of a file that fill the response stream buffer are sent from the
+ * file to the socket: the io_uring engine links file reads to socket
+ * sends, and the others use sendfile; fewer bytes are copied so
+ * pipelined responses still leave together. The write timeout
+ * bounds the whole body, and the connection is not kept alive if
+ * the bytes could not all be sent in time.
+ *
+ * @param conn the connection
+ * @param body the body in memory, or NULL to send from the file
+ * @param fd the file if the body is not in memory
+ * @param offset the offset of the bytes in the body
+ * @param len the number of bytes
  */
-static FILE* listing_directories(const char *pathDir, const char *uri) {
-    // create temporary file
-    FILE* directoriesListingTmpFile = tmpfile();
-    // open path directory for read
-    DIR* openPathDir = opendir(pathDir);
-
-    if (directoriesListingTmpFile == NULL) {
-        return NULL;
-    }
-    if (openPathDir == NULL) {
-        fprintf(stderr, "Directory %s can't be opened for read.\n", openPathDir);
-    }
+static void sendBodyBytes(HttpConnection *conn, const char *body, int fd, long long offset, long long len) {
+	int timeout = responseBodyTimeLeft(conn);
+	if (timeout == 0) {
+		conn->keep_alive = false;
+		return;
+	}
+	if (body != NULL) {
+		if (fwrite(body + offset, 1, len, conn->stream) != (size_t)len) {
+			conn->keep_alive = false;
+		}
+		return;
+	}
 
-    // outputs the first portion of the formatted html page (header portion)
-    char* htmlFirst = "<html>\n"
-                      "<head><title>index of %s</title></head>\n"
-                      "<body>\n"
-                      "<h1>Index of %s</h1>\n"
-                      "<table>\n"
-                      "<tr>\n"
-                      "<th valign=\"top\"></th>\n"
-                      "<th>Name</th>\n"
-                      "<th>Last modified</th>\n"
-                      "<th>Size</th>\n"
-                      "<th>Description (file type)</th>\n"
-                      "</tr>\n"
-                      "<tr>\n"
-                      "<td colspan=\"5\"><hr></td>\n"
-                      "</tr>\n";
-
-    fprintf(directoriesListingTmpFile, htmlFirst, uri, uri);
-
-    struct dirent *dirEnt;
-    //char *entryInPathDir[MAXBUF];
-
-    char *dirEntName;
-    char filepath[MAXPATHLEN];
-    struct stat sb;
-    char time[MAXBUF];
+	long long nsent = -1;
+	if ((len >= CONN_BUFSIZE) && (flushResponseHead(conn) == 0)) {
+		if (server.io_engine == IoEngine_IoUring) {
+			nsent = uring_send_file(fd, conn->sock_fd, offset, len, timeout);
+		}
+		if (nsent == -1) {
+			nsent = send_file(conn->sock_fd, fd, offset, len, timeout);
+		}
+	}
+	if (nsent == -1) {
+	    if (copyFileBytes(fd, offset, conn->stream, len) != 0) {
+	        conn->keep_alive = false;
+	    }
+	} else if (nsent < len) {
+	    // response is truncated: client cannot find the next one
+	    conn->keep_alive = false;
+	}
+}
 
-    while ((dirEnt = readdir(openPathDir)) != NULL) {
-        // for current directory
-        if (strcmp(dirEnt->d_name, ".") == 0) {
-            continue;
-        }
+/**
+ * Determines whether an If-None-Match list has an entity tag,
+ * using the weak comparison of RFC 7232 2.3.2.
+ *
+ * @param list the If-None-Match header value
+ * @param etag the entity tag of the file
+ * @return true if "*" or a tag with the same opaque tag is in the list
+ */
+static bool matchesEntityTag(const char *list, const char *etag) {
+	if (strncmp(etag, "W/", 2) == 0) {
+		etag += 2;
+	}
+	size_t etagLen = strlen(etag);
+	for (const char *p = list; *p != '\0'; ) {
+		p += strspn(p, " \t,");
+		if (*p == '*') {
+			return true;
+		}
+		if (strncmp(p, "W/", 2) == 0) {
+			p += 2;
+		}
+		if (*p != '"') {
+			return false;  // invalid list
+		}
+		const char *end = strchr(p+1, '"');
+		if (end == NULL) {
+			return false;
+		}
+		if (((size_t)(end + 1 - p) == etagLen) && (strncmp(p, etag, etagLen) == 0)) {
+			return true;
+		}
+		p = end + 1;
+	}
+	return false;
+}
 
-        // for parent directory
-        if (strcmp(dirEnt->d_name, "..") == 0) {
-            // if the directory is a root directory
-            if (strcmp(uri, "/") == 0) {
-                continue;
-            }
-            dirEntName = "Parent Directory";
-        }
+/**
+ * Determines whether a GET or HEAD request for a regular file is
+ * answered with 304 Not Modified (RFC 7232 6). If-None-Match takes
+ * precedence over If-Modified-Since.
+ *
+ * @param requestHeaders the request headers
+ * @param etag the entity tag of the file
+ * @param modified the modification time of the file
+ * @param lastModified the Last-Modified date of the file
+ * @return true if the client has the current file
+ */
+static bool isNotModified(Properties *requestHeaders, const char *etag,
+						  time_t modified, const char *lastModified) {
+	char val[MAX_PROP_VAL];
+	if (findProperty(requestHeaders, 0, "If-None-Match", val) != SIZE_MAX) {
+		return matchesEntityTag(val, etag);
+	}
+	if (findProperty(requestHeaders, 0, "If-Modified-Since", val) != SIZE_MAX) {
+		// browsers usually return the Last-Modified date unchanged
+		if (strcmp(val, lastModified) == 0) {
+			return true;
+		}
+		// dates in the future are invalid (RFC 7232 3.3)
+		time_t since = parseRFC_1123_Date_Time(val);
+		return (since != -1) && (modified <= since) && (since <= time(NULL));
+	}
+	return false;
+}
 
-        else {
-            dirEntName = dirEnt->d_name;
-        }
+/**
+ * Send a 304 Not Modified response with the validators of the
+ * file, so that the client can use the copy it has.
+ *
+ * @param conn the connection
+ * @param etag the entity tag of the file
+ * @param lastModified the Last-Modified date of the file
+ * @param vary true if the response varies by Accept-Encoding
+ * @param responseHeaders the response headers
+ */
+static void sendNotModified(HttpConnection *conn, const char *etag, const char *lastModified,
+							bool vary, Properties *responseHeaders) {
+	putProperty(responseHeaders, "ETag", etag);
+	putProperty(responseHeaders, "Last-Modified", lastModified);
+	if (vary) {
+		putProperty(responseHeaders, "Vary", "Accept-Encoding");
+	}
+	sendResponseStatus(conn->stream, Http_NotModified, NULL);
+	sendResponseHeaders(conn->stream, responseHeaders);
+}
 
-        makeFilePath(pathDir, dirEnt->d_name, filepath);
-        stat(filepath, &sb);
-        milliTimeToShortHM_Date_Time(sb.st_mtim.tv_sec, time);
-
-        // outputs the entries (entries of directory) portion of the formatted html page
-        char* htmlEntry = "<tr>\n"
-                          "<td></td>\n"
-                          "<td><a href=\"%s\">%s</a></td>\n"
-                          "<td align=\"right\">%s</td>\n"
-                          "<td align=\"right\">%lu</td>\n"
-                          "<td align=\"right\">%s</td>\n"
-                          "<td></td>\n"
-                          "</tr>\n";
-
-        char entryLink[MAXBUF];
-        char entryMode[MAXBUF];
-
-        // if entry is a parent directory entry in a non-root directory
-        if (strcmp(dirEnt->d_name, "..") == 0) {
-            strcpy(entryLink, "../");
-        }
+/**
+ * Find the byte ranges requested for a regular file by a GET
+ * request. The Range header is ignored if an If-Range validator
+ * does not strongly match the current entity tag or modification
+ * date (RFC 7233 3.2): a weak entity tag never matches, and a
+ * date only matches if it is at least a second before the Date
+ * of the response, since the file may change again within it
+ * (RFC 7232 2.2.2).
+ *
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers, with its Date
+ * @param etag the entity tag of the file
+ * @param modified the modification time of the file
+ * @param lastModified the Last-Modified date of the file
+ * @param contentLen the length of the file
+ * @param ranges output satisfiable ranges
+ * @return the number of satisfiable ranges, 0 if none is
+ *   satisfiable, or -1 to send the whole file
+ */
+static int requestedRanges(Properties *requestHeaders, Properties *responseHeaders, const char *etag,
+						   time_t modified, const char *lastModified, long long contentLen,
+						   ByteRange *ranges) {
+	char val[MAX_PROP_VAL];
+	if (findProperty(requestHeaders, 0, "Range", val) == SIZE_MAX) {
+		return -1;
+	}
+	char validator[MAX_PROP_VAL];
+	if (findProperty(requestHeaders, 0, "If-Range", validator) != SIZE_MAX) {
+		if ((*validator == '"') || (strncmp(validator, "W/", 2) == 0)) {
+			if (   (strncmp(validator, "W/", 2) == 0) || (strncmp(etag, "W/", 2) == 0)
+				|| (strcmp(validator, etag) != 0)) {
+				return -1;
+			}
+		} else {
+			char date[MAX_PROP_VAL];
+			time_t now = (findProperty(responseHeaders, 0, "Date", date) != SIZE_MAX)
+						 ? parseRFC_1123_Date_Time(date) : -1;
+			if (now == -1) {
+				now = time(NULL);
+			}
+			if ((strcmp(validator, lastModified) != 0) || (modified >= now)) {
+				return -1;
+			}
+		}
+	}
+	return parseByteRanges(val, contentLen, ranges, MAX_BYTE_RANGES);
+}
 
-        // if entry is not a parent directory entry (either a file entry or directory entry in a directory)
-        else {
-            strcpy(entryLink, dirEntName);
-            if (S_ISDIR(sb.st_mode)) {
-                strcat(entryLink, "/");
-            }
-        }
+/**
+ * Format the head of a part of a multipart/byteranges body.
+ *
+ * @param buf the buffer for the head
+ * @param size the size of the buffer
+ * @param boundary the part boundary
+ * @param mediaType the media type of the file
+ * @param range the range of the part
+ * @param contentLen the length of the file
+ * @return the length of the head
+ */
+static size_t formatRangePartHead(char *buf, size_t size, const char *boundary, const char *mediaType,
+								  const ByteRange *range, long long contentLen) {
+	int len = snprintf(buf, size, "%s--%s%sContent-type: %s%sContent-Range: bytes %lld-%lld/%lld%s%s",
+					   CRLF, boundary, CRLF, mediaType, CRLF,
+					   range->first, range->last, contentLen, CRLF, CRLF);
+	return ((size_t)len < size) ? (size_t)len : size-1;
+}
 
-        if (S_ISDIR(sb.st_mode)) {
-            strcpy(entryMode, "directory");
-        }
+/**
+ * Send a 206 response with the requested ranges of a file, or a
+ * 416 response if none is satisfiable. Several ranges are sent as
+ * parts of a multipart/byteranges body (RFC 7233 4.1).
+ *
+ * @param conn the connection
+ * @param ranges the satisfiable ranges
+ * @param nranges the number of ranges
+ * @param body the body in memory, or NULL to send from the file
+ * @param fd the file if the body is not in memory
+ * @param contentLen the length of the file
+ * @param mediaType the media type of the file
+ * @param responseHeaders the response headers
+ */
+static void sendRangeResponse(HttpConnection *conn, const ByteRange *ranges, int nranges,
+							  const char *body, int fd, long long contentLen,
+							  const char *mediaType, Properties *responseHeaders) {
+	char buf[MAXBUF];
+	if (nranges == 0) {
+		sprintf(buf, "bytes */%lld", contentLen);
+		putProperty(responseHeaders, "Content-Range", buf);
+		sendStatusResponse(conn->stream, Http_RangeNotSatisfiable, NULL, responseHeaders);
+		return;
+	}
 
-        if (S_ISREG(sb.st_mode)) {
-            strcpy(entryMode, "file");
-        }
+	if (nranges == 1) {
+		sprintf(buf, "bytes %lld-%lld/%lld", ranges[0].first, ranges[0].last, contentLen);
+		putProperty(responseHeaders, "Content-Range", buf);
+		sprintf(buf, "%lld", ranges[0].last - ranges[0].first + 1);
+		putProperty(responseHeaders, "Content-Length", buf);
+		putProperty(responseHeaders, "Content-type", mediaType);
+		sendResponseStatus(conn->stream, Http_PartialContent, NULL);
+		sendResponseHeaders(conn->stream, responseHeaders);
+		sendBodyBytes(conn, body, fd, ranges[0].first, ranges[0].last - ranges[0].first + 1);
+		return;
+	}
 
-        fprintf(directoriesListingTmpFile, htmlEntry, entryLink, dirEntName, time, (size_t)sb.st_size, entryMode);
+	// boundary differs between responses so it cannot be guessed
+	static atomic_uint responseCount = 0;
+	char boundary[48];
+	sprintf(boundary, "%llx%x", (unsigned long long)monotonicMilliTime(),
+			atomic_fetch_add_explicit(&responseCount, 1, memory_order_relaxed));
 
-        // outputs the last portion of the formatted html page (footer portion)
-        char* htmlLast = "<tr><td colspan=\"5\"><hr></td></tr>\n"
-                         "</body>\n"
-                         "</html>\n";
-        fprintf(directoriesListingTmpFile, "%s", htmlLast);
-    }
-    closedir(openPathDir);
-    fflush(directoriesListingTmpFile);
-    rewind(directoriesListingTmpFile);
-    return directoriesListingTmpFile;
+	// length of the part heads, parts, and closing boundary
+	char partHead[3*MAXBUF];
+	long long bodyLen = strlen(CRLF "--" CRLF "--") + strlen(boundary);
+	for (int i = 0; i < nranges; i++) {
+		bodyLen += formatRangePartHead(partHead, sizeof(partHead), boundary, mediaType, &ranges[i], contentLen);
+		bodyLen += ranges[i].last - ranges[i].first + 1;
+	}
+	sprintf(buf, "%lld", bodyLen);
+	putProperty(responseHeaders, "Content-Length", buf);
+	snprintf(buf, sizeof(buf), "multipart/byteranges; boundary=%s", boundary);
+	putProperty(responseHeaders, "Content-type", buf);
+	sendResponseStatus(conn->stream, Http_PartialContent, NULL);
+	sendResponseHeaders(conn->stream, responseHeaders);
+
+	for (int i = 0; i < nranges; i++) {
+		size_t len = formatRangePartHead(partHead, sizeof(partHead), boundary, mediaType, &ranges[i], contentLen);
+		fwrite(partHead, 1, len, conn->stream);
+		sendBodyBytes(conn, body, fd, ranges[i].first, ranges[i].last - ranges[i].first + 1);
+	}
+	fprintf(conn->stream, "%s--%s--%s", CRLF, boundary, CRLF);
+}
+
+/**
+ * Send a response with a body in memory or in a file, or a 304
+ * response if the client has the current body.
+ *
+ * @param conn the connection
+ * @param body the body in memory, or NULL to send from the file
+ * @param fd the file if the body is not in memory
+ * @param len the length of the body
+ * @param contentLength the Content-Length header value
+ * @param etag the ETag header value
+ * @param modified the modification time of the body
+ * @param lastModified the Last-Modified header value
+ * @param mediaType the media type of the body
+ * @param encoding the content coding of the body, or NULL
+ * @param vary true if the response varies by Accept-Encoding
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ */
+static void sendBodyResponse(HttpConnection *conn, const char *body, int fd, long long len,
+							 const char *contentLength, const char *etag, time_t modified,
+							 const char *lastModified, const char *mediaType, const char *encoding,
+							 bool vary, Properties *requestHeaders, Properties *responseHeaders,
+							 bool sendContent) {
+	if (isNotModified(requestHeaders, etag, modified, lastModified)) {
+		sendNotModified(conn, etag, lastModified, vary, responseHeaders);
+		return;
+	}
+
+	// ranges of a body requested by GET
+	ByteRange ranges[MAX_BYTE_RANGES];
+	int nranges = -1;
+	if (sendContent) {
+		nranges = requestedRanges(requestHeaders, responseHeaders, etag, modified, lastModified, len, ranges);
+	}
+
+	// record the body length
+	if (nranges < 0) {
+		putProperty(responseHeaders,"Content-Length", contentLength);
+	}
+
+	// record the last-modified date/time
+	putProperty(responseHeaders,"Last-Modified", lastModified);
+
+	// record the entity tag
+	putProperty(responseHeaders,"ETag", etag);
+	putProperty(responseHeaders,"Accept-Ranges", "bytes");
+	if (encoding != NULL) {
+		putProperty(responseHeaders, "Content-Encoding", encoding);
+	}
+	if (vary) {
+		putProperty(responseHeaders, "Vary", "Accept-Encoding");
+	}
+
+	if (nranges >= 0) {
+		sendRangeResponse(conn, ranges, nranges, body, fd, len, mediaType, responseHeaders);
+		return;
+	}
+	putProperty(responseHeaders, "Content-type", mediaType);
+
+	// send response
+	sendResponseStatus(conn->stream, Http_OK, NULL);
+
+	// Send response headers
+	sendResponseHeaders(conn->stream, responseHeaders);
+
+	if (sendContent) {  // for GET
+		sendBodyBytes(conn, body, fd, 0, len);
+	}
 }
 
+/**
+ * Send a response with a file body cached in memory.
+ *
+ * @param conn the connection
+ * @param content the cached body
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ */
+static void sendContentResponse(HttpConnection *conn, const CachedContent *content,
+								Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
+	// a keep-alive 200 response with only the Server and Date headers
+	// is precomputed with the body; debug output lists each header instead
+	char date[MAX_PROP_VAL];
+	ByteRange ranges[MAX_BYTE_RANGES];
+	if (   !server.debug && (nProperties(responseHeaders) == 2)
+		&& (findProperty(responseHeaders, 0, "Date", date) != SIZE_MAX)
+		&& (strlen(date) == RFC_1123_DATE_LEN - 1)
+		&& !isNotModified(requestHeaders, content->etag, content->modified, content->lastModified)
+		&& (   !sendContent
+			|| (requestedRanges(requestHeaders, responseHeaders, content->etag, content->modified,
+								content->lastModified, content->len, ranges) < 0))) {
+		if (!sendCachedResponse(conn->stream, content, date, sendContent)) {
+			conn->keep_alive = false;
+		}
+		return;
+	}
+	sendBodyResponse(conn, content->body, -1, content->len, content->contentLength,
+					 content->etag, content->modified, content->lastModified, content->mediaType,
+					 NULL, content->vary, requestHeaders, responseHeaders, sendContent);
+}
+
+/**
+ * Send a response with a regular file from the open file cache.
+ *
+ * @param conn the connection
+ * @param file the open file
+ * @param mediaType the media type of the file
+ * @param encoding the content coding of a precompressed file, or NULL
+ * @param vary true if the response varies by Accept-Encoding
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ */
+static void sendFileResponse(HttpConnection *conn, const CachedFile *file, const char *mediaType,
+							 const char *encoding, bool vary, Properties *requestHeaders,
+							 Properties *responseHeaders, bool sendContent) {
+	sendBodyResponse(conn, NULL, file->fd, (long long)file->sb.st_size, file->contentLength,
+					 file->etag, file->sb.st_mtime, file->lastModified, mediaType,
+					 encoding, vary, requestHeaders, responseHeaders, sendContent);
+}
 
+/**
+ * Parse the weight of a content coding (RFC 7231 5.3.1).
+ *
+ * @param p the parameters after the content coding
+ * @return the weight in thousandths, 1000 if none is given
+ */
+static int parseQValue(const char *p) {
+	for (;;) {
+		p += strspn(p, " \t;");
+		if ((*p == '\0') || (*p == ',')) {
+			return 1000;
+		}
+		if (((*p == 'q') || (*p == 'Q')) && (p[1] == '=')) {
+			p += 2;
+			int q = (*p++ == '1') ? 1000 : 0;
+			if (*p == '.') {
+				for (int scale = 100; (*++p >= '0') && (*p <= '9') && (scale > 0); scale /= 10) {
+					q += (*p - '0') * scale;
+				}
+			}
+			return (q > 1000) ? 1000 : q;
+		}
+		p += strcspn(p, ";,");
+	}
+}
+
+/**
+ * Select the precompressed sibling of a file to send for the
+ * content codings the client accepts: the sibling with the highest
+ * weight, preferring earlier encodings. The file itself is sent if
+ * the identity coding is given a higher weight.
+ *
+ * @param requestHeaders the request headers
+ * @param siblings bit for each precompressed sibling of the file
+ * @return the index of the encoding, or -1 to send the file itself
+ */
+static int selectEncoding(Properties *requestHeaders, unsigned siblings) {
+	char val[MAX_PROP_VAL];
+	if ((siblings == 0) || (findProperty(requestHeaders, 0, "Accept-Encoding", val) == SIZE_MAX)) {
+		return -1;
+	}
+
+	// weights of the encodings, "*" and identity, or -1 if not listed
+	int weights[NUM_PRECOMPRESSED];
+	int anyWeight = -1, identityWeight = -1;
+	for (int i = 0; i < NUM_PRECOMPRESSED; i++) {
+		weights[i] = -1;
+	}
+	for (const char *p = val; *p != '\0'; ) {
+		p += strspn(p, " \t,");
+		size_t len = strcspn(p, " \t;,");
+		if (len == 0) {
+			break;
+		}
+		int q = parseQValue(p + len);
+		if ((len == 1) && (*p == '*')) {
+			anyWeight = q;
+		} else if ((len == 8) && (strncasecmp(p, "identity", len) == 0)) {
+			identityWeight = q;
+		} else {
+			if ((len == 6) && (strncasecmp(p, "x-gzip", len) == 0)) {
+				p += 2, len -= 2;  // equivalent to gzip (RFC 7230 4.2.3)
+			}
+			for (int i = 0; i < NUM_PRECOMPRESSED; i++) {
+				if (   (strlen(precompressedEncodings[i].name) == len)
+					&& (strncasecmp(p, precompressedEncodings[i].name, len) == 0)) {
+					weights[i] = q;
+				}
+			}
+		}
+		p += len;
+		p += strcspn(p, ",");
+	}
+
+	int best = -1;
+	int bestWeight = (identityWeight >= 0) ? identityWeight : 0;
+	for (int i = 0; i < NUM_PRECOMPRESSED; i++) {
+		int q = (weights[i] >= 0) ? weights[i] : anyWeight;
+		if (((siblings & (1u << i)) != 0) && (q > 0) && ((q > bestWeight) || ((best == -1) && (q == bestWeight)))) {
+			best = i;
+			bestWeight = q;
+		}
+	}
+	return best;
+}
+
+/**
+ * Send a response with a precompressed sibling of a file,
+ * with the media type of the file.
+ *
+ * @param conn the connection
+ * @param filePath the path of the file
+ * @param encoding the index of the encoding of the sibling
+ * @param mediaType the media type of the file
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ * @return true if sent, false if the sibling is no longer found
+ */
+static bool sendPrecompressed(HttpConnection *conn, const char *filePath, int encoding,
+							  const char *mediaType, Properties *requestHeaders,
+							  Properties *responseHeaders, bool sendContent) {
+	char path[MAXPATHLEN];
+	snprintf(path, sizeof(path), "%s%s", filePath, precompressedEncodings[encoding].ext);
+	CachedFile *file = openCachedFile(path);
+	if (file == NULL) {
+		return false;
+	}
+	if ((file->error != 0) || !S_ISREG(file->sb.st_mode)) {
+		closeCachedFile(file);
+		return false;
+	}
+	sendFileResponse(conn, file, mediaType, precompressedEncodings[encoding].name, true,
+					 requestHeaders, responseHeaders, sendContent);
+	closeCachedFile(file);
+	return true;
+}
+
+/**
+ * Send a response with the body of a compressible file or listing
+ * compressed on the fly, if the client accepts it. The compressed
+ * variant has its own entity tag, and its own byte ranges.
+ *
+ * @param conn the connection
+ * @param filePath the path of the file or directory
+ * @param etag the entity tag of the file
+ * @param len the length of the file
+ * @param fd the open file, read if the body is not in memory
+ * @param body the file body in memory, or NULL
+ * @param mediaType the media type of the file
+ * @param modified the modification time of the file
+ * @param lastModified the Last-Modified header value of the file
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ * @return true if sent, false to send the file itself
+ */
+static bool sendCompressed(HttpConnection *conn, const char *filePath, const char *etag,
+						   long long len, int fd, const char *body, const char *mediaType,
+						   time_t modified, const char *lastModified, Properties *requestHeaders,
+						   Properties *responseHeaders, bool sendContent) {
+	if (   !isCompressible(mediaType, len)
+		|| (selectEncoding(requestHeaders, 1u << COMPRESSED_ENCODING) != COMPRESSED_ENCODING)) {
+		return false;
+	}
+	CompressedBody *variant = compressFileBody(filePath, etag, len, fd, body);
+	if (variant == NULL) {
+		return false;
+	}
+
+	sendBodyResponse(conn, variant->body, -1, (long long)variant->len, variant->contentLength,
+					 variant->etag, modified, lastModified, mediaType,
+					 precompressedEncodings[COMPRESSED_ENCODING].name, true,
+					 requestHeaders, responseHeaders, sendContent);
+	closeCompressedBody(variant);
+	return true;
+}
+
+/**
+ * Determines the page, order and format of a directory listing
+ * from the query parameters and the Accept header of a request.
+ *
+ * @param requestHeaders the request headers
+ * @param page output page of the listing
+ * @return true if the query parameters are valid
+ */
+static bool requestedListingPage(Properties *requestHeaders, ListingPage *page) {
+	char val[MAX_PROP_VAL];
+	page->limit = 0;
+	page->cursor = 0;
+	page->sort = ListingSort_None;
+	page->json =    (findProperty(requestHeaders, 0, "Accept", val) != SIZE_MAX)
+				 && (strstr(val, "application/json") != NULL);
+	if (findProperty(requestHeaders, 0, "?", val) == SIZE_MAX) {
+		return true;
+	}
+	Properties *query = newProperties();
+	if (query == NULL) {
+		return false;
+	}
+	decodeQuery(val, query);
+	bool valid = parseListingPage(query, page);
+	deleteProperties(query);
+	return valid;
+}
+
+/**
+ * Send a page of a directory listing as the directory is read,
+ * or 400 if its cursor is not the position of an entry.
+ *
+ * @param conn the connection
+ * @param filePath the resolved path of the directory
+ * @param uri the request URI of the directory
+ * @param page the page of the listing
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ */
+static void sendListingPage(HttpConnection *conn, const char *filePath, const char *uri,
+							const ListingPage *page, Properties *responseHeaders, bool sendContent) {
+	DIR *dir = opendir(filePath);
+	if (dir == NULL) {
+		sendStatusResponse(conn->stream, Http_NotFound, NULL, responseHeaders);
+		return;
+	}
+	if (!isValidListingCursor(dir, page)) {
+		closedir(dir);
+		sendStatusResponse(conn->stream, Http_BadRequest, NULL, responseHeaders);
+		return;
+	}
+	putProperty(responseHeaders, "Content-type", page->json ? "application/json" : "text/html");
+
+	ChunkedBody body;
+	beginChunkedResponse(&body, conn, Http_OK, responseHeaders, sendContent);
+	if (sendContent) {  // for GET
+		streamListing(dir, uri, page, &body);
+	}
+	endChunkedBody(&body, NULL);
+	closedir(dir);
+}
+
+/**
+ * Determines whether a request URI has no empty, "." or ".."
+ * segments, so its resolved path is the one reported by changes
+ * to the content tree.
+ *
+ * @param uri the request URI
+ * @return true if the URI is canonical
+ */
+static bool isCanonicalUri(const char *uri) {
+	return    (strstr(uri, "//") == NULL) && (strstr(uri, "/./") == NULL)
+		   && (strstr(uri, "/../") == NULL)
+		   && !strendswith(uri, "/.") && !strendswith(uri, "/..");
+}
 
 /**
  * Handle GET or HEAD request.
  *
- * @param stream the socket stream
+ * @param conn the connection
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  * @param sendContent send content (GET)
  */
-static void do_get_or_head(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
+static void do_get_or_head(HttpConnection *conn, const char *uri, Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
 	// get path to URI in file system
 	char filePath[MAXPATHLEN];
 	resolveUri(uri, filePath);
-	FILE *contentStream = NULL;
 
-	// ensure file exists
-	struct stat sb;
-	if (stat(filePath, &sb) != 0) {
-		sendStatusResponse(stream, Http_NotFound, NULL, responseHeaders);
+	// small file bodies are sent from memory until their files change,
+	// unless the client accepts a precompressed sibling or compression
+	bool cacheable = isCanonicalUri(uri);
+	CachedContent *content = cacheable ? findCachedContent(filePath) : NULL;
+	if (content != NULL) {
+		int encoding = selectEncoding(requestHeaders, content->siblings);
+		if (   (   (encoding < 0)
+				|| !sendPrecompressed(conn, filePath, encoding, content->mediaType,
+									  requestHeaders, responseHeaders, sendContent))
+			&& !sendCompressed(conn, filePath, content->etag, content->len, -1, content->body,
+							   content->mediaType, content->modified, content->lastModified,
+							   requestHeaders, responseHeaders, sendContent)) {
+			sendContentResponse(conn, content, requestHeaders, responseHeaders, sendContent);
+		}
+		closeCachedContent(content);
 		return;
 	}
-	// directory path ends with '/'
-	if (S_ISDIR(sb.st_mode) && strendswith(filePath, "/")) {
-		// not allowed for this method
-
-		//sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
-		contentStream = listing_directories(filePath, uri);
-		if (contentStream == NULL) {
-		    sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
-		    return;
-		}
 
-		//return;
-		fileStat(contentStream, &sb);
+	// ensure file exists: its status, media type and header
+	// values are cached with the open file
+	CachedFile *file = openCachedFile(filePath);
+	if (file == NULL) {
+		sendStatusResponse(conn->stream, Http_InternalServerError, NULL, responseHeaders);
+		return;
 	}
-
-	else if (!S_ISREG(sb.st_mode)) { // error if not regular file
-		sendStatusResponse(stream, Http_NotFound, NULL, responseHeaders);
+	if (file->error != 0) {
+		closeCachedFile(file);
+		sendStatusResponse(conn->stream, Http_NotFound, NULL, responseHeaders);
 		return;
 	}
 
-	// record the file length
-	char buf[MAXBUF];
-	size_t contentLen = (size_t)sb.st_size;
-	sprintf(buf,"%lu", contentLen);
-	putProperty(responseHeaders,"Content-Length", buf);
-
-	// record the last-modified date/time
-	time_t timer = sb.st_mtim.tv_sec;
-	putProperty(responseHeaders,"Last-Modified",
-				milliTimeToRFC_1123_Date_Time(timer, buf));
+	if (S_ISREG(file->sb.st_mode)) {
+		int encoding = selectEncoding(requestHeaders, file->siblings);
+		if (   (encoding >= 0)
+			&& sendPrecompressed(conn, filePath, encoding, file->mediaType,
+								 requestHeaders, responseHeaders, sendContent)) {
+			closeCachedFile(file);
+			return;
+		}
 
-	// get mime type of file
-	getMediaType(filePath, buf);
-	if (strcmp(buf, "text/directory") == 0) {
-		// some browsers interpret text/directory as a VCF file
-		strcpy(buf,"text/html");
+		// the body is not read if the client has the current file
+		if (   cacheable
+			&& !isNotModified(requestHeaders, file->etag, file->sb.st_mtime, file->lastModified)) {
+			content = cacheFileContent(filePath, file);
+		}
+		if (content != NULL) {
+			closeCachedFile(file);
+			if (!sendCompressed(conn, filePath, content->etag, content->len, -1, content->body,
+								content->mediaType, content->modified, content->lastModified,
+								requestHeaders, responseHeaders, sendContent)) {
+				sendContentResponse(conn, content, requestHeaders, responseHeaders, sendContent);
+			}
+			closeCachedContent(content);
+			return;
+		}
+		if (!sendCompressed(conn, filePath, file->etag, file->sb.st_size, file->fd, NULL,
+							file->mediaType, file->sb.st_mtime, file->lastModified,
+							requestHeaders, responseHeaders, sendContent)) {
+			bool vary = (file->siblings != 0) || isCompressible(file->mediaType, file->sb.st_size);
+			sendFileResponse(conn, file, file->mediaType, NULL, vary,
+							 requestHeaders, responseHeaders, sendContent);
+		}
+		closeCachedFile(file);
+		return;
 	}
-	putProperty(responseHeaders, "Content-type", buf);
 
-	// send response
-	sendResponseStatus(stream, Http_OK, NULL);
+	// directory path ends with '/'
+	if (!S_ISDIR(file->sb.st_mode) || !strendswith(filePath, "/")) {
+		closeCachedFile(file);
+		sendStatusResponse(conn->stream, Http_NotFound, NULL, responseHeaders);
+		return;
+	}
 
-	// Send response headers
-	sendResponseHeaders(stream, responseHeaders);
+	ListingPage page;
+	if (!requestedListingPage(requestHeaders, &page)) {
+		closeCachedFile(file);
+		sendStatusResponse(conn->stream, Http_BadRequest, NULL, responseHeaders);
+		return;
+	}
+	putProperty(responseHeaders, "Vary", "Accept");
+	if (page.json || (page.limit > 0) || (page.cursor > 0) || (page.sort != ListingSort_None)) {
+		closeCachedFile(file);
+		sendListingPage(conn, filePath, uri, &page, responseHeaders, sendContent);
+		return;
+	}
 
-	if (sendContent) {  // for GET
-	    if (contentStream == NULL) {
-	        contentStream = fopen(filePath, "r");
-	    }
+	// listing is used until the directory or its entries change
+	CachedListing *listing = openCachedListing(filePath, uri, &file->sb, cacheable);
+	closeCachedFile(file);
+	if (listing == NULL) {
+		sendStatusResponse(conn->stream, Http_NotFound, NULL, responseHeaders);
+		return;
+	}
+	if (listing->body == NULL) {
+		// too long to keep in memory
+		closeCachedListing(listing);
+		sendListingPage(conn, filePath, uri, &page, responseHeaders, sendContent);
+		return;
+	}
 
-		//contentStream = fopen(filePath, "r");
-		copyFileStreamBytes(contentStream, stream, contentLen);
-		fclose(contentStream);
+	// some browsers interpret text/directory as a VCF file
+	if (!sendCompressed(conn, listing->path, listing->etag, listing->len, -1, listing->body,
+						"text/html", listing->modified, listing->lastModified,
+						requestHeaders, responseHeaders, sendContent)) {
+		sendBodyResponse(conn, listing->body, -1, listing->len, listing->contentLength,
+						 listing->etag, listing->modified, listing->lastModified, "text/html",
+						 NULL, isCompressible("text/html", listing->len),
+						 requestHeaders, responseHeaders, sendContent);
 	}
+	closeCachedListing(listing);
 }
 
 /**
  * Handle GET request.
  *
- * @param stream the socket stream
+ * @param conn the connection
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  * @param headOnly only perform head operation
  */
-void do_get(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
-	do_get_or_head(stream, uri, requestHeaders, responseHeaders, true);
+void do_get(HttpConnection *conn, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+	do_get_or_head(conn, uri, requestHeaders, responseHeaders, true);
 }
 
 /**
  * Handle HEAD request.
  *
- * @param the socket stream
+ * @param conn the connection
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_head(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
-	do_get_or_head(stream, uri, requestHeaders, responseHeaders, false);
+void do_head(HttpConnection *conn, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+	do_get_or_head(conn, uri, requestHeaders, responseHeaders, false);
 }
 
 /**
  * Handle DELETE request.
  *
- * @param the socket stream
+ * @param conn the connection
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
+void do_delete(HttpConnection *conn, const char *uri, Properties *requestHeaders, Properties *responseHeaders) {
     // get path to URI in file system
     char filePath[MAXPATHLEN];
     resolveUri(uri, filePath);
@@ -265,7 +824,7 @@ void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Proper
     // ensure file exists
     struct stat sb;
     if (stat(filePath, &sb) != 0) {
-        sendStatusResponse(stream, Http_NotFound, NULL, responseHeaders);
+        sendStatusResponse(conn->stream, Http_NotFound, NULL, responseHeaders);
         return;
     }
 
@@ -285,48 +844,135 @@ void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Proper
         closedir(dir);
         if (size != 0) {
             // not allowed for this method
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+            sendStatusResponse(conn->stream, Http_MethodNotAllowed, NULL, responseHeaders);
             return;
         }
     } else if (!S_ISREG(sb.st_mode)) { // error if not regular file
-        sendStatusResponse(stream, Http_NotFound, NULL, responseHeaders);
+        sendStatusResponse(conn->stream, Http_NotFound, NULL, responseHeaders);
         return;
     }
     if (remove(filePath) == 0) {
+        invalidateCachedFile(filePath);
+        invalidateCachedContent(filePath);
+        invalidateCachedListing(filePath);
         printf(stderr, "Deleted successfully\n");
-        //sendResponseStatus(stream, Http_OK, NULL);
-        sendStatusResponse(stream, Http_OK, NULL, responseHeaders);
+        //sendResponseStatus(conn->stream, Http_OK, NULL);
+        sendStatusResponse(conn->stream, Http_OK, NULL, responseHeaders);
     }
     else {
-        sendStatusResponse(stream, Http_NotFound, NULL, responseHeaders);
+        sendStatusResponse(conn->stream, Http_NotFound, NULL, responseHeaders);
     }
 }
 
+/**
+ * Determines whether the request body of a PUT or POST request
+ * can be received, from its framing and its declared length. A
+ * chunked body is checked against the maximum body size as its
+ * chunks are read.
+ * @param conn the connection
+ * @param requestHeaders the request headers
+ * @return 0 if the body can be received, or the error status:
+ *   411 if its length is unknown, 413 if it is too long,
+ *   501 if its transfer coding is not chunked
+ */
+static int requestBodyStatus(HttpConnection *conn, Properties *requestHeaders) {
+    if (conn->body_chunked) {
+        return 0;
+    }
+    char val[MAX_PROP_VAL];
+    if (findProperty(requestHeaders, 0, "Transfer-Encoding", val) != SIZE_MAX) {
+        return Http_NotImplemented;
+    }
+    if (findProperty(requestHeaders, 0, "Content-Length", val) == SIZE_MAX) {
+        return Http_LengthRequired;
+    }
+    // body length is tracked by the connection
+    if ((server.max_body_size > 0) && (conn->body_remaining > server.max_body_size * 1024)) {
+        return Http_PayloadTooLarge;
+    }
+    return 0;
+}
+
+/**
+ * Refuse the request body of a PUT or POST request with an
+ * error response, before any of the body is read.
+ * @param conn the connection
+ * @param status the response status
+ * @param responseHeaders the response headers
+ */
+static void refuseContent(HttpConnection *conn, int status, Properties *responseHeaders) {
+    refuseRequestBody(conn, responseHeaders);
+    sendStatusResponse(conn->stream, status, NULL, responseHeaders);
+}
+
+/**
+ * Read the request body into a temporary file in the directory
+ * of the file path, and rename it over the file path once the
+ * whole body was read, so a body that cannot be read leaves any
+ * file at the path as it was. Sends an error response, closing
+ * the connection if the body could not be read.
+ * @param conn the connection
+ * @param filePath the path of the file to write
+ * @param mode the permissions of the file
+ * @param responseHeaders the response headers
+ * @return true if the file was written
+ */
+static bool receiveContent(HttpConnection *conn, const char *filePath, mode_t mode,
+                           Properties *responseHeaders) {
+    char tempPath[MAXPATHLEN];
+    FILE *contentStream = createTempFile(filePath, tempPath, mode);
+    // if the file cannot be created
+    if (contentStream == NULL) {
+        refuseContent(conn, Http_MethodNotAllowed, responseHeaders);
+        return false;
+    }
+
+    bool keepAlive = conn->keep_alive;  // reset if the body cannot be read
+    int status = readRequestBody(conn, contentStream);
+    if ((fclose(contentStream) != 0) && (status == 0)) {
+        status = Http_InternalServerError;
+    }
+    if ((status == 0) && (rename(tempPath, filePath) != 0)) {
+        perror("receiveContent");
+        status = Http_InternalServerError;
+    }
+    if (status != 0) {
+        unlink(tempPath);
+        // the rest of the body cannot be found, so the connection closes
+        if (keepAlive && !conn->keep_alive) {
+            closeAfterResponse(conn, responseHeaders);
+        }
+        sendStatusResponse(conn->stream, status, NULL, responseHeaders);
+        return false;
+    }
+
+    // the cached status, open file, body and listing are out of date
+    invalidateCachedFile(filePath);
+    invalidateCachedContent(filePath);
+    invalidateCachedListing(filePath);
+    return true;
+}
+
 /**
  * Handle PUT request.
- * @param the socket stream
+ * @param conn the connection
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_put(FILE *stream, const char* uri, Properties *requestHeaders, Properties *responseHeaders){
+void do_put(HttpConnection *conn, const char* uri, Properties *requestHeaders, Properties *responseHeaders){
     // get path to URI in file system
     char filePath[MAXPATHLEN];
     resolveUri(uri, filePath);
 
-    // contentStream for the PUT operation where file stream bytes will be copied from
-    // contentStream to stream
-    FILE *contentStream = NULL;
     char buf[MAXBUF];
 
-    // check content_length
-    int contentLen;
-    char val[MAXBUF];
-    if (findProperty(requestHeaders, 0, "Content-Length", val) == SIZE_MAX) {
-        sendStatusResponse(stream, Http_LengthRequired, NULL, responseHeaders);
+    // check the body can be received before any of it is written
+    int bodyStatus = requestBodyStatus(conn, requestHeaders);
+    if (bodyStatus != 0) {
+        refuseContent(conn, bodyStatus, responseHeaders);
         return;
     }
-    contentLen = atoi(val);
 
     struct stat sb;
 
@@ -335,25 +981,20 @@ void do_put(FILE *stream, const char* uri, Properties *requestHeaders, Propertie
         // if the end of our file path to an existing file is a directory
         if (S_ISDIR(sb.st_mode) && strendswith(filePath, "/")) {
             // not allowed for this method
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+            refuseContent(conn, Http_MethodNotAllowed, responseHeaders);
             return;
         }
         // if the end of our file path to an existing file is not a regular file
         else if (!S_ISREG(sb.st_mode)) { // error if not regular file
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+            refuseContent(conn, Http_MethodNotAllowed, responseHeaders);
             return;
         }
 
-        // write request body to the file
-        contentStream = fopen(filePath, "w");
-        // if the file cannot be opened
-        if (contentStream == NULL) {
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+        // replace the file with the request body, keeping its permissions
+        if (!receiveContent(conn, filePath, sb.st_mode & 07777, responseHeaders)) {
             return;
         }
-        copyFileStreamBytes(stream, contentStream, contentLen);
-        fclose(contentStream);
-        sendStatusResponse(stream, Http_OK, NULL, responseHeaders);
+        sendStatusResponse(conn->stream, Http_OK, NULL, responseHeaders);
     }
 
     // if our file does not exist
@@ -361,56 +1002,46 @@ void do_put(FILE *stream, const char* uri, Properties *requestHeaders, Propertie
         char *pathOfFile = getPath(filePath, buf);
         // if getting the path to file is NULL
         if (pathOfFile == NULL) {
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+            refuseContent(conn, Http_MethodNotAllowed, responseHeaders);
             return;
         }
         // if creating intermediate directories fails
         if (mkdirs(pathOfFile, 0777) != 0){
         //if (mkdirs(pathOfFile, sb.st_mode) < 0){
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+            refuseContent(conn, Http_MethodNotAllowed, responseHeaders);
             return;
         }
 
         // write request body to the file
-        contentStream = fopen(filePath, "w");
-        // if the file cannot be opened
-        if (contentStream == NULL) {
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+        if (!receiveContent(conn, filePath, fileCreationMode(), responseHeaders)) {
             return;
         }
-        copyFileStreamBytes(stream, contentStream, contentLen);
-        fclose(contentStream);
         putProperty(responseHeaders,"Location", filePath);
-        sendStatusResponse(stream, Http_Created, NULL, responseHeaders);
+        sendStatusResponse(conn->stream, Http_Created, NULL, responseHeaders);
     }
 }
 
 /**
  * Handle POST request.
- * @param the socket stream
+ * @param conn the connection
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_post(FILE *stream, const char* uri, Properties *requestHeaders, Properties *responseHeaders){
+void do_post(HttpConnection *conn, const char* uri, Properties *requestHeaders, Properties *responseHeaders){
     // get path to URI in file system
     char collectionDirPath[MAXPATHLEN];
     resolveUri(uri, collectionDirPath);
     char filePath[MAXPATHLEN];
 
-    // contentStream for the POST operation where file stream bytes will be copied from
-    // contentStream to stream
-    FILE *contentStream = NULL;
     char buf[MAXBUF];
 
-    // check content_length
-    int contentLen;
-    char val[MAXBUF];
-    if (findProperty(requestHeaders, 0, "Content-Length", val) == SIZE_MAX) {
-        sendStatusResponse(stream, Http_LengthRequired, NULL, responseHeaders);
+    // check the body can be received before any of it is written
+    int bodyStatus = requestBodyStatus(conn, requestHeaders);
+    if (bodyStatus != 0) {
+        refuseContent(conn, bodyStatus, responseHeaders);
         return;
     }
-    contentLen = atoi(val);
 
     // contentTypeString should hold the string to Content-type: eg. application/x-www-form-urlencoded,
     // multipart/form-data, text/plain, etc.
@@ -445,12 +1076,12 @@ void do_post(FILE *stream, const char* uri, Properties *requestHeaders, Properti
         // if the path to a collection directory is not a directory
         if (!S_ISDIR(sb.st_mode)) {
             // not allowed for this method
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+            refuseContent(conn, Http_MethodNotAllowed, responseHeaders);
             return;
         }
 
         if (strendswith(collectionDirPath, "/")) {
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+            refuseContent(conn, Http_MethodNotAllowed, responseHeaders);
             return;
         }
 
@@ -461,25 +1092,27 @@ void do_post(FILE *stream, const char* uri, Properties *requestHeaders, Properti
         strcpy(filePath, collectionDirPath);
         strcat(filePath, "XXXXXXXXXX");
         strcat(filePath, extensionString);
-        mkstemps(filePath, strlen(extensionString));
+        int fd = mkstemps(filePath, strlen(extensionString));
+        // if the name cannot be reserved
+        if (fd == -1) {
+            refuseContent(conn, Http_MethodNotAllowed, responseHeaders);
+            return;
+        }
+        close(fd);
 
-        // write request body to the file
-        contentStream = fopen(filePath, "w");
-        // if the file cannot be opened
-        if (contentStream == NULL) {
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+        // write request body to the file, replacing the empty file
+        if (!receiveContent(conn, filePath, fileCreationMode(), responseHeaders)) {
+            remove(filePath);
             return;
         }
-        copyFileStreamBytes(stream, contentStream, contentLen);
-        fclose(contentStream);
         putProperty(responseHeaders,"Location", filePath);
-        sendStatusResponse(stream, Http_Created, NULL, responseHeaders);
+        sendStatusResponse(conn->stream, Http_Created, NULL, responseHeaders);
     }
 
     // if the path to a collection directory does not exist
     else {
         if (strendswith(collectionDirPath, "/")) {
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+            refuseContent(conn, Http_MethodNotAllowed, responseHeaders);
             return;
         }
 
@@ -490,30 +1123,59 @@ void do_post(FILE *stream, const char* uri, Properties *requestHeaders, Properti
         strcpy(filePath, collectionDirPath);
         strcat(filePath, "XXXXXXXXXX");
         strcat(filePath, extensionString);
-        mkstemps(filePath, strlen(extensionString));
 
         char *pathOfFile = getPath(filePath, buf);
         // if getting the path to file is NULL
         if (pathOfFile == NULL) {
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+            refuseContent(conn, Http_MethodNotAllowed, responseHeaders);
             return;
         }
         // if creating intermediate directories fails
         if (mkdirs(pathOfFile, 0777) != 0){
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+            refuseContent(conn, Http_MethodNotAllowed, responseHeaders);
+            return;
+        }
+        int fd = mkstemps(filePath, strlen(extensionString));
+        // if the name cannot be reserved
+        if (fd == -1) {
+            refuseContent(conn, Http_MethodNotAllowed, responseHeaders);
             return;
         }
+        close(fd);
 
-        // write request body to the file
-        contentStream = fopen(filePath, "w");
-        // if the file cannot be opened
-        if (contentStream == NULL) {
-            sendStatusResponse(stream, Http_MethodNotAllowed, NULL, responseHeaders);
+        // write request body to the file, replacing the empty file
+        if (!receiveContent(conn, filePath, fileCreationMode(), responseHeaders)) {
+            remove(filePath);
             return;
         }
-        copyFileStreamBytes(stream, contentStream, contentLen);
-        fclose(contentStream);
         putProperty(responseHeaders,"Location", filePath);
-        sendStatusResponse(stream, Http_Created, NULL, responseHeaders);
+        sendStatusResponse(conn->stream, Http_Created, NULL, responseHeaders);
     }
 }
+
+/**
+ * Handle GET or HEAD request for the server status URI
+ * by reporting the server counters as plain text.
+ * @param conn the connection
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent true to send the counters (GET)
+ */
+void do_status(HttpConnection *conn, const char* uri, Properties *requestHeaders, Properties *responseHeaders, bool sendContent) {
+	char body[16*MAXBUF];
+	size_t contentLen = formatServerStats(body, sizeof(body));
+
+	char buf[MAXBUF];
+	sprintf(buf, "%lu", contentLen);
+	putProperty(responseHeaders, "Content-Length", buf);
+	putProperty(responseHeaders, "Content-type", "text/plain");
+	// counters change with every request
+	putProperty(responseHeaders, "Cache-Control", "no-store");
+
+	sendResponseStatus(conn->stream, Http_OK, NULL);
+	sendResponseHeaders(conn->stream, responseHeaders);
+	if (sendContent) {
+		fwrite(body, sizeof(char), contentLen, conn->stream);
+	}
+}
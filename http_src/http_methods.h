@@ -11,54 +11,66 @@
 
 #include <stdio.h>
 #include "properties.h"
+#include "http_connection.h"
 
 /**
  * Handle HEAD request.
  *
- * @param the socket stream
+ * @param conn the connection
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_get(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+void do_get(HttpConnection *conn, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
 
 /**
  * Handle HEAD request.
  *
- * @param the socket stream
+ * @param conn the connection
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_head(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+void do_head(HttpConnection *conn, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
 
 /**
  * Handle DELETE request.
  *
- * @param the socket stream
+ * @param conn the connection
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_delete(FILE *stream, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
+void do_delete(HttpConnection *conn, const char *uri, Properties *requestHeaders, Properties *responseHeaders);
 
 /**
  * Handle PUT request.
- * @param the socket stream
+ * @param conn the connection
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_put(FILE *stream, const char* uri, Properties *requestHeaders, Properties *responseHeaders);
+void do_put(HttpConnection *conn, const char* uri, Properties *requestHeaders, Properties *responseHeaders);
 
 /**
  * Handle POST request.
- * @param the socket stream
+ * @param conn the connection
  * @param uri the request URI
  * @param requestHeaders the request headers
  * @param responseHeaders the response headers
  */
-void do_post(FILE *stream, const char* uri, Properties *requestHeaders, Properties *responseHeaders);
+void do_post(HttpConnection *conn, const char* uri, Properties *requestHeaders, Properties *responseHeaders);
+
+/**
+ * Handle GET or HEAD request for the server status URI
+ * by reporting the server counters as plain text.
+ * @param conn the connection
+ * @param uri the request URI
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @param sendContent true to send the counters (GET)
+ */
+void do_status(HttpConnection *conn, const char* uri, Properties *requestHeaders, Properties *responseHeaders, bool sendContent);
 
 
 #endif /* HTTP_METHODS_H_ */
@@ -0,0 +1,264 @@
+/*
+ * http_parser.c
+ *
+ * Functions that implement an incremental parser for the
+ * request line and headers of an HTTP/1.x request.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "http_codes.h"
+#include "http_parser.h"
+#include "http_scan.h"
+
+/**
+ * Returns the length of the token at the start of a string.
+ *
+ * @param p the string
+ * @param end the end of the string
+ * @return the length of the token
+ */
+static size_t tokenLength(const char *p, const char *end) {
+	return scanTokenChars(p, end) - p;
+}
+
+/**
+ * Returns true if a string has a control character other than tab.
+ *
+ * @param p the string
+ * @param end the end of the string
+ * @return true if the string has a control character
+ */
+static bool hasControlChar(const char *p, const char *end) {
+	return scanFieldChars(p, end) != end;
+}
+
+/**
+ * Reject the request head with an error status.
+ *
+ * @param parser the parser
+ * @param status the error status
+ * @return -1 for the rejected head
+ */
+static int rejectRequestHead(RequestParser *parser, int status) {
+	parser->state = RequestParse_Error;
+	parser->status = status;
+	return -1;
+}
+
+/**
+ * Parse the request line: method, target and version
+ * separated by single spaces.
+ *
+ * @param parser the parser
+ * @param line the line without its line ending
+ * @param end the end of the line
+ * @return 0 if successful, or the error status
+ */
+static int parseRequestLine(RequestParser *parser, char *line, char *end) {
+	HttpRequestHead *head = &parser->head;
+
+	head->method.ptr = line;
+	head->method.len = tokenLength(line, end);
+	char *p = line + head->method.len;
+	if ((head->method.len == 0) || (p == end) || (*p != ' ')) {
+		return Http_BadRequest;
+	}
+
+	head->uri.ptr = ++p;
+	char *sp = memchr(p, ' ', end - p);
+	if ((sp == NULL) || (sp == p) || hasControlChar(p, sp)) {
+		return Http_BadRequest;
+	}
+	head->uri.len = sp - p;
+
+	head->version.ptr = ++sp;
+	head->version.len = end - sp;
+	if (   (head->version.len != 8) || (strncmp(sp, "HTTP/", 5) != 0)
+		|| (sp[5] < '0') || (sp[5] > '9') || (sp[6] != '.') || (sp[7] < '0') || (sp[7] > '9')) {
+		return Http_BadRequest;
+	}
+	if (sp[5] != '1') {
+		return Http_HTTPVersionNotSupported;
+	}
+	if (head->uri.len > parser->max_uri) {
+		return Http_URITooLong;
+	}
+	return 0;
+}
+
+/**
+ * Parse a header field line: a field name, a colon, and a
+ * value with optional whitespace around it.
+ *
+ * @param parser the parser
+ * @param line the line without its line ending
+ * @param end the end of the line
+ * @return 0 if successful, or the error status
+ */
+static int parseHeaderLine(RequestParser *parser, char *line, char *end) {
+	HttpRequestHead *head = &parser->head;
+	if (head->nheaders == MAX_REQUEST_HEADERS) {
+		return Http_RequestHeaderFieldsTooLarge;
+	}
+
+	// no whitespace before the colon, which also rejects obsolete line folding
+	HttpHeaderSlice *header = &head->headers[head->nheaders];
+	header->name.ptr = line;
+	header->name.len = tokenLength(line, end);
+	char *p = line + header->name.len;
+	if ((header->name.len == 0) || (p == end) || (*p != ':')) {
+		return Http_BadRequest;
+	}
+
+	for (p++; (p < end) && ((*p == ' ') || (*p == '\t')); p++) {}
+	while ((end > p) && ((end[-1] == ' ') || (end[-1] == '\t'))) {
+		end--;
+	}
+	if (hasControlChar(p, end)) {
+		return Http_BadRequest;
+	}
+	header->value.ptr = p;
+	header->value.len = end - p;
+	head->nheaders++;
+	return 0;
+}
+
+/**
+ * Move the slices parsed so far to where the buffer is now.
+ *
+ * @param parser the parser
+ * @param buf the buffer that starts with the request head
+ */
+static void rebaseRequestHead(RequestParser *parser, char *buf) {
+	if ((parser->base == buf) || (parser->base == NULL)) {
+		parser->base = buf;
+		return;
+	}
+	HttpRequestHead *head = &parser->head;
+	if (parser->state == RequestParse_Headers) {
+		head->method.ptr = buf + (head->method.ptr - parser->base);
+		head->uri.ptr = buf + (head->uri.ptr - parser->base);
+		head->version.ptr = buf + (head->version.ptr - parser->base);
+		for (size_t i = 0; i < head->nheaders; i++) {
+			head->headers[i].name.ptr = buf + (head->headers[i].name.ptr - parser->base);
+			head->headers[i].value.ptr = buf + (head->headers[i].value.ptr - parser->base);
+		}
+	}
+	parser->base = buf;
+}
+
+/**
+ * Terminate each slice of the complete head in place. The byte
+ * after each slice is a delimiter or line ending within the head.
+ *
+ * @param head the request head
+ */
+static void terminateRequestHead(HttpRequestHead *head) {
+	head->method.ptr[head->method.len] = '\0';
+	head->uri.ptr[head->uri.len] = '\0';
+	head->version.ptr[head->version.len] = '\0';
+	for (size_t i = 0; i < head->nheaders; i++) {
+		head->headers[i].name.ptr[head->headers[i].name.len] = '\0';
+		head->headers[i].value.ptr[head->headers[i].value.len] = '\0';
+	}
+}
+
+/**
+ * Initialize a request parser for the next request head.
+ *
+ * @param parser the parser
+ * @param max_head the maximum length of a request head
+ * @param max_uri the maximum length of a request target
+ */
+void initRequestParser(RequestParser *parser, size_t max_head, size_t max_uri) {
+	parser->state = RequestParse_RequestLine;
+	parser->max_head = max_head;
+	parser->max_uri = max_uri;
+	parser->base = NULL;
+	parser->line_start = parser->scan = 0;
+	parser->head_len = 0;
+	parser->status = 0;
+	parser->head.nheaders = 0;
+}
+
+/**
+ * Parse the bytes of a request head received so far. The buffer
+ * starts with the head and holds all of its bytes received, so a
+ * call after more bytes arrive resumes with the first line not yet
+ * parsed. Empty lines before the request line are skipped.
+ *
+ * Once the head is complete, its slices point into the buffer, and
+ * each slice is also terminated in place so it can be used as a
+ * string. A head longer than the maximum is rejected with 431, as
+ * is one with too many header fields; a request target longer than
+ * the maximum with 414, a version other than HTTP/1.x with 505, and
+ * any other malformed line with 400.
+ *
+ * @param parser the parser
+ * @param buf the buffer that starts with the request head
+ * @param len the number of bytes in the buffer
+ * @return 1 if the head is complete, 0 if more bytes are needed,
+ *   -1 if the head is rejected with the status in the parser
+ */
+int parseRequestHead(RequestParser *parser, char *buf, size_t len) {
+	if (parser->state == RequestParse_Done) {
+		return 1;
+	}
+	if (parser->state == RequestParse_Error) {
+		return -1;
+	}
+	rebaseRequestHead(parser, buf);
+
+	// only bytes within the limit can belong to the head
+	size_t limit = (len < parser->max_head) ? len : parser->max_head;
+	while (parser->scan < limit) {
+		char *nl = memchr(buf + parser->scan, '\n', limit - parser->scan);
+		if (nl == NULL) {
+			// resume the search with the next bytes received
+			parser->scan = limit;
+			break;
+		}
+		char *line = buf + parser->line_start;
+		char *end = (nl > line) && (nl[-1] == '\r') ? nl - 1 : nl;
+		parser->line_start = parser->scan = nl + 1 - buf;
+
+		int status = 0;
+		if (parser->state == RequestParse_RequestLine) {
+			if (end == line) {
+				continue;  // empty line before request line
+			}
+			status = parseRequestLine(parser, line, end);
+			parser->state = RequestParse_Headers;
+		} else if (end == line) {
+			// blank line ends the head
+			parser->head_len = parser->line_start;
+			parser->state = RequestParse_Done;
+			terminateRequestHead(&parser->head);
+			return 1;
+		} else {
+			status = parseHeaderLine(parser, line, end);
+		}
+		if (status != 0) {
+			return rejectRequestHead(parser, status);
+		}
+	}
+
+	if (len >= parser->max_head) {
+		// head cannot end within the limit
+		return rejectRequestHead(parser, Http_RequestHeaderFieldsTooLarge);
+	}
+	return 0;
+}
+
+/**
+ * Returns true if parsing stopped with a complete or rejected head.
+ *
+ * @param parser the parser
+ * @return true if the parser needs no more bytes
+ */
+bool requestParseFinished(const RequestParser *parser) {
+	return (parser->state == RequestParse_Done) || (parser->state == RequestParse_Error);
+}
@@ -0,0 +1,98 @@
+/*
+ * http_parser.h
+ *
+ * Functions that implement an incremental parser for the
+ * request line and headers of an HTTP/1.x request.
+ *
+ */
+
+#ifndef HTTP_PARSER_H_
+#define HTTP_PARSER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** maximum header fields in a request head */
+#define MAX_REQUEST_HEADERS 64
+
+/** Definition of a slice of a request head */
+typedef struct HttpSlice {
+	char *ptr;                    /** first byte of slice */
+	size_t len;                   /** length of slice */
+} HttpSlice;
+
+/** Definition of a request header field */
+typedef struct HttpHeaderSlice {
+	HttpSlice name;               /** field name */
+	HttpSlice value;              /** field value without surrounding whitespace */
+} HttpHeaderSlice;
+
+/** Definition of a parsed request head */
+typedef struct HttpRequestHead {
+	HttpSlice method;             /** request method */
+	HttpSlice uri;                /** request target */
+	HttpSlice version;            /** protocol version */
+	size_t nheaders;              /** number of header fields */
+	HttpHeaderSlice headers[MAX_REQUEST_HEADERS];  /** header fields in request order */
+} HttpRequestHead;
+
+/** request parser states */
+enum RequestParseState {
+	RequestParse_RequestLine,     /** waiting for the request line */
+	RequestParse_Headers,         /** waiting for the blank line after the headers */
+	RequestParse_Done,            /** head is complete */
+	RequestParse_Error            /** head is rejected with an error status */
+};
+
+/** Definition of a request parser that resumes where it left off */
+typedef struct RequestParser {
+	enum RequestParseState state; /** parser state */
+	size_t max_head;              /** maximum length of a request head */
+	size_t max_uri;               /** maximum length of a request target */
+	char *base;                   /** buffer of the last call, for slices parsed so far */
+	size_t line_start;            /** offset of line being parsed */
+	size_t scan;                  /** offset where search for end of line resumes */
+	size_t head_len;              /** length of complete head */
+	int status;                   /** error status of rejected head */
+	HttpRequestHead head;         /** slices of complete head */
+} RequestParser;
+
+/**
+ * Initialize a request parser for the next request head.
+ *
+ * @param parser the parser
+ * @param max_head the maximum length of a request head
+ * @param max_uri the maximum length of a request target
+ */
+void initRequestParser(RequestParser *parser, size_t max_head, size_t max_uri);
+
+/**
+ * Parse the bytes of a request head received so far. The buffer
+ * starts with the head and holds all of its bytes received, so a
+ * call after more bytes arrive resumes with the first line not yet
+ * parsed. Empty lines before the request line are skipped.
+ *
+ * Once the head is complete, its slices point into the buffer, and
+ * each slice is also terminated in place so it can be used as a
+ * string. A head longer than the maximum is rejected with 431, as
+ * is one with too many header fields; a request target longer than
+ * the maximum with 414, a version other than HTTP/1.x with 505, and
+ * any other malformed line with 400.
+ *
+ * @param parser the parser
+ * @param buf the buffer that starts with the request head
+ * @param len the number of bytes in the buffer
+ * @return 1 if the head is complete, 0 if more bytes are needed,
+ *   -1 if the head is rejected with the status in the parser
+ */
+int parseRequestHead(RequestParser *parser, char *buf, size_t len);
+
+/**
+ * Returns true if parsing stopped with a complete or rejected head.
+ *
+ * @param parser the parser
+ * @return true if the parser needs no more bytes
+ */
+bool requestParseFinished(const RequestParser *parser);
+
+#endif /* HTTP_PARSER_H_ */
@@ -4,6 +4,10 @@
  * Functions used to process requests from clients.
  *
  */
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -15,34 +19,156 @@
 #include "time_util.h"
 #include "http_server.h"
 #include "http_codes.h"
+#include "http_connection.h"
+#include "http_request.h"
+#include "server_stats.h"
 
 
 /**
- *  Process an http request.
- *  @param sock_fd the socket descriptor
+ * Determine whether the client wants the connection kept alive.
+ * HTTP/1.1 connections persist unless the request has a
+ * "Connection: close" header; HTTP/1.0 connections persist
+ * only with a "Connection: keep-alive" header.
+ *
+ * @param version the request protocol version
+ * @param requestHeaders the request headers
+ * @return true if the client wants a persistent connection
  */
-void process_request(int sock_fd) {
-	char buf[MAXBUF];
-	char request[MAXBUF];
-	char method[MAXBUF];
-	char uri[MAXBUF], encUri[MAXBUF];
-	char version[MAXBUF];
+static bool requestKeepAlive(const char *version, Properties *requestHeaders) {
+	char val[MAX_PROP_VAL];
+	if (findProperty(requestHeaders, 0, "Connection", val) == SIZE_MAX) {
+		return strcasecmp(version, "HTTP/1.1") == 0;
+	}
+	strlower(val, val);
+	if (strcasecmp(version, "HTTP/1.1") == 0) {
+		return strstr(val, "close") == NULL;
+	}
+	return strstr(val, "keep-alive") != NULL;
+}
+
+/**
+ * Find the length of a request body from its Content-Length
+ * headers. Repeated headers and list elements must all be the
+ * same valid length, or the body cannot be found and the request
+ * is answered with 400 (RFC 7230 3.3.3).
+ *
+ * @param requestHeaders the request headers
+ * @return the body length, 0 if none, or -1 if a length is
+ *   invalid or the lengths differ
+ */
+static long long requestContentLength(Properties *requestHeaders) {
+	char val[MAX_PROP_VAL];
+	long long len = -1;
+	for (size_t i = findProperty(requestHeaders, 0, "Content-Length", val);
+		 i != SIZE_MAX; i = findProperty(requestHeaders, i+1, "Content-Length", val)) {
+		char *p = val;
+		do {
+			p += strspn(p, " \t");
+			if (!isdigit((unsigned char)*p)) {
+				return -1;
+			}
+			char *end;
+			errno = 0;
+			long long n = strtoll(p, &end, 10);
+			p = end + strspn(end, " \t");
+			if (   (errno == ERANGE) || ((*p != '\0') && (*p != ','))
+				|| ((len != -1) && (n != len))) {
+				return -1;
+			}
+			len = n;
+		} while (*p++ == ',');
+	}
+	return (len == -1) ? 0 : len;
+}
+
+/**
+ * Decide whether the connection is kept alive after this request
+ * and record the decision in the response headers.
+ *
+ * @param conn the connection
+ * @param version the request protocol version
+ * @param requestHeaders the request headers
+ * @param responseHeaders the response headers
+ * @return false if the Content-Length of the request is invalid,
+ *   so the request is answered with 400 and the connection closed
+ */
+static bool setKeepAlive(HttpConnection *conn, const char *version,
+						 Properties *requestHeaders, Properties *responseHeaders) {
+	char val[MAX_PROP_VAL];
+
+	// request body length must be known to find the next request
+	conn->body_remaining = 0;
+	conn->body_chunked = false;
+	bool framed = true;
+	bool valid = true;
+	if (findProperty(requestHeaders, 0, "Transfer-Encoding", val) != SIZE_MAX) {
+		// only chunked bodies are read; with a Content-Length too, the
+		// request may frame differently elsewhere (RFC 7230 3.3.3)
+		conn->body_chunked = (strcasecmp(val, "chunked") == 0);
+		framed =    conn->body_chunked
+				 && (findProperty(requestHeaders, 0, "Content-Length", val) == SIZE_MAX);
+	} else if ((conn->body_remaining = requestContentLength(requestHeaders)) < 0) {
+		conn->body_remaining = 0;
+		framed = valid = false;
+	}
+
+	conn->keep_alive = framed
+			&& (conn->nrequests < server.max_keep_alive_requests)
+			&& requestKeepAlive(version, requestHeaders);
 
-	// open socket as a stream
-	FILE *stream = fdopen(sock_fd, "r+");
-	if (stream == NULL) {
-		perror("fdopen");
-		return;
+	// HTTP/1.0 clients do not understand chunked response bodies
+	conn->chunked = (strcasecmp(version, "HTTP/1.1") == 0);
+
+	// client may wait for 100 Continue before sending the body, which
+	// HTTP/1.0 clients are not sent (RFC 7231 5.1.1)
+	conn->expect_continue =    conn->chunked
+							&& ((conn->body_remaining > 0) || conn->body_chunked)
+							&& (findProperty(requestHeaders, 0, "Expect", val) != SIZE_MAX)
+							&& (strcasecmp(val, "100-continue") == 0);
+
+	if (!conn->keep_alive) {
+		closeAfterResponse(conn, responseHeaders);
+	} else if (strcasecmp(version, "HTTP/1.1") != 0) {
+		// HTTP/1.0 clients must be told the connection persists
+		putProperty(responseHeaders, "Connection", "keep-alive");
+		sprintf(val, "timeout=%d, max=%d", server.keep_alive_timeout,
+				server.max_keep_alive_requests - conn->nrequests);
+		putProperty(responseHeaders, "Keep-Alive", val);
 	}
-	// turn off buffering to also allow direct use of socket
-	setvbuf(stream, NULL, _IONBF, 0);
+	return valid;
+}
+
+/**
+ * Determines whether a request has an expectation other than
+ * 100-continue, which cannot be met (RFC 7231 5.1.1).
+ *
+ * @param requestHeaders the request headers
+ * @return true if the request should get 417 Expectation Failed
+ */
+static bool hasUnmetExpectation(Properties *requestHeaders) {
+	char val[MAX_PROP_VAL];
+	return    (findProperty(requestHeaders, 0, "Expect", val) != SIZE_MAX)
+		   && (strcasecmp(val, "100-continue") != 0);
+}
+
+/**
+ *  Process an http request on a connection.
+ *  @param conn the connection
+ *  @return true if the connection is kept alive for another request
+ */
+bool process_request(HttpConnection *conn) {
+	FILE *stream = conn->stream;
+	char buf[MAXBUF];
+	char uri[MAXBUF];
 
-	// get header line
-	if (fgets(request, MAXBUF, stream) == NULL) {
-		return;
+	// head was received and parsed before the request was dispatched
+	conn->keep_alive = false;
+	if (!hasRequestHead(conn)) {
+		return false;
 	}
-	// eliminate newline from request
-	trim_newline(request);
+	HttpRequestHead *head = takeRequestHead(conn);
+	conn->nrequests++;
+	STAT_INCR(requests);
 
 	// initialize request headers
 	Properties *responseHeaders = newProperties();
@@ -50,28 +176,43 @@ void process_request(int sock_fd) {
 	putProperty(responseHeaders, "Server", server.server_name);
 
 	// date and time of this response
-	time_t timer;
-	time(&timer); // need to get local file time?
-	putProperty(responseHeaders,"Date",
-				milliTimeToRFC_1123_Date_Time(timer, buf));
+	putProperty(responseHeaders,"Date", currentRFC_1123_Date_Time(buf));
 
 
-	// parse header
-	if (sscanf(request, "%s %s %s", method, encUri, version) != 3) {
+	if (head == NULL) {
+		// malformed, too large, or unsupported version
+		int status = requestHeadStatus(conn);
 		if (server.debug) {
-			fprintf(stderr, "request header incomplete: %s\n", request);
+			fprintf(stderr, "request head rejected: %d %s\n", status, httpCodeStr(status));
 		}
-		sendStatusResponse(stream, Http_BadRequest, NULL, responseHeaders);
-		return;
+		putProperty(responseHeaders, "Connection", "close");
+		sendStatusResponse(stream, status, NULL, responseHeaders);
+		deleteProperties(responseHeaders);
+		return false;
 	}
 
+	// slices of the head are terminated in place in the receive buffer
+	const char *method = head->method.ptr;
+	char *encUri = head->uri.ptr;
+	const char *version = head->version.ptr;
+
 	// initialize request headers
 	Properties *requestHeaders = newProperties();
-	readRequestHeaders(stream, requestHeaders);
+	for (size_t i = 0; i < head->nheaders; i++) {
+		if (!putProperty(requestHeaders, head->headers[i].name.ptr, head->headers[i].value.ptr)) {
+			fprintf(stderr, "process_request requestHeaders full\n");
+			break;
+		}
+	}
 	if (server.debug) {
+		char request[3*MAXBUF];
+		snprintf(request, sizeof(request), "%s %s %s", method, encUri, version);
 		debugRequest(request, requestHeaders);
 	}
 
+	// persistent connection unless client or limits say otherwise
+	bool validLength = setKeepAlive(conn, version, requestHeaders, responseHeaders);
+
 	// save query parameters as request header key "?"
 	char *p = strpbrk(encUri,"?&");  // query separators
 	if (p != NULL) {
@@ -79,26 +220,45 @@ void process_request(int sock_fd) {
 		*p = '\0';
 	}
 
+	// next request cannot be found after a body of unknown length
+	if (!validLength) {
+		if (server.debug) {
+			fprintf(stderr, "request header invalid Content-Length\n");
+		}
+		sendStatusResponse(stream, Http_BadRequest, NULL, responseHeaders);
+	}
+
 	// unescape URI
-	if (unescapeUri(encUri, uri) == NULL) {
+	else if (unescapeUri(encUri, uri) == NULL) {
 		if (server.debug) {
-			fprintf(stderr, "request header invalid URI encoding %s\n", request);
+			fprintf(stderr, "request header invalid URI encoding %s\n", encUri);
 		}
 		sendStatusResponse(stream, Http_BadRequest, NULL, responseHeaders);
-		return;
+	}
+
+	// body of a request whose expectation fails is not read
+	else if (hasUnmetExpectation(requestHeaders)) {
+		refuseRequestBody(conn, responseHeaders);
+		sendStatusResponse(stream, Http_ExpectationFailed, NULL, responseHeaders);
+	}
+
+	// server counters on the status URI if enabled
+	else if (   (*server.status_uri != '\0') && (strcmp(uri, server.status_uri) == 0)
+			 && ((strcasecmp(method, "GET") == 0) || (strcasecmp(method, "HEAD") == 0))) {
+		do_status(conn, uri, requestHeaders, responseHeaders, strcasecmp(method, "GET") == 0);
 	}
 
 	// dispatch based on method
-	if (strcasecmp(method, "GET") == 0) {
-		do_get(stream, uri, requestHeaders, responseHeaders);
+	else if (strcasecmp(method, "GET") == 0) {
+		do_get(conn, uri, requestHeaders, responseHeaders);
 	} else 	if (strcasecmp(method, "HEAD") == 0) {
-		do_head(stream, uri, requestHeaders, responseHeaders);
+		do_head(conn, uri, requestHeaders, responseHeaders);
 	} else if (strcasecmp(method, "DELETE") == 0) {
-        do_delete(stream, uri, requestHeaders, responseHeaders);
+        do_delete(conn, uri, requestHeaders, responseHeaders);
     } else if (strcasecmp(method, "PUT") == 0) {
-        do_put(stream, uri, requestHeaders, responseHeaders);
+        do_put(conn, uri, requestHeaders, responseHeaders);
     } else if (strcasecmp(method, "POST") == 0) {
-        do_post(stream, uri, requestHeaders, responseHeaders);
+        do_post(conn, uri, requestHeaders, responseHeaders);
     } else {
 		sendStatusResponse(stream, Http_NotImplemented, NULL, responseHeaders);
 	}
@@ -107,9 +267,16 @@ void process_request(int sock_fd) {
 	deleteProperties(requestHeaders);
 	deleteProperties(responseHeaders);
 
-	// close socket stream
-	fflush(stream);
-	fclose(stream);
-	close(sock_fd);
-}
+	// next request cannot be found after an unread request body,
+	// unless a short body is read and discarded
+	if (   ((conn->body_remaining > 0) || conn->body_chunked)
+		&& (!conn->keep_alive || !canDrainRequestBody(conn) || (readRequestBody(conn, NULL) != 0))) {
+		conn->keep_alive = false;
+	}
+
+	// the wait for the next request starts now
+	finishConnectionRequest(conn);
 
+	// response stays queued until the connection is flushed
+	return conn->keep_alive;
+}
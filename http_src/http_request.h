@@ -8,11 +8,15 @@
 #ifndef HTTP_REQUEST_H_
 #define HTTP_REQUEST_H_
 
+#include <stdbool.h>
+#include "http_connection.h"
+
 /**
- *  Process an http request.
- *  @param sock_fd the socket descriptor
+ *  Process an http request on a connection.
+ *  @param conn the connection
+ *  @return true if the connection is kept alive for another request
  */
-void process_request(int sock_fd);
+bool process_request(HttpConnection *conn);
 
 
 #endif /* HTTP_REQUEST_H_ */
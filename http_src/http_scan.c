@@ -0,0 +1,251 @@
+/*
+ * http_scan.c
+ *
+ * Functions that scan request heads for token and field
+ * value characters, with vectorized versions selected for
+ * the CPU at runtime.
+ *
+ * The SSE4.2 versions compare 16 bytes at a time against
+ * character ranges, as picohttpparser does. The AVX2 version
+ * for field values compares 32 bytes at a time and leaves
+ * shorter values and the last bytes to the SSE4.2 compare.
+ * Field names are too short to gain from AVX2, so they are
+ * always scanned by the SSE4.2 version. Bytes left at the
+ * end of a string are scanned by the scalar versions.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "http_scan.h"
+
+// build with -DNO_X86_SIMD to measure the scalar functions alone
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(NO_X86_SIMD)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/** token characters of methods and field names (RFC 9110 5.6.2) */
+static const char tokenChars[256] = {
+	['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1,
+	['*'] = 1, ['+'] = 1, ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1,
+	['`'] = 1, ['|'] = 1, ['~'] = 1,
+	['0'] = 1, ['1'] = 1, ['2'] = 1, ['3'] = 1, ['4'] = 1,
+	['5'] = 1, ['6'] = 1, ['7'] = 1, ['8'] = 1, ['9'] = 1,
+	['A'] = 1, ['B'] = 1, ['C'] = 1, ['D'] = 1, ['E'] = 1, ['F'] = 1, ['G'] = 1,
+	['H'] = 1, ['I'] = 1, ['J'] = 1, ['K'] = 1, ['L'] = 1, ['M'] = 1, ['N'] = 1,
+	['O'] = 1, ['P'] = 1, ['Q'] = 1, ['R'] = 1, ['S'] = 1, ['T'] = 1, ['U'] = 1,
+	['V'] = 1, ['W'] = 1, ['X'] = 1, ['Y'] = 1, ['Z'] = 1,
+	['a'] = 1, ['b'] = 1, ['c'] = 1, ['d'] = 1, ['e'] = 1, ['f'] = 1, ['g'] = 1,
+	['h'] = 1, ['i'] = 1, ['j'] = 1, ['k'] = 1, ['l'] = 1, ['m'] = 1, ['n'] = 1,
+	['o'] = 1, ['p'] = 1, ['q'] = 1, ['r'] = 1, ['s'] = 1, ['t'] = 1, ['u'] = 1,
+	['v'] = 1, ['w'] = 1, ['x'] = 1, ['y'] = 1, ['z'] = 1
+};
+
+/**
+ * Find the end of a token one character at a time.
+ *
+ * @param p the string
+ * @param end the end of the string
+ * @return the first character after the token, or end
+ */
+static const char *scanTokenCharsScalar(const char *p, const char *end) {
+	while ((p < end) && tokenChars[(unsigned char)*p]) {
+		p++;
+	}
+	return p;
+}
+
+/**
+ * Find the first control character in a field value
+ * one character at a time.
+ *
+ * @param p the string
+ * @param end the end of the string
+ * @return the first control character, or end if none
+ */
+static const char *scanFieldCharsScalar(const char *p, const char *end) {
+	for (; p < end; p++) {
+		unsigned char c = *p;
+		if (((c < ' ') && (c != '\t')) || (c == 0x7f)) {
+			break;
+		}
+	}
+	return p;
+}
+
+#if defined(HAVE_X86_SIMD)
+
+/**
+ * Ranges of characters that may end a token: every non-token
+ * character, and the token characters '|' and '~' since only
+ * 8 ranges fit in one compare.
+ */
+static const char tokenStopRanges[16] =
+	"\x00 " "\"\"" "()" ",," "//" ":@" "[]" "{\xff";
+
+/** ranges of control characters other than tab */
+static const char fieldStopRanges[16] = "\x00\x08" "\x0a\x1f" "\x7f\x7f";
+
+/**
+ * Find the first control character in a field value 16
+ * characters at a time. Always inlined, so the AVX2 version
+ * gets a copy in AVX encoding rather than paying for switching
+ * from AVX to SSE code.
+ *
+ * @param p the string
+ * @param end the end of the string
+ * @return the first control character, or end if none
+ */
+__attribute__((target("sse4.2"), always_inline))
+static inline const char *scanFieldRanges(const char *p, const char *end) {
+	const __m128i ranges = _mm_loadu_si128((const __m128i*)fieldStopRanges);
+	while (end - p >= 16) {
+		__m128i chars = _mm_loadu_si128((const __m128i*)p);
+		int i = _mm_cmpestri(ranges, 6, chars, 16,
+							 _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+		if (i != 16) {
+			return p + i;
+		}
+		p += 16;
+	}
+	return scanFieldCharsScalar(p, end);
+}
+
+/**
+ * Find the end of a token 16 characters at a time.
+ *
+ * @param p the string
+ * @param end the end of the string
+ * @return the first character after the token, or end
+ */
+__attribute__((target("sse4.2")))
+static const char *scanTokenCharsSse42(const char *p, const char *end) {
+	const __m128i ranges = _mm_loadu_si128((const __m128i*)tokenStopRanges);
+	while (end - p >= 16) {
+		__m128i chars = _mm_loadu_si128((const __m128i*)p);
+		int i = _mm_cmpestri(ranges, 16, chars, 16,
+							 _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+		if (i == 16) {
+			p += 16;
+			continue;
+		}
+		p += i;
+		if (!tokenChars[(unsigned char)*p]) {
+			return p;
+		}
+		p++;  // '|' or '~'
+	}
+	return scanTokenCharsScalar(p, end);
+}
+
+/**
+ * Find the first control character in a field value
+ * 16 characters at a time.
+ *
+ * @param p the string
+ * @param end the end of the string
+ * @return the first control character, or end if none
+ */
+__attribute__((target("sse4.2")))
+static const char *scanFieldCharsSse42(const char *p, const char *end) {
+	return scanFieldRanges(p, end);
+}
+
+/**
+ * Returns a mask of the bytes within an unsigned range.
+ *
+ * @param chars the bytes
+ * @param lo the lowest byte in the range
+ * @param hi the highest byte in the range
+ * @return 0xff for each byte in the range, 0 otherwise
+ */
+__attribute__((target("avx2")))
+static inline __m256i bytesInRange(__m256i chars, char lo, char hi) {
+	__m256i aboveLo = _mm256_cmpeq_epi8(_mm256_max_epu8(chars, _mm256_set1_epi8(lo)), chars);
+	__m256i belowHi = _mm256_cmpeq_epi8(_mm256_min_epu8(chars, _mm256_set1_epi8(hi)), chars);
+	return _mm256_and_si256(aboveLo, belowHi);
+}
+
+/**
+ * Find the first control character in a field value
+ * 32 characters at a time.
+ *
+ * @param p the string
+ * @param end the end of the string
+ * @return the first control character, or end if none
+ */
+__attribute__((target("avx2")))
+static const char *scanFieldCharsAvx2(const char *p, const char *end) {
+	while (end - p >= 32) {
+		__m256i chars = _mm256_loadu_si256((const __m256i*)p);
+		__m256i controls = bytesInRange(chars, 0x00, 0x1f);
+		controls = _mm256_andnot_si256(_mm256_cmpeq_epi8(chars, _mm256_set1_epi8('\t')), controls);
+		controls = _mm256_or_si256(controls, _mm256_cmpeq_epi8(chars, _mm256_set1_epi8(0x7f)));
+		unsigned mask = (unsigned)_mm256_movemask_epi8(controls);
+		if (mask != 0) {
+			return p + __builtin_ctz(mask);
+		}
+		p += 32;
+	}
+	return scanFieldRanges(p, end);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+/** scanning functions in use */
+static const char *(*tokenScanner)(const char *p, const char *end) = scanTokenCharsScalar;
+static const char *(*fieldScanner)(const char *p, const char *end) = scanFieldCharsScalar;
+static const char *scannerName = "scalar";
+
+/**
+ * Select the fastest scanning functions the CPU supports.
+ * Until called, the portable scalar functions are used.
+ */
+void initHttpScan(void) {
+#if defined(HAVE_X86_SIMD)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("sse4.2")) {
+		tokenScanner = scanTokenCharsSse42;
+		fieldScanner = scanFieldCharsAvx2;
+		scannerName = "avx2";
+	} else if (__builtin_cpu_supports("sse4.2")) {
+		tokenScanner = scanTokenCharsSse42;
+		fieldScanner = scanFieldCharsSse42;
+		scannerName = "sse4.2";
+	}
+#endif
+}
+
+/**
+ * Returns the name of the scanning functions in use.
+ *
+ * @return "avx2", "sse4.2" or "scalar"
+ */
+const char *httpScanName(void) {
+	return scannerName;
+}
+
+/**
+ * Find the end of the token at the start of a string: the first
+ * character that is not a token character (RFC 9110 5.6.2).
+ *
+ * @param p the string
+ * @param end the end of the string
+ * @return the first character after the token, or end
+ */
+const char *scanTokenChars(const char *p, const char *end) {
+	return tokenScanner(p, end);
+}
+
+/**
+ * Find the first control character in a field value other than
+ * tab, which includes the CR and LF that end the line.
+ *
+ * @param p the string
+ * @param end the end of the string
+ * @return the first control character, or end if none
+ */
+const char *scanFieldChars(const char *p, const char *end) {
+	return fieldScanner(p, end);
+}
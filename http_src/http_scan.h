@@ -0,0 +1,46 @@
+/*
+ * http_scan.h
+ *
+ * Functions that scan request heads for token and field
+ * value characters, with vectorized versions selected for
+ * the CPU at runtime.
+ *
+ */
+
+#ifndef HTTP_SCAN_H_
+#define HTTP_SCAN_H_
+
+/**
+ * Select the fastest scanning functions the CPU supports.
+ * Until called, the portable scalar functions are used.
+ */
+void initHttpScan(void);
+
+/**
+ * Returns the name of the scanning functions in use.
+ *
+ * @return "avx2", "sse4.2" or "scalar"
+ */
+const char *httpScanName(void);
+
+/**
+ * Find the end of the token at the start of a string: the first
+ * character that is not a token character (RFC 9110 5.6.2).
+ *
+ * @param p the string
+ * @param end the end of the string
+ * @return the first character after the token, or end
+ */
+const char *scanTokenChars(const char *p, const char *end);
+
+/**
+ * Find the first control character in a field value other than
+ * tab, which includes the CR and LF that end the line.
+ *
+ * @param p the string
+ * @param end the end of the string
+ * @return the first control character, or end if none
+ */
+const char *scanFieldChars(const char *p, const char *end);
+
+#endif /* HTTP_SCAN_H_ */
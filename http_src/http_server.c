@@ -5,24 +5,61 @@
  * and dispatches client requests to request sockets.
  *
  */
+#if defined(__linux__)
+#define _GNU_SOURCE  // for CPU affinity of acceptor threads
+#endif
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
 #include "file_util.h"
+#include "file_cache.h"
+#include "content_cache.h"
+#include "compress_cache.h"
+#include "listing_cache.h"
 #include "time_util.h"
 #include "http_request.h"
+#include "http_connection.h"
 #include "network_util.h"
 #include "properties.h"
 #include "http_server.h"
 #include "media_util.h"
+#include "event_loop.h"
+#include "http_util.h"
+#include "http_scan.h"
+#include "server_stats.h"
 #include "thpool.h"
 
 #define DEFAULT_HTTP_PORT 8080
 //#define DEFAULT_HTTP_PORT 8000
 #define DEFAULT_CONTENT_TYPES "mime.types"
+#define DEFAULT_KEEP_ALIVE_TIMEOUT 5
+#define DEFAULT_MAX_KEEP_ALIVE_REQUESTS 100
+#define DEFAULT_REQUEST_LINE_TIMEOUT 10
+#define DEFAULT_HEADER_TIMEOUT 20
+#define DEFAULT_BODY_TIMEOUT 30
+#define DEFAULT_WRITE_TIMEOUT 30
+#define DEFAULT_MAX_BODY_SIZE 4194304
+#define DEFAULT_MAX_PIPELINE_DEPTH 16
+#define DEFAULT_MAX_QUEUED_CONNECTIONS 256
+#define DEFAULT_LISTENERS 1
+#define DEFAULT_OPEN_FILE_CACHE_ENTRIES 256
+#define DEFAULT_OPEN_FILE_CACHE_VALID 2
+#define DEFAULT_CONTENT_CACHE_SIZE 16384
+#define DEFAULT_CONTENT_CACHE_MAX_FILE 64
+#define DEFAULT_LISTING_CACHE_SIZE 16384
+#define DEFAULT_COMPRESS_TYPES "text/* application/javascript application/json application/xml image/svg+xml"
+#define DEFAULT_COMPRESS_MIN_SIZE 1024
+#define DEFAULT_COMPRESS_CACHE_SIZE 8192
+#define DEFAULT_COMPRESS_LEVEL 6
 
 /** http server configuration */
 struct http_server_conf server;
@@ -106,6 +143,273 @@ static bool process_config(const char* configFileName) {
         server.server_protocol = serverProtocolProp;
         findProperty(httpConfig, 0, "ServerProtocol", serverProtocolProp);
 
+        // set I/O engine property or use default "epoll"
+        server.io_engine = IoEngine_Epoll;
+        char ioEngineProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "IoEngine", ioEngineProp) != SIZE_MAX) {
+            if (strcasecmp(ioEngineProp, "epoll") == 0) {
+                server.io_engine = IoEngine_Epoll;
+            } else if (strcasecmp(ioEngineProp, "io_uring") == 0) {
+                server.io_engine = IoEngine_IoUring;
+            } else if (strcasecmp(ioEngineProp, "blocking") == 0) {
+                server.io_engine = IoEngine_Blocking;
+            } else {
+                fprintf(stderr, "Invalid I/O engine %s\n", ioEngineProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the keep-alive timeout in seconds
+        server.keep_alive_timeout = DEFAULT_KEEP_ALIVE_TIMEOUT;
+        char keepAliveTimeoutProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "KeepAliveTimeout", keepAliveTimeoutProp) != SIZE_MAX) {
+            if (   (sscanf(keepAliveTimeoutProp, "%d", &server.keep_alive_timeout) != 1)
+                   || (server.keep_alive_timeout < 1)) {
+                fprintf(stderr, "Invalid keep-alive timeout %s\n", keepAliveTimeoutProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the request line timeout in seconds
+        server.request_line_timeout = DEFAULT_REQUEST_LINE_TIMEOUT;
+        char requestLineTimeoutProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "RequestLineTimeout", requestLineTimeoutProp) != SIZE_MAX) {
+            if (   (sscanf(requestLineTimeoutProp, "%d", &server.request_line_timeout) != 1)
+                   || (server.request_line_timeout < 1)) {
+                fprintf(stderr, "Invalid request line timeout %s\n", requestLineTimeoutProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the request header timeout in seconds
+        server.header_timeout = DEFAULT_HEADER_TIMEOUT;
+        char headerTimeoutProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "HeaderTimeout", headerTimeoutProp) != SIZE_MAX) {
+            if (   (sscanf(headerTimeoutProp, "%d", &server.header_timeout) != 1)
+                   || (server.header_timeout < 1)) {
+                fprintf(stderr, "Invalid header timeout %s\n", headerTimeoutProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the request body stall timeout in seconds
+        server.body_timeout = DEFAULT_BODY_TIMEOUT;
+        char bodyTimeoutProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "BodyTimeout", bodyTimeoutProp) != SIZE_MAX) {
+            if (   (sscanf(bodyTimeoutProp, "%d", &server.body_timeout) != 1)
+                   || (server.body_timeout < 1)) {
+                fprintf(stderr, "Invalid body timeout %s\n", bodyTimeoutProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the response write stall timeout in seconds
+        server.write_timeout = DEFAULT_WRITE_TIMEOUT;
+        char writeTimeoutProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "WriteTimeout", writeTimeoutProp) != SIZE_MAX) {
+            if (   (sscanf(writeTimeoutProp, "%d", &server.write_timeout) != 1)
+                   || (server.write_timeout < 1)) {
+                fprintf(stderr, "Invalid write timeout %s\n", writeTimeoutProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the maximum request body size in KB
+        server.max_body_size = DEFAULT_MAX_BODY_SIZE;
+        char maxBodySizeProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "MaxBodySize", maxBodySizeProp) != SIZE_MAX) {
+            if (   (sscanf(maxBodySizeProp, "%lld", &server.max_body_size) != 1)
+                   || (server.max_body_size < 0)
+                   || (server.max_body_size > LLONG_MAX / 1024)) {
+                fprintf(stderr, "Invalid max body size %s\n", maxBodySizeProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the maximum requests per connection
+        server.max_keep_alive_requests = DEFAULT_MAX_KEEP_ALIVE_REQUESTS;
+        char maxKeepAliveProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "MaxKeepAliveRequests", maxKeepAliveProp) != SIZE_MAX) {
+            if (   (sscanf(maxKeepAliveProp, "%d", &server.max_keep_alive_requests) != 1)
+                   || (server.max_keep_alive_requests < 1)) {
+                fprintf(stderr, "Invalid max keep-alive requests %s\n", maxKeepAliveProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the pipelined requests answered per flush
+        server.max_pipeline_depth = DEFAULT_MAX_PIPELINE_DEPTH;
+        char pipelineDepthProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "MaxPipelineDepth", pipelineDepthProp) != SIZE_MAX) {
+            if (   (sscanf(pipelineDepthProp, "%d", &server.max_pipeline_depth) != 1)
+                   || (server.max_pipeline_depth < 1)) {
+                fprintf(stderr, "Invalid max pipeline depth %s\n", pipelineDepthProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the connections waiting for a worker before new ones are shed
+        server.max_queued_connections = DEFAULT_MAX_QUEUED_CONNECTIONS;
+        char maxQueuedProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "MaxQueuedConnections", maxQueuedProp) != SIZE_MAX) {
+            if (   (sscanf(maxQueuedProp, "%d", &server.max_queued_connections) != 1)
+                   || (server.max_queued_connections < 0)) {
+                fprintf(stderr, "Invalid max queued connections %s\n", maxQueuedProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the open files cached with their status (0 to disable)
+        server.open_file_cache_entries = DEFAULT_OPEN_FILE_CACHE_ENTRIES;
+        char cacheEntriesProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "OpenFileCacheEntries", cacheEntriesProp) != SIZE_MAX) {
+            if (   (sscanf(cacheEntriesProp, "%d", &server.open_file_cache_entries) != 1)
+                   || (server.open_file_cache_entries < 0)) {
+                fprintf(stderr, "Invalid open file cache entries %s\n", cacheEntriesProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the seconds a cached file is used before its status is read again
+        server.open_file_cache_valid = DEFAULT_OPEN_FILE_CACHE_VALID;
+        char cacheValidProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "OpenFileCacheValid", cacheValidProp) != SIZE_MAX) {
+            if (   (sscanf(cacheValidProp, "%d", &server.open_file_cache_valid) != 1)
+                   || (server.open_file_cache_valid < 0)) {
+                fprintf(stderr, "Invalid open file cache valid time %s\n", cacheValidProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the KB of small file bodies cached in memory (0 to disable)
+        server.content_cache_size = DEFAULT_CONTENT_CACHE_SIZE;
+        char contentCacheProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "ContentCacheSize", contentCacheProp) != SIZE_MAX) {
+            if (   (sscanf(contentCacheProp, "%d", &server.content_cache_size) != 1)
+                   || (server.content_cache_size < 0)) {
+                fprintf(stderr, "Invalid content cache size %s\n", contentCacheProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the KB of the largest file body cached in memory
+        server.content_cache_max_file = DEFAULT_CONTENT_CACHE_MAX_FILE;
+        char contentMaxFileProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "ContentCacheMaxFile", contentMaxFileProp) != SIZE_MAX) {
+            if (   (sscanf(contentMaxFileProp, "%d", &server.content_cache_max_file) != 1)
+                   || (server.content_cache_max_file < 0)) {
+                fprintf(stderr, "Invalid content cache max file %s\n", contentMaxFileProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the KB of directory listings cached in memory
+        server.listing_cache_size = DEFAULT_LISTING_CACHE_SIZE;
+        char listingCacheProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "ListingCacheSize", listingCacheProp) != SIZE_MAX) {
+            if (   (sscanf(listingCacheProp, "%d", &server.listing_cache_size) != 1)
+                   || (server.listing_cache_size < 0)) {
+                fprintf(stderr, "Invalid listing cache size %s\n", listingCacheProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize flag to serve precompressed siblings of files
+        server.precompressed = true;
+        char precompressedProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "Precompressed", precompressedProp) != SIZE_MAX) {
+            server.precompressed = (strcasecmp(precompressedProp, "true") == 0);
+        }
+
+        // set media types compressed on the fly or use the defaults
+        static char compressTypesProp[MAX_PROP_VAL] = DEFAULT_COMPRESS_TYPES;
+        server.compress_types = compressTypesProp;
+        findProperty(httpConfig, 0, "CompressTypes", compressTypesProp);
+
+        // initialize the length of the smallest body compressed on the fly
+        server.compress_min_size = DEFAULT_COMPRESS_MIN_SIZE;
+        char compressMinProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "CompressMinSize", compressMinProp) != SIZE_MAX) {
+            if (   (sscanf(compressMinProp, "%d", &server.compress_min_size) != 1)
+                   || (server.compress_min_size < 0)) {
+                fprintf(stderr, "Invalid compress min size %s\n", compressMinProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the KB of compressed variants cached in memory
+        server.compress_cache_size = DEFAULT_COMPRESS_CACHE_SIZE;
+        char compressCacheProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "CompressCacheSize", compressCacheProp) != SIZE_MAX) {
+            if (   (sscanf(compressCacheProp, "%d", &server.compress_cache_size) != 1)
+                   || (server.compress_cache_size < 0)) {
+                fprintf(stderr, "Invalid compress cache size %s\n", compressCacheProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the compression level while the CPUs are idle
+        server.compress_level = DEFAULT_COMPRESS_LEVEL;
+        char compressLevelProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "CompressLevel", compressLevelProp) != SIZE_MAX) {
+            if (   (sscanf(compressLevelProp, "%d", &server.compress_level) != 1)
+                   || (server.compress_level < 1) || (server.compress_level > 9)) {
+                fprintf(stderr, "Invalid compress level %s\n", compressLevelProp);
+                status = false;
+                break;
+            }
+        }
+
+        // initialize the listener sockets sharing the port (0 for one per CPU)
+        server.listeners = DEFAULT_LISTENERS;
+        char listenersProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "Listeners", listenersProp) != SIZE_MAX) {
+            if (   (sscanf(listenersProp, "%d", &server.listeners) != 1)
+                   || (server.listeners < 0) || (server.listeners > MAX_LISTENERS)) {
+                fprintf(stderr, "Invalid listeners %s\n", listenersProp);
+                status = false;
+                break;
+            }
+        }
+        if (server.listeners == 0) {
+            long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+            server.listeners = (ncpus < 1) ? 1 : (ncpus > MAX_LISTENERS) ? MAX_LISTENERS : ncpus;
+        }
+
+        // initialize flag to pin acceptor threads to CPUs
+        server.listener_cpu_affinity = false;
+        char cpuAffinityProp[MAX_PROP_VAL];
+        if (findProperty(httpConfig, 0, "ListenerCpuAffinity", cpuAffinityProp) != SIZE_MAX) {
+            server.listener_cpu_affinity = (strcasecmp(cpuAffinityProp, "true") == 0);
+        }
+
+        // set server status URI property or leave status disabled
+        static char statusUriProp[MAX_PROP_VAL] = "";
+        server.status_uri = statusUriProp;
+        findProperty(httpConfig, 0, "StatusUri", statusUriProp);
+
+        // set custom status pages directory property or use default pages
+        static char errorPagesProp[MAX_PROP_VAL] = "";
+        server.error_pages = errorPagesProp;
+        findProperty(httpConfig, 0, "ErrorPages", errorPagesProp);
+
         // initialize the content type
 
         char contentTypeProp[MAX_PROP_VAL];
@@ -132,24 +436,179 @@ static bool process_config(const char* configFileName) {
 }
 
 /**
- * Help to process request for a thread.
- * @param listen_sock_fd
+ * Print the peer of a new connection for debugging.
+ * @param socket_fd the accepted peer socket
  */
-void process_request_helper(int listen_sock_fd) {
-    int socket_fd = accept_peer_connection(listen_sock_fd);
+static void debug_new_connection(int socket_fd) {
+    int port;
+    char host[HOST_NAME_MAX];
+    if (get_peer_host_and_port(socket_fd, host, &port) != 0) {
+        perror("get_peer_host_and_port");
+    } else {
+        fprintf(stderr, "New connection accepted  %s:%u\n", host, port);
+    }
+}
 
+/**
+ * Process the next request on a connection, followed by any
+ * pipelined requests whose heads are already received, up to
+ * the pipeline depth. Responses are queued in request order
+ * and flushed together.
+ * @param conn the connection with a request head received
+ * @return true if the connection is kept alive
+ */
+static bool process_pipelined_requests(HttpConnection *conn) {
+    bool keep_alive;
+    int depth = 0;
+    do {
+        keep_alive = process_request(conn);
+    } while (   keep_alive && hasRequestHead(conn)
+             && (++depth < server.max_pipeline_depth));
+    if (flushConnection(conn) != 0) {
+        // peer gone or stalled past the write timeout
+        keep_alive = false;
+    }
+    return keep_alive;
+}
+
+/**
+ * Wait until the head of the next request on a connection
+ * is received, or its deadline passes.
+ * @param conn the connection
+ * @return true if a request head is received
+ */
+static bool wait_request_head(HttpConnection *conn) {
+    int status;
+    while ((status = receiveRequestHead(conn)) == 0) {
+        long long timeout = connectionDeadline(conn) - monotonicMilliTime();
+        if ((timeout <= 0) || !wait_socket_readable(conn->sock_fd, (int)timeout)) {
+            timeoutConnection(conn);
+            return false;
+        }
+    }
+    return status > 0;
+}
+
+/**
+ * Help to process requests for a thread. The thread serves
+ * requests on the connection until it is no longer kept alive.
+ * @param socket_fd the accepted peer socket
+ */
+void process_request_helper(int socket_fd) {
     if (server.debug) {
-        int port;
-        char host[HOST_NAME_MAX];
-        if (get_peer_host_and_port(socket_fd, host, &port) != 0) {
-            perror("get_peer_host_and_port");
-        } else if (server.debug) {
-            fprintf(stderr, "New connection accepted  %s:%u\n", host, port);
+        debug_new_connection(socket_fd);
+    }
+
+    HttpConnection *conn = newHttpConnection(socket_fd);
+    if (conn == NULL) {
+        return;
+    }
+
+    // handle requests until closed or a request is not received in time
+    while (wait_request_head(conn) && process_pipelined_requests(conn)) {
+    }
+    deleteHttpConnection(conn);
+}
+
+/**
+ * Help to process a ready request for a thread. The connection
+ * is returned to the event loop if it is kept alive.
+ * @param conn the connection with a ready request
+ */
+void process_ready_request_helper(HttpConnection *conn) {
+    if (server.debug && (conn->nrequests == 0)) {
+        debug_new_connection(conn->sock_fd);
+    }
+
+    // take the bytes received so far: a partial request waits
+    // for the rest in the event loop rather than in this worker
+    int status = receiveRequestHead(conn);
+    if (status == 0) {
+        resume_connection(conn);
+        return;
+    }
+
+    // handle requests
+    if ((status > 0) && process_pipelined_requests(conn)) {
+        resume_connection(conn);
+    } else {
+        deleteHttpConnection(conn);
+    }
+}
+
+/** Definition of a listener socket and its acceptor thread */
+typedef struct Listener {
+    int sock_fd;              /** listener socket */
+    int index;                /** index of listener for its counters */
+    threadpool thpool;        /** workers that process requests */
+    pthread_t thread;         /** acceptor thread */
+} Listener;
+
+/**
+ * Get the CPU for a listener and its acceptor thread.
+ * @param index the index of the listener
+ * @return the CPU
+ */
+static int listener_cpu(int index) {
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (ncpus < 1) ? 0 : (int)(index % ncpus);
+}
+
+/**
+ * Pin the calling thread to a CPU.
+ * @param cpu the CPU
+ */
+static void pin_thread_to_cpu(int cpu) {
+#if defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        fprintf(stderr, "Unable to pin acceptor thread to CPU %d\n", cpu);
+    }
+#else
+    (void)cpu;
+#endif
+}
+
+/**
+ * Accept connections on a listener and hand them to the workers,
+ * with an event loop or with a blocking accept loop.
+ * @param arg the listener
+ * @return NULL
+ */
+static void *run_listener(void *arg) {
+    Listener *listener = arg;
+    if (server.listener_cpu_affinity) {
+        // accept on the CPU that the listener prefers connections from
+        pin_thread_to_cpu(listener_cpu(listener->index));
+    }
+
+    if (server.io_engine != IoEngine_Blocking) {
+        // reactor dispatches connections once requests are ready
+        if (run_event_loop(listener->sock_fd, listener->index, listener->thpool,
+                           process_ready_request_helper) == -1) {
+            fprintf(stderr, "Falling back to blocking I/O engine\n");
+            server.io_engine = IoEngine_Blocking;
+            set_socket_nonblocking(listener->sock_fd, false);
         }
     }
 
-    // handle request
-    process_request(socket_fd);
+    if (listener->index == 0) {
+        puts("Adding tasks to threadpool");
+    }
+    while (true) {
+        // accept here and hand one job per connection to the pool
+        int socket_fd = accept_peer_connection(listener->sock_fd);
+        STAT_INCR(connections_accepted);
+        STAT_INCR(listener_accepted[listener->index]);
+        if (thpool_try_add_work(listener->thpool, (void*)process_request_helper, (void*)(intptr_t)socket_fd) != 0) {
+            // queue full, or no memory for the job: a queued connection
+            // would only wait longer, and one not queued is never served
+            shedConnection(socket_fd);
+        }
+    }
+    return NULL;
 }
 
 /**
@@ -157,7 +616,6 @@ void process_request_helper(int listen_sock_fd) {
  * @param argc argument count
  * @param argv array of args; argv[1] may be port no.
  */
-
 int main(int argc, char* argv[argc]) {
     // initialize config file name
     const char* configFileName = "httpd.conf";
@@ -170,32 +628,104 @@ int main(int argc, char* argv[argc]) {
         return EXIT_FAILURE;
     }
 
-    // create listener socket for server with specified port
-    int listen_sock_fd = get_listener_socket(server.server_port);
-    if (listen_sock_fd == 0) {
-        perror("listen_sock_fd");
+    // files written for requests get the permissions fopen() would give them;
+    // the mask is read before worker threads can create files
+    initFileCreationMask();
+
+    // status pages, and responses to connections shed under overload or timed out
+    if (!initStatusResponses()) {
+        fprintf(stderr, "Unable to precompute status responses\n");
+        return EXIT_FAILURE;
+    }
+
+    // open files and their status are cached by path
+    if (!initFileCache(server.open_file_cache_entries, server.open_file_cache_valid*1000)) {
+        fprintf(stderr, "Unable to create open file cache\n");
         return EXIT_FAILURE;
     }
 
+    // small file bodies are cached in memory until their files change
+    if (!initContentCache((size_t)server.content_cache_size*1024,
+                          (size_t)server.content_cache_max_file*1024,
+                          server.open_file_cache_valid*1000)) {
+        fprintf(stderr, "Unable to create content cache\n");
+        return EXIT_FAILURE;
+    }
+
+    // directory listings are cached in memory until their directories change
+    if (!initListingCache((size_t)server.listing_cache_size*1024,
+                          server.open_file_cache_valid*1000)) {
+        fprintf(stderr, "Unable to create listing cache\n");
+        return EXIT_FAILURE;
+    }
+    if (watchContentCache(server.content_base) && server.debug) {
+        fprintf(stderr, "Watching %s for content changes\n", server.content_base);
+    }
+
+    // bodies of compressible types are compressed on the fly
+    if (!initCompression(server.compress_types, server.compress_min_size,
+                         (size_t)server.compress_cache_size*1024, server.compress_level)) {
+        fprintf(stderr, "Unable to create compress cache\n");
+        return EXIT_FAILURE;
+    }
+
+    // request heads are scanned with the vector instructions available
+    initHttpScan();
+    if (server.debug) {
+        fprintf(stderr, "Request heads scanned with %s\n", httpScanName());
+    }
+
+    // queued responses may be flushed after the peer has gone away;
+    // report that as a write error rather than terminating the server
+    signal(SIGPIPE, SIG_IGN);
+
+    // create listener sockets for server with specified port; several
+    // listeners share the port and the kernel balances connections
+    // across them, so acceptor threads do not contend on one queue
+    static Listener listeners[MAX_LISTENERS];
+    for (int i = 0; i < server.listeners; i++) {
+        listeners[i].index = i;
+        if (server.listeners == 1) {
+            listeners[i].sock_fd = get_listener_socket(server.server_port);
+        } else {
+            int cpu = server.listener_cpu_affinity ? listener_cpu(i) : -1;
+            listeners[i].sock_fd = get_reuseport_listener_socket(server.server_port, cpu);
+        }
+        if (listeners[i].sock_fd == 0) {
+            perror("listen_sock_fd");
+            return EXIT_FAILURE;
+        }
+    }
+
     if (server.debug) {
-        fprintf(stderr, "HttpServer running on port %d\n", server.server_port);
+        fprintf(stderr, "HttpServer running on port %d with %d listener%s\n",
+                server.server_port, server.listeners, (server.listeners == 1) ? "" : "s");
     }
 
     puts("Making threadpool with 4 threads"); // TODO # of threads
-    threadpool thpool = thpool_init(4); // TODO # of threads
+    threadpool thpool = thpool_init_bounded(4, server.max_queued_connections); // TODO # of threads
 
-    puts("Adding tasks to threadpool");
-    while (true) {
-        // handle request
-        thpool_add_work(thpool, (void*)process_request_helper, (void*)listen_sock_fd);
+    // the main thread accepts on the first listener, and each
+    // other listener gets its own acceptor thread
+    for (int i = 0; i < server.listeners; i++) {
+        listeners[i].thpool = thpool;
     }
+    for (int i = 1; i < server.listeners; i++) {
+        if (pthread_create(&listeners[i].thread, NULL, run_listener, &listeners[i]) != 0) {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+    run_listener(&listeners[0]);
 
     sleep(2);
     puts("Killing threadpool");
     thpool_destroy(thpool);
 
-    // close listener socket
-    close(listen_sock_fd);
+    // close listener sockets
+    for (int i = 0; i < server.listeners; i++) {
+        close(listeners[i].sock_fd);
+    }
     return EXIT_SUCCESS;
 
 }
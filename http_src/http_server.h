@@ -14,9 +14,19 @@
 /** maximum buffer size */
 #define MAXBUF 256
 
+/** maximum listener sockets sharing the server port */
+#define MAX_LISTENERS 64
+
 /** web newline sequence */
 #define CRLF "\r\n"
 
+/** server I/O engines */
+enum IoEngine {
+	IoEngine_Blocking,  /** main thread accepts, one job per connection */
+	IoEngine_Epoll,     /** epoll reactor dispatches ready connections */
+	IoEngine_IoUring    /** io_uring reactor receives requests for workers */
+};
+
 /** http server config properties */
 struct http_server_conf {
 	/** debug flag */
@@ -36,6 +46,78 @@ struct http_server_conf {
 
 	/** http response protocol */
 	const char* server_protocol;
+
+	/** I/O engine that accepts and dispatches connections */
+	enum IoEngine io_engine;
+
+	/** seconds to wait for the next request on a connection */
+	int keep_alive_timeout;
+
+	/** seconds to receive the request line, from the first byte of a request */
+	int request_line_timeout;
+
+	/** seconds to receive the request headers, from the first byte of a request */
+	int header_timeout;
+
+	/** seconds to receive a request body, from its start */
+	int body_timeout;
+
+	/** seconds to send a response body, from its start */
+	int write_timeout;
+
+	/** KB of the longest request body accepted, 0 for no limit */
+	long long max_body_size;
+
+	/** maximum requests per connection (1 disables keep-alive) */
+	int max_keep_alive_requests;
+
+	/** maximum pipelined requests answered before responses are flushed */
+	int max_pipeline_depth;
+
+	/** maximum connections waiting for a worker (0 for no limit) */
+	int max_queued_connections;
+
+	/** maximum open files cached with their status (0 disables the cache) */
+	int open_file_cache_entries;
+
+	/** seconds a cached file is used before its status is read again */
+	int open_file_cache_valid;
+
+	/** maximum KB of file bodies cached in memory (0 disables the cache) */
+	int content_cache_size;
+
+	/** maximum KB of a file body cached in memory */
+	int content_cache_max_file;
+
+	/** maximum KB of directory listings cached in memory */
+	int listing_cache_size;
+
+	/** true to serve precompressed .br, .zst and .gz siblings of files */
+	bool precompressed;
+
+	/** media types compressed on the fly, or empty to compress none */
+	const char *compress_types;
+
+	/** length of the smallest body compressed on the fly */
+	int compress_min_size;
+
+	/** maximum KB of compressed variants of files cached in memory */
+	int compress_cache_size;
+
+	/** compression level while the CPUs are idle (1 to 9) */
+	int compress_level;
+
+	/** listener sockets sharing the port, each with its own acceptor thread */
+	int listeners;
+
+	/** true to pin each acceptor thread to a CPU that its listener prefers */
+	bool listener_cpu_affinity;
+
+	/** URI that reports server counters, or empty if disabled */
+	const char *status_uri;
+
+	/** directory of custom status pages named by status, or empty if none */
+	const char *error_pages;
 };
 
 /**  external declaration of server config */
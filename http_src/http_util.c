@@ -6,40 +6,224 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include "properties.h"
 #include "file_util.h"
 #include "string_util.h"
 #include "http_codes.h"
+#include "media_util.h"
 #include "http_server.h"
+#include "http_connection.h"
+#include "http_util.h"
+#include "server_stats.h"
+#include "time_util.h"
+
+/** seconds a shed client should wait before retrying */
+#define SHED_RETRY_AFTER 1
+
+/** limit of status codes with precomputed status responses */
+#define MAX_STATUS 600
+
+/** Definition of a precomputed status response */
+typedef struct StatusPage {
+	char *response;               /** status line, content headers, blank line and page */
+	size_t len;                   /** length of response */
+	size_t statusLineLen;         /** length of status line */
+	size_t pageLen;               /** length of page */
+	char mediaType[MAXBUF];       /** media type of page */
+} StatusPage;
+
+/** precomputed status responses by status, NULL response if none */
+static StatusPage statusPages[MAX_STATUS];
+
+/** precomputed response to connections shed under overload */
+static char *shedResponse = NULL;
+static size_t shedResponseLen = 0;
+
+/** precomputed response to requests that timed out */
+static char *timeoutResponse = NULL;
+static size_t timeoutResponseLen = 0;
 
 
 /**
- * Reads request headers from request stream until empty line.
+ * Determines the error status for a failed read of the request body.
  *
- * @param istream the socket input stream
- * @param request headers
+ * @param nread the result of the read
+ * @return 408 if the body stalled, 400 if the peer closed
  */
-void readRequestHeaders(FILE *istream, Properties *requestHeaders) {
-	char buf[MAXBUF];
+static int requestBodyReadStatus(ssize_t nread) {
+	if ((nread < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+		// no bytes within the body timeout
+		STAT_INCR(requests_timed_out);
+		return Http_RequestTimeout;
+	}
+	return Http_BadRequest;  // peer closed before end of body
+}
 
-	while (fgets(buf, MAXBUF, istream) != NULL) {
-		// trim newline characters
-		trim_newline(buf);
+/**
+ * Reads a line of the chunked framing of the request body,
+ * without its line ending.
+ *
+ * @param conn the connection
+ * @param line the buffer for the line
+ * @param size the size of the buffer
+ * @return 0 if successful, or the error status to respond with
+ */
+static int readChunkLine(HttpConnection *conn, char *line, size_t size) {
+	ssize_t len = readConnectionLine(conn, line, size);
+	return (len < 0) ? requestBodyReadStatus(len) : 0;
+}
 
-		// empty line marks send of headers
-		if (*buf == '\0') {
-			break;
-		}
+/**
+ * Reads the size line of the next chunk of the request body, and
+ * the trailer fields after the last chunk, which are not used.
+ *
+ * @param conn the connection
+ * @return 0 if successful, or the error status to respond with
+ */
+static int readChunkSize(HttpConnection *conn) {
+	char line[MAXBUF];
+	int status = readChunkLine(conn, line, sizeof(line));
+	if (status != 0) {
+		return status;
+	}
+	// chunk extensions after the size are ignored
+	char *end;
+	errno = 0;
+	conn->body_remaining = strtoll(line, &end, 16);
+	if (   (end == line) || !isxdigit((unsigned char)*line) || (errno == ERANGE)
+		|| (conn->body_remaining < 0)
+		|| ((*end != '\0') && (*end != ';') && (*end != ' ') && (*end != '\t'))) {
+		return Http_BadRequest;
+	}
+	if (conn->body_remaining == 0) {
+		// last chunk is followed by trailer fields and a blank line
+		do {
+			status = readChunkLine(conn, line, sizeof(line));
+		} while ((status == 0) && (*line != '\0'));
+		conn->body_chunked = false;
+	}
+	return status;
+}
 
-		char *p = strchr(buf, ':'); // find name/value delimiter
-		if (p != NULL) {
-			for (*p++ = '\0'; *p == ' '; p++) {} // skip over leading value whitespace
-			if (!putProperty(requestHeaders, buf, p)) {  // save request property
-				fprintf(stderr, "readRequestHeaders requestHeaders full\n");
-				break;
+/**
+ * Reads the unread request body from the connection
+ * to the output stream, decoding a chunked body. A
+ * client waiting for it is sent 100 Continue first.
+ * The connection is not kept alive if the body could
+ * not be read.
+ *
+ * @param conn the connection
+ * @param ostream the output stream for the body, or NULL to discard it
+ * @return 0 if successful, or the error status to respond with:
+ *   408 if the body took longer than the body timeout, 400 if the
+ *   peer closed before its end or the chunks are malformed, 413 if
+ *   a chunked body is longer than the maximum body size, 500 if the
+ *   output stream failed
+ */
+int readRequestBody(HttpConnection *conn, FILE *ostream) {
+	char buf[CONN_BUFSIZE];
+	long long maxBytes = server.max_body_size * 1024;
+	long long nbytes = 0;
+	if (conn->expect_continue) {
+		// the request was accepted, so the client can send the body,
+		// which flushes the interim response before waiting for it
+		sendResponseStatus(conn->stream, Http_Continue, NULL);
+		fputs(CRLF, conn->stream);
+		conn->expect_continue = false;
+	}
+	startRequestBody(conn);
+	do {
+		if (conn->body_chunked) {
+			int status = readChunkSize(conn);
+			if (status != 0) {
+				conn->keep_alive = false;
+				return status;
+			}
+			// a chunk beyond the limit is refused before it is written;
+			// without a limit, the total must still fit its type
+			long long limit = (maxBytes > 0) ? maxBytes : LLONG_MAX;
+			if (conn->body_remaining > limit - nbytes) {
+				conn->keep_alive = false;
+				return Http_PayloadTooLarge;
+			}
+			nbytes += conn->body_remaining;
+		}
+		while (conn->body_remaining > 0) {
+			size_t ntoread = (conn->body_remaining < (long long)sizeof(buf)) ? (size_t)conn->body_remaining : sizeof(buf);
+			ssize_t nread = readConnectionBytes(conn, buf, ntoread);
+			if (nread <= 0) {
+				conn->keep_alive = false;
+				return requestBodyReadStatus(nread);
+			}
+			conn->body_remaining -= nread;
+			if ((ostream != NULL) && (fwrite(buf, sizeof(char), nread, ostream) < (size_t)nread)) {
+				perror("readRequestBody");
+				conn->keep_alive = false;
+				return Http_InternalServerError;
+			}
+		}
+		if (conn->body_chunked) {
+			// chunk data ends with CRLF
+			int status = readChunkLine(conn, buf, sizeof(buf));
+			if ((status != 0) || (*buf != '\0')) {
+				conn->keep_alive = false;
+				return (status != 0) ? status : Http_BadRequest;
 			}
 		}
+	} while (conn->body_chunked);
+	return 0;
+}
+
+/**
+ * Determines whether the unread body of a request that was
+ * answered can be read and discarded to keep the connection:
+ * a short body with a Content-Length, that the client sends
+ * without waiting for 100 Continue.
+ *
+ * @param conn the connection
+ * @return true if the body can be discarded
+ */
+bool canDrainRequestBody(const HttpConnection *conn) {
+	return !conn->expect_continue && !conn->body_chunked && (conn->body_remaining <= MAX_DRAINED_BODY);
+}
+
+/**
+ * Close the connection after the response, replacing any
+ * Connection and Keep-Alive response headers with
+ * Connection: close.
+ *
+ * @param conn the connection
+ * @param responseHeaders the response headers
+ */
+void closeAfterResponse(HttpConnection *conn, Properties *responseHeaders) {
+	conn->keep_alive = false;
+	removeProperty(responseHeaders, "Keep-Alive");
+	removeProperty(responseHeaders, "Connection");
+	putProperty(responseHeaders, "Connection", "close");
+}
+
+/**
+ * Prepare the response to a request whose body is refused
+ * without being read. Unless the body can be read and
+ * discarded after the response, the connection is closed,
+ * which the response says with Connection: close.
+ *
+ * @param conn the connection
+ * @param responseHeaders the response headers
+ */
+void refuseRequestBody(HttpConnection *conn, Properties *responseHeaders) {
+	if (   ((conn->body_remaining > 0) || conn->body_chunked)
+		&& conn->keep_alive && !canDrainRequestBody(conn)) {
+		closeAfterResponse(conn, responseHeaders);
 	}
 }
 
@@ -63,14 +247,13 @@ void sendResponseStatus(FILE *ostream, int status, const char *statusMsg) {
 
 
 /**
- * Send bytes for headers to response output stream
- * with terminating blank line.
+ * Send bytes for header lines to response output stream
+ * without terminating blank line.
  *
+ * @param ostream the output socket stream
  * @param responseHeaders the header name value pairs
- * @param responseCharset the response charset
  */
-void sendResponseHeaders(FILE *ostream, Properties *responseHeaders) {
-	// output headers
+static void sendResponseHeaderLines(FILE *ostream, Properties *responseHeaders) {
 	char name[MAX_PROP_NAME], val[MAX_PROP_VAL];
 	for (int i = 0; getProperty(responseHeaders, i, name, val); i++) {
 		fprintf(ostream, "%s: %s%s", name, val, CRLF);
@@ -78,6 +261,17 @@ void sendResponseHeaders(FILE *ostream, Properties *responseHeaders) {
     		fprintf(stderr, "%s: %s\n", name, val);
     	}
 	}
+}
+
+/**
+ * Send bytes for headers to response output stream
+ * with terminating blank line.
+ *
+ * @param responseHeaders the header name value pairs
+ * @param responseCharset the response charset
+ */
+void sendResponseHeaders(FILE *ostream, Properties *responseHeaders) {
+	sendResponseHeaderLines(ostream, responseHeaders);
 
 	// Send a blank line to indicate the end of the header lines.
 	fprintf(ostream, "%s", CRLF);
@@ -86,8 +280,29 @@ void sendResponseHeaders(FILE *ostream, Properties *responseHeaders) {
 	}
 }
 
+/**
+ * Format the default status page.
+ *
+ * @param status the response status
+ * @param statusMsg the response message
+ * @param buf the buffer for the page
+ * @param size the size of the buffer
+ * @return the length of the page
+ */
+static size_t formatStatusPage(int status, const char *statusMsg, char *buf, size_t size) {
+	int len = snprintf(buf, size,
+		"<html>"
+		"<head><title>%d %s</title></head>"
+		"<body>%d %s</body></html>",
+		status, statusMsg, status, statusMsg);
+	return ((size_t)len < size) ? (size_t)len : size-1;
+}
+
 /**
  * Set status response and status page to the response output stream.
+ * The status line, content headers and page of a status with the
+ * default message are precomputed, so only the response headers
+ * are formatted.
  *
  * @param ostream the output socket stream
  * @param status the response status
@@ -96,31 +311,203 @@ void sendResponseHeaders(FILE *ostream, Properties *responseHeaders) {
  * @param responseHeaders the response headers
  */
 void sendStatusResponse(FILE* ostream, int status, const char *statusMsg, Properties *responseHeaders) {
-    if (statusMsg == NULL) {  // use default message
-        statusMsg = httpCodeStr(status);
-    }
-	sendResponseStatus(ostream, status, statusMsg);
+	const StatusPage *page = NULL;
+	if ((statusMsg == NULL) && (status >= 0) && (status < MAX_STATUS)) {
+		page = &statusPages[status];
+	}
+	if ((page == NULL) || (page->response == NULL)) {
+		// status without a precomputed response
+		if (statusMsg == NULL) {
+			statusMsg = httpCodeStr(status);
+		}
+		sendResponseStatus(ostream, status, statusMsg);
 
-	char errorBody[2*MAXBUF];  // because of data substitution.
-	const char *errorPage =
-		"<html>"
-	    "<head><title>%d %s</title></head>"
-	    "<body>%d %s</body></html>";
-	sprintf(errorBody, errorPage, status, statusMsg, status, statusMsg);
-	FILE *tmpStream = tmpStringFile(errorBody);
+		char body[2*MAXBUF];  // because of data substitution.
+		size_t contentLen = formatStatusPage(status, statusMsg, body, sizeof(body));
+		char buf[MAXBUF];
+		sprintf(buf, "%lu", contentLen);
+		putProperty(responseHeaders,"Content-Length", buf);
+		putProperty(responseHeaders,"Content-type", "text/html");
+		sendResponseHeaders(ostream, responseHeaders);
+		fwrite(body, sizeof(char), contentLen, ostream);
+		return;
+	}
+
+	// response headers go between the status line and the content headers
+	fwrite(page->response, sizeof(char), page->statusLineLen, ostream);
+	if (server.debug) {
+		fprintf(stderr, "%s %d %s\n", server.server_protocol, status, httpCodeStr(status));
+	}
+	sendResponseHeaderLines(ostream, responseHeaders);
+	fwrite(page->response + page->statusLineLen, sizeof(char),
+		   page->len - page->statusLineLen, ostream);
+	if (server.debug) {
+		fprintf(stderr, "Content-Length: %lu\nContent-type: %s\n\n", page->pageLen, page->mediaType);
+	}
+}
 
-	char buf[MAXBUF];
-	size_t contentLen = strlen(errorBody);
-	sprintf(buf, "%lu", contentLen);
-	putProperty(responseHeaders,"Content-Length", buf);
-	putProperty(responseHeaders,"Content-type", "text/html");
+/**
+ * Read the custom status page for a status from the error pages
+ * directory, named by the status, for example 404.html.
+ *
+ * @param status the response status
+ * @param mediaType output buffer for media type of the page
+ * @param len output length of the page
+ * @return the page, or NULL if there is none
+ */
+static char *readCustomStatusPage(int status, char *mediaType, size_t *len) {
+	if (*server.error_pages == '\0') {
+		return NULL;
+	}
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%d.html", server.error_pages, status);
+	FILE *pageStream = fopen(path, "r");
+	if (pageStream == NULL) {
+		return NULL;
+	}
 
-	// Send the headers
-	sendResponseHeaders(ostream, responseHeaders);
+	struct stat sb;
+	char *page = NULL;
+	if ((fileStat(pageStream, &sb) == 0) && S_ISREG(sb.st_mode)) {
+		page = malloc(sb.st_size + 1);
+	}
+	if ((page != NULL) && (fread(page, sizeof(char), sb.st_size, pageStream) == (size_t)sb.st_size)) {
+		*len = sb.st_size;
+		getMediaType(path, mediaType);
+	} else {
+		fprintf(stderr, "Invalid error page %s\n", path);
+		free(page);
+		page = NULL;
+	}
+	fclose(pageStream);
+	return page;
+}
 
-	// Send the error page body.
-	copyFileStreamBytes(tmpStream, ostream, contentLen);
-	fclose(tmpStream);
+/**
+ * Precompute the status response for a status, with its custom
+ * status page if there is one, or else the default page.
+ *
+ * @param status the response status
+ * @param page the status response
+ * @return true if successful, false if out of memory
+ */
+static bool precomputeStatusPage(int status, StatusPage *page) {
+	const char *statusMsg = httpCodeStr(status);
+	char defaultPage[2*MAXBUF];
+	size_t pageLen;
+	char *customPage = readCustomStatusPage(status, page->mediaType, &pageLen);
+	const char *body = customPage;
+	if (customPage == NULL) {
+		pageLen = formatStatusPage(status, statusMsg, defaultPage, sizeof(defaultPage));
+		strcpy(page->mediaType, "text/html");
+		body = defaultPage;
+	}
+
+	char head[2*MAXBUF];
+	int statusLineLen = snprintf(head, sizeof(head), "%s %d %s%s",
+		server.server_protocol, status, statusMsg, CRLF);
+	int headLen = statusLineLen + snprintf(head + statusLineLen, sizeof(head) - statusLineLen,
+		"Content-Length: %lu%s"
+		"Content-type: %s%s"
+		"%s",
+		pageLen, CRLF,
+		page->mediaType, CRLF,
+		CRLF);
+
+	page->response = malloc(headLen + pageLen);
+	if (page->response != NULL) {
+		memcpy(page->response, head, headLen);
+		memcpy(page->response + headLen, body, pageLen);
+		page->len = headLen + pageLen;
+		page->statusLineLen = statusLineLen;
+		page->pageLen = pageLen;
+	}
+	free(customPage);
+	return page->response != NULL;
+}
+
+/**
+ * Precompute a complete response that closes the connection
+ * from the precomputed status response.
+ *
+ * @param status the response status
+ * @param extraHeaders additional header lines, each ending in CRLF
+ * @param len output length of the response
+ * @return the response, or NULL if out of memory
+ */
+static char *precomputeClosingResponse(int status, const char *extraHeaders, size_t *len) {
+	const StatusPage *page = &statusPages[status];
+	char headers[2*MAXBUF];
+	int headersLen = snprintf(headers, sizeof(headers),
+		"Server: %s%s"
+		"%s"
+		"Connection: close%s",
+		server.server_name, CRLF,
+		extraHeaders,
+		CRLF);
+
+	char *response = malloc(page->len + headersLen);
+	if (response != NULL) {
+		char *p = response;
+		memcpy(p, page->response, page->statusLineLen);
+		p += page->statusLineLen;
+		memcpy(p, headers, headersLen);
+		p += headersLen;
+		memcpy(p, page->response + page->statusLineLen, page->len - page->statusLineLen);
+		*len = page->len + headersLen;
+	}
+	return response;
+}
+
+/**
+ * Precompute the status responses with their status pages, and
+ * the responses sent to connections that are closed without
+ * processing a request: shed while the server is overloaded, or
+ * timed out before the request arrived. Must be called once the
+ * server configuration and media types are loaded.
+ *
+ * @return true if successful, false if out of memory
+ */
+bool initStatusResponses(void) {
+	for (int status = 100; status < MAX_STATUS; status++) {
+		if ((*httpCodeStr(status) != '\0') && !precomputeStatusPage(status, &statusPages[status])) {
+			return false;
+		}
+	}
+
+	char retryAfter[MAXBUF];
+	sprintf(retryAfter, "Retry-After: %d%s", SHED_RETRY_AFTER, CRLF);
+	shedResponse = precomputeClosingResponse(Http_ServiceUnavailable, retryAfter, &shedResponseLen);
+	timeoutResponse = precomputeClosingResponse(Http_RequestTimeout, "", &timeoutResponseLen);
+	return (shedResponse != NULL) && (timeoutResponse != NULL);
+}
+
+/**
+ * Shed a new connection while the server is overloaded by
+ * sending the precomputed 503 response and closing it. The
+ * request is not read, and the send never blocks.
+ *
+ * @param sock_fd the peer socket
+ */
+void shedConnection(int sock_fd) {
+	STAT_INCR(connections_shed);
+	send(sock_fd, shedResponse, shedResponseLen, MSG_DONTWAIT | MSG_NOSIGNAL);
+	close(sock_fd);
+}
+
+/**
+ * Answer a connection whose request did not arrive in time before
+ * the caller closes it. A partly received request gets the
+ * precomputed 408 response without blocking; a connection that
+ * is idle between requests is closed without a response.
+ *
+ * @param conn the connection
+ */
+void timeoutConnection(HttpConnection *conn) {
+	if (conn->request_start != 0) {
+		STAT_INCR(requests_timed_out);
+		send(conn->sock_fd, timeoutResponse, timeoutResponseLen, MSG_DONTWAIT | MSG_NOSIGNAL);
+	}
 }
 
 /**
@@ -163,6 +550,96 @@ char *resolveUri(const char *uri, char *fspath) {
 	return fspath;
 }
 
+/**
+ * Parse a byte position of a byte range.
+ *
+ * @param p the position
+ * @param pos output position, saturated at LLONG_MAX
+ * @return the first character after the position, or NULL if none
+ */
+static const char *parseBytePos(const char *p, long long *pos) {
+	if ((*p < '0') || (*p > '9')) {
+		return NULL;
+	}
+	for (*pos = 0; (*p >= '0') && (*p <= '9'); p++) {
+		int digit = *p - '0';
+		*pos = (*pos > (LLONG_MAX - digit) / 10) ? LLONG_MAX : 10 * *pos + digit;
+	}
+	return p;
+}
+
+/**
+ * Parse the byte ranges of a Range header value (RFC 7233 2.1)
+ * against the length of the selected representation. Ranges past
+ * the end are clipped, and unsatisfiable ranges are left out.
+ *
+ * @param rangeSpec the Range header value
+ * @param contentLen the length of the representation
+ * @param ranges output satisfiable ranges in request order
+ * @param maxRanges the maximum number of ranges
+ * @return the number of satisfiable ranges, 0 if none is satisfiable,
+ *   or -1 if the header is invalid, is not in bytes, or has more
+ *   than the maximum ranges, so that it is ignored
+ */
+int parseByteRanges(const char *rangeSpec, long long contentLen, ByteRange *ranges, int maxRanges) {
+	const char *p = rangeSpec + strspn(rangeSpec, " \t");
+	if (strncasecmp(p, "bytes=", 6) != 0) {
+		return -1;
+	}
+	p += 6;
+
+	int nranges = 0;
+	int nspecs = 0;
+	for (;;) {
+		// list elements may be empty (RFC 7230 7)
+		p += strspn(p, " \t");
+		if (*p == ',') {
+			p++;
+			continue;
+		}
+		if (*p == '\0') {
+			break;
+		}
+
+		long long first, last;
+		if (*p == '-') {  // suffix of given length
+			long long suffixLen;
+			if ((p = parseBytePos(p+1, &suffixLen)) == NULL) {
+				return -1;
+			}
+			first = (suffixLen < contentLen) ? contentLen - suffixLen : 0;
+			last = (suffixLen > 0) ? contentLen - 1 : -1;
+		} else {
+			if (((p = parseBytePos(p, &first)) == NULL) || (*p++ != '-')) {
+				return -1;
+			}
+			last = LLONG_MAX;
+			if ((*p >= '0') && (*p <= '9')) {
+				p = parseBytePos(p, &last);
+				if (last < first) {
+					return -1;
+				}
+			}
+			if (last >= contentLen) {
+				last = contentLen - 1;
+			}
+		}
+		p += strspn(p, " \t");
+		if ((*p != ',') && (*p != '\0')) {
+			return -1;
+		}
+		if (++nspecs > maxRanges) {
+			return -1;  // too many to serve efficiently
+		}
+		if (first <= last) {
+			ranges[nranges].first = first;
+			ranges[nranges].last = last;
+			nranges++;
+		}
+	}
+	return (nspecs > 0) ? nranges : -1;
+}
+
 /**
  * Debug request by printing request and request headers
  *
@@ -210,3 +687,220 @@ void decodeQuery(const char *query, Properties *queryProps) {
         putProperty(queryProps, name, value);
     }
 }
+
+/**
+ * Begin a body of unknown length written to a stream, after the
+ * response headers were sent.
+ *
+ * @param body the body
+ * @param ostream the response stream
+ * @param chunked true for the chunked transfer coding
+ */
+void beginChunkedBody(ChunkedBody *body, FILE *ostream, bool chunked) {
+	body->ostream = ostream;
+	body->chunked = chunked;
+	body->discard = false;
+	body->failed = false;
+	body->nbytes = 0;
+	body->conn = NULL;
+	body->status = 0;
+	body->responseHeaders = NULL;
+	body->mem = NULL;
+	body->memLen = 0;
+	body->len = 0;
+}
+
+/**
+ * Begin a response with a body of unknown length, sending the
+ * status and the response headers. The body is chunked for HTTP/1.1
+ * clients, so the connection is kept alive. Other clients get the
+ * body until the connection closes, or buffered and sent with its
+ * length when endChunkedBody() is called if the connection persists.
+ * Response headers that name the trailer fields (Trailer) must be
+ * set before.
+ *
+ * @param body the body
+ * @param conn the connection
+ * @param status the response status
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ */
+void beginChunkedResponse(ChunkedBody *body, HttpConnection *conn, int status,
+						  Properties *responseHeaders, bool sendContent) {
+	beginChunkedBody(body, conn->stream, conn->chunked);
+	body->conn = conn;
+	body->discard = !sendContent;
+	if (!conn->chunked && conn->keep_alive && sendContent) {
+		// HTTP/1.0 client needs the length to find the next response
+		body->ostream = open_memstream(&body->mem, &body->memLen);
+		if (body->ostream != NULL) {
+			body->status = status;
+			body->responseHeaders = responseHeaders;
+			return;
+		}
+		body->ostream = conn->stream;
+		closeAfterResponse(conn, responseHeaders);  // body ends when connection closes
+	}
+	if (conn->chunked) {
+		putProperty(responseHeaders, "Transfer-Encoding", "chunked");
+	}
+	sendResponseStatus(conn->stream, status, NULL);
+	sendResponseHeaders(conn->stream, responseHeaders);
+}
+
+/**
+ * Send the buffered bytes of a body of unknown length as a chunk.
+ *
+ * @param body the body
+ */
+static void sendChunk(ChunkedBody *body) {
+	if ((body->len == 0) || body->failed) {
+		return;
+	}
+	if (   (body->chunked && (fprintf(body->ostream, "%zx%s", body->len, CRLF) < 0))
+		|| (fwrite(body->buf, 1, body->len, body->ostream) != body->len)
+		|| (body->chunked && (fputs(CRLF, body->ostream) < 0))) {
+		body->failed = true;
+	}
+	body->len = 0;
+}
+
+/**
+ * Write bytes to a body of unknown length. The bytes are sent
+ * once they fill a chunk.
+ *
+ * @param body the body
+ * @param bytes the bytes
+ * @param len the number of bytes
+ * @return true if successful, false if the stream failed
+ */
+bool writeChunkedBody(ChunkedBody *body, const char *bytes, size_t len) {
+	if (body->discard) {
+		return true;
+	}
+	body->nbytes += len;
+	while ((len > 0) && !body->failed) {
+		size_t n = CHUNK_BUFSIZE - body->len;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(body->buf + body->len, bytes, n);
+		body->len += n;
+		bytes += n;
+		len -= n;
+		if (body->len == CHUNK_BUFSIZE) {
+			sendChunk(body);
+		}
+	}
+	return !body->failed;
+}
+
+/**
+ * Write formatted text to a body of unknown length.
+ *
+ * @param body the body
+ * @param format the format string
+ * @param ... the values to format
+ * @return true if successful, false if the stream failed
+ */
+bool printfChunkedBody(ChunkedBody *body, const char *format, ...) {
+	if (body->discard) {
+		return true;
+	}
+	va_list args;
+	va_start(args, format);
+	int n = vsnprintf(body->buf + body->len, CHUNK_BUFSIZE - body->len, format, args);
+	va_end(args);
+	if ((n >= 0) && ((size_t)n < CHUNK_BUFSIZE - body->len)) {
+		body->nbytes += n;
+		body->len += n;  // formatted in place
+		return !body->failed;
+	}
+
+	// text that does not fit is written through a buffer of its own
+	char *text = (n >= 0) ? malloc(n + 1) : NULL;
+	if (text == NULL) {
+		body->failed = true;
+		return false;
+	}
+	va_start(args, format);
+	vsnprintf(text, n + 1, format, args);
+	va_end(args);
+	writeChunkedBody(body, text, n);
+	free(text);
+	return !body->failed;
+}
+
+/**
+ * Send a response buffered for its length, or an error response
+ * if the body could not be buffered.
+ *
+ * @param body the body
+ * @param trailers the trailer fields, sent as headers, or NULL if none
+ */
+static void sendBufferedResponse(ChunkedBody *body, Properties *trailers) {
+	HttpConnection *conn = body->conn;
+	if ((fclose(body->ostream) != 0) || body->failed) {
+		body->failed = true;
+		free(body->mem);
+		// headers for the body would describe the wrong content
+		Properties *errorHeaders = newProperties();
+		char date[MAXBUF];
+		putProperty(errorHeaders, "Server", server.server_name);
+		putProperty(errorHeaders, "Date", currentRFC_1123_Date_Time(date));
+		closeAfterResponse(conn, errorHeaders);
+		sendStatusResponse(conn->stream, Http_InternalServerError, NULL, errorHeaders);
+		deleteProperties(errorHeaders);
+		return;
+	}
+	char name[MAX_PROP_NAME], val[MAX_PROP_VAL];
+	for (int i = 0; (trailers != NULL) && getProperty(trailers, i, name, val); i++) {
+		putProperty(body->responseHeaders, name, val);
+	}
+	char contentLength[24];
+	snprintf(contentLength, sizeof(contentLength), "%zu", body->memLen);
+	putProperty(body->responseHeaders, "Content-Length", contentLength);
+	sendResponseStatus(conn->stream, body->status, NULL);
+	sendResponseHeaders(conn->stream, body->responseHeaders);
+	if (fwrite(body->mem, 1, body->memLen, conn->stream) != body->memLen) {
+		body->failed = true;
+	}
+	free(body->mem);
+}
+
+/**
+ * End a body of unknown length, sending the last chunk and the
+ * trailer fields. Trailer fields are sent only with the chunked
+ * transfer coding, or as headers of a buffered response. The
+ * connection of a response is not kept alive if the body was
+ * not all sent.
+ *
+ * @param body the body
+ * @param trailers the trailer fields, or NULL if none
+ * @return true if the whole body was written to the stream
+ */
+bool endChunkedBody(ChunkedBody *body, Properties *trailers) {
+	if (body->discard) {
+		return true;
+	}
+	sendChunk(body);
+	if (body->responseHeaders != NULL) {
+		sendBufferedResponse(body, trailers);
+	} else if (body->chunked && !body->failed) {
+		// last chunk, trailer fields and blank line
+		if (fprintf(body->ostream, "0%s", CRLF) < 0) {
+			body->failed = true;
+		}
+		if (trailers != NULL) {
+			sendResponseHeaderLines(body->ostream, trailers);
+		}
+		if (fputs(CRLF, body->ostream) < 0) {
+			body->failed = true;
+		}
+	}
+	if (body->failed && (body->conn != NULL)) {
+		// truncated body without its last chunk tells the client
+		body->conn->keep_alive = false;
+	}
+	return !body->failed;
+}
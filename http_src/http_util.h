@@ -9,15 +9,92 @@
 #define HTTP_UTIL_H_
 
 #include "properties.h"
+#include "http_connection.h"
+
+/** maximum ranges of a Range header that are served */
+#define MAX_BYTE_RANGES 16
+
+/** Definition of a satisfiable byte range */
+typedef struct ByteRange {
+	long long first;              /** first byte position */
+	long long last;               /** last byte position, inclusive */
+} ByteRange;
+
+/** size of the chunks of a chunked response body */
+#define CHUNK_BUFSIZE 8192
+
+/**
+ * Definition of a response body of unknown length, written with
+ * the chunked transfer coding (RFC 7230 4.1), or as it is to a
+ * response that ends when the connection closes. The body of a
+ * persistent HTTP/1.0 connection is buffered for its length.
+ */
+typedef struct ChunkedBody {
+	FILE *ostream;                /** the response stream, or the buffer */
+	bool chunked;                 /** true for the chunked transfer coding */
+	bool discard;                 /** true if the body is not sent (HEAD) */
+	bool failed;                  /** true if the stream failed */
+	long long nbytes;             /** bytes of body written */
+	HttpConnection *conn;         /** connection of the response, or NULL */
+	int status;                   /** status of a buffered response */
+	Properties *responseHeaders;  /** headers of a buffered response */
+	char *mem;                    /** buffered body */
+	size_t memLen;                /** length of buffered body */
+	size_t len;                   /** bytes of next chunk */
+	char buf[CHUNK_BUFSIZE];      /** next chunk */
+} ChunkedBody;
+
+/** longest refused request body read and discarded to keep the connection */
+#define MAX_DRAINED_BODY 65536
+
+/**
+ * Reads the unread request body from the connection
+ * to the output stream, decoding a chunked body. A
+ * client waiting for it is sent 100 Continue first.
+ * The connection is not kept alive if the body could
+ * not be read.
+ *
+ * @param conn the connection
+ * @param ostream the output stream for the body, or NULL to discard it
+ * @return 0 if successful, or the error status to respond with:
+ *   408 if the body took longer than the body timeout, 400 if the
+ *   peer closed before its end or the chunks are malformed, 413 if
+ *   a chunked body is longer than the maximum body size, 500 if the
+ *   output stream failed
+ */
+int readRequestBody(HttpConnection *conn, FILE *ostream);
+
+/**
+ * Determines whether the unread body of a request that was
+ * answered can be read and discarded to keep the connection:
+ * a short body with a Content-Length, that the client sends
+ * without waiting for 100 Continue.
+ *
+ * @param conn the connection
+ * @return true if the body can be discarded
+ */
+bool canDrainRequestBody(const HttpConnection *conn);
 
 /**
- * Reads request headers from request stream until empty line.
+ * Close the connection after the response, replacing any
+ * Connection and Keep-Alive response headers with
+ * Connection: close.
  *
- * @param istream the socket input stream
- * @param request headers
- * @throws IOException if error occurs
+ * @param conn the connection
+ * @param responseHeaders the response headers
+ */
+void closeAfterResponse(HttpConnection *conn, Properties *responseHeaders);
+
+/**
+ * Prepare the response to a request whose body is refused
+ * without being read. Unless the body can be read and
+ * discarded after the response, the connection is closed,
+ * which the response says with Connection: close.
+ *
+ * @param conn the connection
+ * @param responseHeaders the response headers
  */
-void readRequestHeaders(FILE *istream, Properties *requestHeader);
+void refuseRequestBody(HttpConnection *conn, Properties *responseHeaders);
 
 /**
  * Send bytes for status to response output stream.
@@ -39,6 +116,9 @@ void sendResponseHeaders(FILE *ostream, Properties *responseHeaders);
 
 /**
  * Set error response and error page to the response output stream.
+ * The status line, content headers and page of a status with the
+ * default message are precomputed, so only the response headers
+ * are formatted.
  *
  * @param ostream the output socket stream
  * @param status the response status
@@ -48,6 +128,36 @@ void sendResponseHeaders(FILE *ostream, Properties *responseHeaders);
  */
 void sendStatusResponse(FILE* ostream, int status, const char *statusMsg, Properties *responseHeaders);
 
+/**
+ * Precompute the status responses with their status pages, and
+ * the responses sent to connections that are closed without
+ * processing a request: shed while the server is overloaded, or
+ * timed out before the request arrived. Must be called once the
+ * server configuration and media types are loaded.
+ *
+ * @return true if successful, false if out of memory
+ */
+bool initStatusResponses(void);
+
+/**
+ * Shed a new connection while the server is overloaded by
+ * sending the precomputed 503 response and closing it. The
+ * request is not read, and the send never blocks.
+ *
+ * @param sock_fd the peer socket
+ */
+void shedConnection(int sock_fd);
+
+/**
+ * Answer a connection whose request did not arrive in time before
+ * the caller closes it. A partly received request gets the
+ * precomputed 408 response without blocking; a connection that
+ * is idle between requests is closed without a response.
+ *
+ * @param conn the connection
+ */
+void timeoutConnection(HttpConnection *conn);
+
 /**
  * Decode a URI string by replacing %xx with the
  * corresponding character code and '+' with " ".
@@ -65,6 +175,21 @@ char *unescapeUri(const char *escUri, char *uri);
  */
 char *resolveUri(const char *uri, char *fspath);
 
+/**
+ * Parse the byte ranges of a Range header value (RFC 7233 2.1)
+ * against the length of the selected representation. Ranges past
+ * the end are clipped, and unsatisfiable ranges are left out.
+ *
+ * @param rangeSpec the Range header value
+ * @param contentLen the length of the representation
+ * @param ranges output satisfiable ranges in request order
+ * @param maxRanges the maximum number of ranges
+ * @return the number of satisfiable ranges, 0 if none is satisfiable,
+ *   or -1 if the header is invalid, is not in bytes, or has more
+ *   than the maximum ranges, so that it is ignored
+ */
+int parseByteRanges(const char *rangeSpec, long long contentLen, ByteRange *ranges, int maxRanges);
+
 /**
  * Decode query string.
  *
@@ -73,6 +198,69 @@ char *resolveUri(const char *uri, char *fspath);
  */
 void decodeQuery(const char *query, Properties *queryProps);
 
+/**
+ * Begin a body of unknown length written to a stream, after the
+ * response headers were sent.
+ *
+ * @param body the body
+ * @param ostream the response stream
+ * @param chunked true for the chunked transfer coding
+ */
+void beginChunkedBody(ChunkedBody *body, FILE *ostream, bool chunked);
+
+/**
+ * Begin a response with a body of unknown length, sending the
+ * status and the response headers. The body is chunked for HTTP/1.1
+ * clients, so the connection is kept alive. Other clients get the
+ * body until the connection closes, or buffered and sent with its
+ * length when endChunkedBody() is called if the connection persists.
+ * Response headers that name the trailer fields (Trailer) must be
+ * set before.
+ *
+ * @param body the body
+ * @param conn the connection
+ * @param status the response status
+ * @param responseHeaders the response headers
+ * @param sendContent send content (GET)
+ */
+void beginChunkedResponse(ChunkedBody *body, HttpConnection *conn, int status,
+						  Properties *responseHeaders, bool sendContent);
+
+/**
+ * Write bytes to a body of unknown length. The bytes are sent
+ * once they fill a chunk.
+ *
+ * @param body the body
+ * @param bytes the bytes
+ * @param len the number of bytes
+ * @return true if successful, false if the stream failed
+ */
+bool writeChunkedBody(ChunkedBody *body, const char *bytes, size_t len);
+
+/**
+ * Write formatted text to a body of unknown length.
+ *
+ * @param body the body
+ * @param format the format string
+ * @param ... the values to format
+ * @return true if successful, false if the stream failed
+ */
+bool printfChunkedBody(ChunkedBody *body, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/**
+ * End a body of unknown length, sending the last chunk and the
+ * trailer fields. Trailer fields are sent only with the chunked
+ * transfer coding, or as headers of a buffered response. The
+ * connection of a response is not kept alive if the body was
+ * not all sent.
+ *
+ * @param body the body
+ * @param trailers the trailer fields, or NULL if none
+ * @return true if the whole body was written to the stream
+ */
+bool endChunkedBody(ChunkedBody *body, Properties *trailers);
+
 /**
  * Debug request by printing request and request headers
  *
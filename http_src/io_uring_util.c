@@ -0,0 +1,463 @@
+/*
+ * io_uring_util.c
+ *
+ * Functions that implement a minimal io_uring submission
+ * and completion ring on top of the raw system calls.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include "io_uring_util.h"
+#include "time_util.h"
+
+#if defined(HAVE_IO_URING)
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/time_types.h>
+
+/** size of each file read linked to a socket send */
+#define SEND_FILE_CHUNK 65536
+
+/** number of linked read and send pairs submitted at once */
+#define SEND_FILE_PAIRS 4
+
+/**
+ * Create an io_uring instance.
+ *
+ * @param ring the ring to initialize
+ * @param entries number of submission entries (power of 2)
+ * @return 0 if successful, -1 with errno set if unavailable
+ */
+int uring_init(IoUring *ring, unsigned entries) {
+	memset(ring, 0, sizeof(IoUring));
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	ring->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (ring->ring_fd < 0) {
+		return -1;
+	}
+	ring->features = p.features;
+
+	// map submission and completion rings, shared on newer kernels
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_len > ring->sq_len) {
+			ring->sq_len = ring->cq_len;
+		}
+		ring->cq_len = ring->sq_len;
+	}
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED) {
+		close(ring->ring_fd);
+		return -1;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ptr = ring->sq_ptr;
+	} else {
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+							MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED) {
+			munmap(ring->sq_ptr, ring->sq_len);
+			close(ring->ring_fd);
+			return -1;
+		}
+	}
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+					  MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		if (ring->cq_ptr != ring->sq_ptr) {
+			munmap(ring->cq_ptr, ring->cq_len);
+		}
+		munmap(ring->sq_ptr, ring->sq_len);
+		close(ring->ring_fd);
+		return -1;
+	}
+
+	char *sq = ring->sq_ptr;
+	ring->sq_head = (unsigned*)(sq + p.sq_off.head);
+	ring->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+	ring->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+	ring->sq_entries = p.sq_entries;
+	ring->sq_array = (unsigned*)(sq + p.sq_off.array);
+	ring->sqe_tail = *ring->sq_tail;
+
+	char *cq = ring->cq_ptr;
+	ring->cq_head = (unsigned*)(cq + p.cq_off.head);
+	ring->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+	ring->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+	// submission ring slots always refer to the sqe at the same index
+	for (unsigned i = 0; i < p.sq_entries; i++) {
+		ring->sq_array[i] = i;
+	}
+	return 0;
+}
+
+/**
+ * Release an io_uring instance.
+ *
+ * @param ring the ring
+ */
+void uring_exit(IoUring *ring) {
+	munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_ptr != ring->sq_ptr) {
+		munmap(ring->cq_ptr, ring->cq_len);
+	}
+	munmap(ring->sq_ptr, ring->sq_len);
+	close(ring->ring_fd);
+}
+
+/**
+ * Get the next free submission entry, cleared for use.
+ *
+ * @param ring the ring
+ * @return the entry or NULL if the submission ring is full
+ */
+struct io_uring_sqe *uring_get_sqe(IoUring *ring) {
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	if (ring->sqe_tail - head >= ring->sq_entries) {
+		return NULL;
+	}
+	struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+	ring->sqe_tail++;
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	return sqe;
+}
+
+/**
+ * Enter the kernel to submit entries and wait for completions.
+ *
+ * @param ring the ring
+ * @param to_submit number of entries to submit
+ * @param wait_nr number of completions to wait for
+ * @param timeout_ms milliseconds to wait, or -1 to wait indefinitely
+ * @return number of entries submitted, or -errno if error
+ */
+static int enter_ring(IoUring *ring, unsigned to_submit, unsigned wait_nr, int timeout_ms) {
+	unsigned flags = (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0;
+	struct __kernel_timespec ts;
+	struct io_uring_getevents_arg arg;
+	void *argp = NULL;
+	size_t argsz = 0;
+	if ((wait_nr > 0) && (timeout_ms >= 0)) {
+		ts.tv_sec = timeout_ms / 1000;
+		ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+		memset(&arg, 0, sizeof(arg));
+		arg.ts = (unsigned long long)(uintptr_t)&ts;
+		argp = &arg;
+		argsz = sizeof(arg);
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+
+	int ret;
+	while (((ret = (int)syscall(__NR_io_uring_enter, ring->ring_fd, to_submit,
+								wait_nr, flags, argp, argsz)) == -1) && (errno == EINTR)) {
+		// entries were consumed by the interrupted call
+		to_submit = 0;
+	}
+	return (ret == -1) ? -errno : ret;
+}
+
+/**
+ * Submit filled entries and optionally wait for completions.
+ *
+ * @param ring the ring
+ * @param wait_nr number of completions to wait for
+ * @param timeout_ms milliseconds to wait, or -1 to wait indefinitely
+ * @return number of entries submitted, or -errno if error
+ */
+int uring_submit_and_wait(IoUring *ring, unsigned wait_nr, int timeout_ms) {
+	// publish filled entries before the kernel reads the tail
+	unsigned to_submit = ring->sqe_tail - *ring->sq_tail;
+	__atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+	return enter_ring(ring, to_submit, wait_nr, timeout_ms);
+}
+
+/**
+ * Withdraw the entries that a failed or partial submission left
+ * in the submission ring, so that a later submission does not
+ * start operations on descriptors or buffers that may be gone.
+ *
+ * @param ring the ring
+ */
+void uring_unqueue_sqes(IoUring *ring) {
+	// entries past the kernel consumer index were not read
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	__atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+	ring->sqe_tail = head;
+}
+
+/**
+ * Wait for completions without submitting entries, so one
+ * thread can wait while other threads submit.
+ *
+ * @param ring the ring
+ * @param wait_nr number of completions to wait for
+ * @param timeout_ms milliseconds to wait, or -1 to wait indefinitely
+ * @return 0 if successful, -ETIME if timed out, or -errno if error
+ */
+int uring_wait(IoUring *ring, unsigned wait_nr, int timeout_ms) {
+	return enter_ring(ring, 0, wait_nr, timeout_ms);
+}
+
+/**
+ * Get the next completion without waiting.
+ *
+ * @param ring the ring
+ * @return the completion or NULL if none available
+ */
+struct io_uring_cqe *uring_peek_cqe(IoUring *ring) {
+	unsigned head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+	return &ring->cqes[head & ring->cq_mask];
+}
+
+/**
+ * Mark the completion returned by uring_peek_cqe() as consumed.
+ *
+ * @param ring the ring
+ */
+void uring_cqe_seen(IoUring *ring) {
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Register a ring of receive buffers with the kernel.
+ *
+ * @param ring the ring
+ * @param bufring the buffer ring to initialize
+ * @param bgid the buffer group id used by receives
+ * @param entries number of buffers (power of 2)
+ * @param buf_size size of each buffer
+ * @return 0 if successful, -1 if unavailable
+ */
+int uring_setup_buf_ring(IoUring *ring, IoUringBufRing *bufring,
+		unsigned short bgid, unsigned entries, size_t buf_size) {
+	// kernel requires a page-aligned ring
+	size_t ring_len = entries * sizeof(struct io_uring_buf);
+	void *br = mmap(NULL, ring_len, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (br == MAP_FAILED) {
+		return -1;
+	}
+	char *bufs = malloc(entries * buf_size);
+	if (bufs == NULL) {
+		munmap(br, ring_len);
+		return -1;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (unsigned long long)(uintptr_t)br;
+	reg.ring_entries = entries;
+	reg.bgid = bgid;
+	if (syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+		free(bufs);
+		munmap(br, ring_len);
+		return -1;
+	}
+
+	bufring->br = br;
+	bufring->bufs = bufs;
+	bufring->entries = entries;
+	bufring->buf_size = buf_size;
+	bufring->bgid = bgid;
+
+	// provide every buffer to the kernel
+	for (unsigned i = 0; i < entries; i++) {
+		struct io_uring_buf *buf = &bufring->br->bufs[i];
+		buf->addr = (unsigned long long)(uintptr_t)(bufs + i * buf_size);
+		buf->len = (unsigned)buf_size;
+		buf->bid = (unsigned short)i;
+	}
+	__atomic_store_n(&bufring->br->tail, (unsigned short)entries, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * Get the buffer selected by the kernel for a completion.
+ *
+ * @param bufring the buffer ring
+ * @param cqe_flags flags of the completion
+ * @return the buffer
+ */
+char *uring_buf(IoUringBufRing *bufring, unsigned cqe_flags) {
+	unsigned bid = cqe_flags >> IORING_CQE_BUFFER_SHIFT;
+	return bufring->bufs + bid * bufring->buf_size;
+}
+
+/**
+ * Return the buffer selected for a completion to the kernel.
+ *
+ * @param bufring the buffer ring
+ * @param cqe_flags flags of the completion
+ */
+void uring_recycle_buf(IoUringBufRing *bufring, unsigned cqe_flags) {
+	unsigned short bid = (unsigned short)(cqe_flags >> IORING_CQE_BUFFER_SHIFT);
+	unsigned short tail = bufring->br->tail;
+	struct io_uring_buf *buf = &bufring->br->bufs[tail & (bufring->entries - 1)];
+	buf->addr = (unsigned long long)(uintptr_t)(bufring->bufs + bid * bufring->buf_size);
+	buf->len = (unsigned)bufring->buf_size;
+	buf->bid = bid;
+	__atomic_store_n(&bufring->br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+/** per-thread ring for sending files: 0 untried, 1 ready, -1 unavailable */
+static __thread int send_ring_state = 0;
+static __thread IoUring send_ring;
+static __thread char *send_bufs = NULL;
+
+/**
+ * Send bytes of a file to a socket with linked file read and
+ * socket send operations on a per-thread io_uring. If the
+ * transfer is not done by the timeout, the socket is shut
+ * down so the pending operations fail.
+ *
+ * @param file_fd the file
+ * @param sock_fd the socket
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to send from the offset
+ * @param timeout_ms milliseconds the whole transfer may take, or -1 for no limit
+ * @return number of bytes sent, or -1 if io_uring is unavailable
+ *   and nothing was sent
+ */
+long long uring_send_file(int file_fd, int sock_fd, long long offset, long long nbytes, int timeout_ms) {
+	if (send_ring_state == 0) {
+		send_bufs = malloc(SEND_FILE_PAIRS * SEND_FILE_CHUNK);
+		if ((send_bufs != NULL) && (uring_init(&send_ring, 2*SEND_FILE_PAIRS) == 0)) {
+			send_ring_state = 1;
+			if ((send_ring.features & IORING_FEAT_EXT_ARG) == 0) {
+				// waits with a timeout are not available
+				uring_exit(&send_ring);
+				send_ring_state = 0;
+			}
+		}
+		if (send_ring_state == 0) {
+			free(send_bufs);
+			send_ring_state = -1;
+		}
+	}
+	if (send_ring_state < 0) {
+		return -1;
+	}
+
+	long long deadline = monotonicMilliTime() + timeout_ms;
+	long long nsent = 0;
+	while (nsent < nbytes) {
+		// chain read->send pairs so sends reach the socket in file order;
+		// a short read or send fails the link and cancels the rest
+		unsigned npairs = 0;
+		unsigned lens[SEND_FILE_PAIRS];
+		for (long long off = nsent; (npairs < SEND_FILE_PAIRS) && (off < nbytes); npairs++) {
+			long long len = nbytes - off;
+			lens[npairs] = (unsigned)((len < SEND_FILE_CHUNK) ? len : SEND_FILE_CHUNK);
+			char *buf = send_bufs + npairs * SEND_FILE_CHUNK;
+
+			struct io_uring_sqe *sqe = uring_get_sqe(&send_ring);
+			sqe->opcode = IORING_OP_READ;
+			sqe->fd = file_fd;
+			sqe->off = (unsigned long long)(offset + off);
+			sqe->addr = (unsigned long long)(uintptr_t)buf;
+			sqe->len = lens[npairs];
+			sqe->flags = IOSQE_IO_LINK;
+
+			sqe = uring_get_sqe(&send_ring);
+			sqe->opcode = IORING_OP_SEND;
+			sqe->fd = sock_fd;
+			sqe->addr = (unsigned long long)(uintptr_t)buf;
+			sqe->len = lens[npairs];
+			sqe->user_data = 1;
+			off += lens[npairs];
+			// only the last send pushes a partial segment
+			sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL | ((off < nbytes) ? MSG_MORE : 0);
+			if ((npairs + 1 < SEND_FILE_PAIRS) && (off < nbytes)) {
+				sqe->flags = IOSQE_IO_LINK;
+			}
+		}
+
+		int ret = uring_submit_and_wait(&send_ring, 0, -1);
+		unsigned nsubmitted = (ret > 0) ? (unsigned)ret : 0;
+		if (nsubmitted < 2*npairs) {
+			// entries the kernel did not take are withdrawn; those it
+			// took complete below, before their buffers are reused
+			uring_unqueue_sqes(&send_ring);
+		}
+		if (nsubmitted == 0) {
+			errno = (ret < 0) ? -ret : EBUSY;
+			return (nsent > 0) ? nsent : -1;
+		}
+
+		// completions of linked operations arrive in submission order
+		bool failed = false;
+		unsigned npair = 0;
+		for (unsigned ncqes = 0; ncqes < nsubmitted; ncqes++) {
+			struct io_uring_cqe *cqe;
+			while ((cqe = uring_peek_cqe(&send_ring)) == NULL) {
+				long long left = deadline - monotonicMilliTime();
+				if (   ((timeout_ms >= 0) && (left <= 0))
+					|| (uring_wait(&send_ring, 1, (timeout_ms >= 0) ? (int)left : -1) == -ETIME)) {
+					// client is too slow: fail the pending send
+					// and wait for the rest of the chain to cancel
+					shutdown(sock_fd, SHUT_RDWR);
+					timeout_ms = -1;
+				}
+			}
+			if (cqe->user_data == 1) {  // send
+				if (!failed && (cqe->res == (int)lens[npair])) {
+					nsent += cqe->res;
+				} else {
+					if (!failed && (cqe->res > 0)) {
+						nsent += cqe->res;
+					}
+					failed = true;
+				}
+				npair++;
+			} else if (cqe->res != (int)lens[npair]) {  // short read
+				failed = true;
+			}
+			uring_cqe_seen(&send_ring);
+		}
+		if (failed || (nsubmitted < 2*npairs)) {
+			break;
+		}
+	}
+	return nsent;
+}
+
+#else
+
+/**
+ * Send bytes of a file to a socket with linked file read and
+ * socket send operations on a per-thread io_uring.
+ * Not available on this system.
+ *
+ * @param file_fd the file
+ * @param sock_fd the socket
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to send from the offset
+ * @param timeout_ms milliseconds the whole transfer may take, or -1 for no limit
+ * @return -1 since io_uring is not available on this system
+ */
+long long uring_send_file(int file_fd, int sock_fd, long long offset, long long nbytes, int timeout_ms) {
+	(void)file_fd;
+	(void)sock_fd;
+	(void)offset;
+	(void)nbytes;
+	(void)timeout_ms;
+	return -1;
+}
+
+#endif
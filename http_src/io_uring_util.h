@@ -0,0 +1,179 @@
+/*
+ * io_uring_util.h
+ *
+ * Functions that implement a minimal io_uring submission
+ * and completion ring on top of the raw system calls.
+ *
+ */
+
+#ifndef IO_URING_UTIL_H_
+#define IO_URING_UTIL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// io_uring with multishot accept and provided buffer rings (Linux 5.19)
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_ACCEPT_MULTISHOT)
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#if defined(HAVE_IO_URING)
+
+/** Definition of an io_uring submission and completion ring */
+typedef struct IoUring {
+	int ring_fd;                  /** io_uring instance */
+	unsigned features;            /** IORING_FEAT_* of the kernel */
+
+	unsigned *sq_head;            /** kernel consumer index of submissions */
+	unsigned *sq_tail;            /** producer index of submissions */
+	unsigned sq_mask;             /** index mask of submission ring */
+	unsigned sq_entries;          /** entries in submission ring */
+	unsigned *sq_array;           /** submission ring of sqe indexes */
+	unsigned sqe_tail;            /** next sqe to fill */
+	struct io_uring_sqe *sqes;    /** submission queue entries */
+
+	unsigned *cq_head;            /** consumer index of completions */
+	unsigned *cq_tail;            /** kernel producer index of completions */
+	unsigned cq_mask;             /** index mask of completion ring */
+	struct io_uring_cqe *cqes;    /** completion queue entries */
+
+	void *sq_ptr;                 /** submission ring mapping */
+	size_t sq_len;                /** size of submission ring mapping */
+	void *cq_ptr;                 /** completion ring mapping */
+	size_t cq_len;                /** size of completion ring mapping */
+	size_t sqes_len;              /** size of sqe mapping */
+} IoUring;
+
+/** Definition of a ring of buffers provided to the kernel for receives */
+typedef struct IoUringBufRing {
+	struct io_uring_buf_ring *br; /** shared buffer ring */
+	char *bufs;                   /** buffer memory */
+	unsigned entries;             /** number of buffers (power of 2) */
+	size_t buf_size;              /** size of each buffer */
+	unsigned short bgid;          /** buffer group id */
+} IoUringBufRing;
+
+/**
+ * Create an io_uring instance.
+ *
+ * @param ring the ring to initialize
+ * @param entries number of submission entries (power of 2)
+ * @return 0 if successful, -1 with errno set if unavailable
+ */
+int uring_init(IoUring *ring, unsigned entries);
+
+/**
+ * Release an io_uring instance.
+ *
+ * @param ring the ring
+ */
+void uring_exit(IoUring *ring);
+
+/**
+ * Get the next free submission entry, cleared for use.
+ *
+ * @param ring the ring
+ * @return the entry or NULL if the submission ring is full
+ */
+struct io_uring_sqe *uring_get_sqe(IoUring *ring);
+
+/**
+ * Submit filled entries and optionally wait for completions.
+ *
+ * @param ring the ring
+ * @param wait_nr number of completions to wait for
+ * @param timeout_ms milliseconds to wait, or -1 to wait indefinitely
+ * @return number of entries submitted, or -errno if error
+ */
+int uring_submit_and_wait(IoUring *ring, unsigned wait_nr, int timeout_ms);
+
+/**
+ * Withdraw the entries that a failed or partial submission left
+ * in the submission ring, so that a later submission does not
+ * start operations on descriptors or buffers that may be gone.
+ *
+ * @param ring the ring
+ */
+void uring_unqueue_sqes(IoUring *ring);
+
+/**
+ * Wait for completions without submitting entries, so one
+ * thread can wait while other threads submit.
+ *
+ * @param ring the ring
+ * @param wait_nr number of completions to wait for
+ * @param timeout_ms milliseconds to wait, or -1 to wait indefinitely
+ * @return 0 if successful, -ETIME if timed out, or -errno if error
+ */
+int uring_wait(IoUring *ring, unsigned wait_nr, int timeout_ms);
+
+/**
+ * Get the next completion without waiting.
+ *
+ * @param ring the ring
+ * @return the completion or NULL if none available
+ */
+struct io_uring_cqe *uring_peek_cqe(IoUring *ring);
+
+/**
+ * Mark the completion returned by uring_peek_cqe() as consumed.
+ *
+ * @param ring the ring
+ */
+void uring_cqe_seen(IoUring *ring);
+
+/**
+ * Register a ring of receive buffers with the kernel.
+ *
+ * @param ring the ring
+ * @param bufring the buffer ring to initialize
+ * @param bgid the buffer group id used by receives
+ * @param entries number of buffers (power of 2)
+ * @param buf_size size of each buffer
+ * @return 0 if successful, -1 if unavailable
+ */
+int uring_setup_buf_ring(IoUring *ring, IoUringBufRing *bufring,
+		unsigned short bgid, unsigned entries, size_t buf_size);
+
+/**
+ * Get the buffer selected by the kernel for a completion.
+ *
+ * @param bufring the buffer ring
+ * @param cqe_flags flags of the completion
+ * @return the buffer
+ */
+char *uring_buf(IoUringBufRing *bufring, unsigned cqe_flags);
+
+/**
+ * Return the buffer selected for a completion to the kernel.
+ *
+ * @param bufring the buffer ring
+ * @param cqe_flags flags of the completion
+ */
+void uring_recycle_buf(IoUringBufRing *bufring, unsigned cqe_flags);
+
+#endif /* HAVE_IO_URING */
+
+/**
+ * Send bytes of a file to a socket with linked file read and
+ * socket send operations on a per-thread io_uring. If the
+ * transfer is not done by the timeout, the socket is shut
+ * down so the pending operations fail.
+ *
+ * @param file_fd the file
+ * @param sock_fd the socket
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to send from the offset
+ * @param timeout_ms milliseconds the whole transfer may take, or -1 for no limit
+ * @return number of bytes sent, or -1 if io_uring is unavailable
+ *   and nothing was sent
+ */
+long long uring_send_file(int file_fd, int sock_fd, long long offset, long long nbytes, int timeout_ms);
+
+#endif /* IO_URING_UTIL_H_ */
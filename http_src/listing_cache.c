@@ -0,0 +1,739 @@
+/*
+ * listing_cache.c
+ *
+ * Functions that generate directory listings in memory and
+ * cache them by directory until the directory changes.
+ *
+ * A listing is written as the directory is read, with the status
+ * of each entry read relative to the open directory, either into
+ * memory or to a response body. Pages, orders and JSON listings
+ * are streamed for each request, as is a listing longer than the
+ * cache, so a large directory is not held in memory unless it is
+ * sorted, which needs the names of all entries.
+ *
+ * A cached listing is used while the directory has the inode and
+ * modification time it had when it was read, which changes when
+ * entries are added, removed or renamed. Changes to the entries themselves, such as a
+ * file that grows, are reported by the file system watches of the
+ * content cache, or the listing is generated again after the open
+ * file validation interval if the content tree is not watched.
+ *
+ * Listings are requested far less often than files, and a listing
+ * of a large directory may be most of the byte limit, so unlike the
+ * other caches it is not split into shards: one lock guards the hash
+ * table and the least-recently-used list.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include "listing_cache.h"
+#include "content_cache.h"
+#include "file_cache.h"
+#include "server_stats.h"
+
+/** number of hash buckets (power of 2) */
+#define LISTING_CACHE_BUCKETS 64
+
+/** initial capacity of the entries of a sorted listing */
+#define LISTING_ENTRIES 1024
+
+/** Definition of the listing cache */
+typedef struct ListingCache {
+	pthread_mutex_t lock;         /** lock of cache */
+	CachedListing *buckets[LISTING_CACHE_BUCKETS];  /** hash buckets of entries */
+	size_t nbytes;                /** bytes of cached listings */
+	size_t max_bytes;             /** maximum bytes of cached listings */
+	long long invalidated;        /** monotonic ms of last invalidation */
+	CachedListing *lru_head;      /** most recently used entry */
+	CachedListing *lru_tail;      /** least recently used entry */
+} ListingCache;
+
+/** Definition of an entry of a sorted listing */
+typedef struct ListingEntry {
+	char *name;                   /** name of entry */
+	long long size;               /** length of entry */
+	time_t mtime;                 /** modification time of entry */
+	mode_t mode;                  /** type and mode of entry, 0 if status not read */
+} ListingEntry;
+
+/** names of listing orders in queries */
+static const char *listingSortNames[] = { "", "name", "mtime", "size" };
+
+/** the listing cache */
+static ListingCache cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/** milliseconds a listing is used before it is generated again if not watched */
+static int listing_cache_valid_ms = 0;
+
+/**
+ * Initialize the listing cache. Until called, or if the maximum
+ * is 0, every listing is generated for its request.
+ *
+ * @param max_bytes maximum bytes of listings in memory
+ * @param valid_ms milliseconds a listing is used before it is
+ *   generated again, unless file system watches invalidate it
+ * @return true if successful, false if out of memory
+ */
+bool initListingCache(size_t max_bytes, int valid_ms) {
+	listing_cache_valid_ms = valid_ms;
+	cache.max_bytes = max_bytes;
+	return true;
+}
+
+/**
+ * Parse the page, order and format of a listing from the query
+ * parameters "limit", "cursor" and "sort" of a request.
+ *
+ * @param query the query parameters
+ * @param page the page, with its format already set
+ * @return true if the parameters are valid
+ */
+bool parseListingPage(Properties *query, ListingPage *page) {
+	char val[MAX_PROP_VAL];
+	char *end;
+	if (findProperty(query, 0, "limit", val) != SIZE_MAX) {
+		page->limit = strtol(val, &end, 10);
+		if ((*val == '\0') || (*end != '\0') || (page->limit < 0)) {
+			return false;
+		}
+	}
+	if (findProperty(query, 0, "cursor", val) != SIZE_MAX) {
+		page->cursor = strtoll(val, &end, 10);
+		if ((*val == '\0') || (*end != '\0') || (page->cursor < 0)) {
+			return false;
+		}
+	}
+	if (findProperty(query, 0, "sort", val) != SIZE_MAX) {
+		for (page->sort = ListingSort_Name; page->sort <= ListingSort_Size; page->sort++) {
+			if (strcasecmp(val, listingSortNames[page->sort]) == 0) {
+				break;
+			}
+		}
+		if (page->sort > ListingSort_Size) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Write a string as a JSON string literal.
+ *
+ * @param body the listing body
+ * @param str the string
+ */
+static void writeJsonString(ChunkedBody *body, const char *str) {
+	writeChunkedBody(body, "\"", 1);
+	for (const char *p = str; *p != '\0'; ) {
+		size_t n = strcspn(p, "\"\\\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f"
+							  "\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f");
+		writeChunkedBody(body, p, n);
+		p += n;
+		if (*p != '\0') {
+			printfChunkedBody(body, "\\u%04x", (unsigned char)*p++);
+		}
+	}
+	writeChunkedBody(body, "\"", 1);
+}
+
+/**
+ * Write the head of a listing.
+ *
+ * @param body the listing body
+ * @param uri the request URI of the directory
+ * @param page the page of the listing
+ */
+static void writeListingHead(ChunkedBody *body, const char *uri, const ListingPage *page) {
+	if (page->json) {
+		writeChunkedBody(body, "{\"uri\":", 7);
+		writeJsonString(body, uri);
+		writeChunkedBody(body, ",\"entries\":[", 12);
+		return;
+	}
+	printfChunkedBody(body,
+					  "<html>\n"
+					  "<head><title>index of %s</title></head>\n"
+					  "<body>\n"
+					  "<h1>Index of %s</h1>\n"
+					  "<table>\n"
+					  "<tr>\n"
+					  "<th valign=\"top\"></th>\n"
+					  "<th>Name</th>\n"
+					  "<th>Last modified</th>\n"
+					  "<th>Size</th>\n"
+					  "<th>Description (file type)</th>\n"
+					  "</tr>\n"
+					  "<tr>\n"
+					  "<td colspan=\"5\"><hr></td>\n"
+					  "</tr>\n", uri, uri);
+}
+
+/**
+ * Write an entry of a listing. The parent directory ".." is
+ * a link to it in HTML listings.
+ *
+ * @param body the listing body
+ * @param page the page of the listing
+ * @param name the name of the entry
+ * @param mode the type and mode of the entry
+ * @param size the length of the entry
+ * @param mtime the modification time of the entry
+ * @param first true for the first entry of the page
+ */
+static void writeListingEntry(ChunkedBody *body, const ListingPage *page, const char *name,
+							  mode_t mode, long long size, time_t mtime, bool first) {
+	const char *entryMode = S_ISDIR(mode) ? "directory" : S_ISREG(mode) ? "file" : "";
+	if (page->json) {
+		writeChunkedBody(body, first ? "\n{\"name\":" : ",\n{\"name\":", first ? 9 : 10);
+		writeJsonString(body, name);
+		printfChunkedBody(body, ",\"type\":\"%s\",\"size\":%lld,\"mtime\":%lld}",
+						  (*entryMode != '\0') ? entryMode : "other", size, (long long)mtime);
+		return;
+	}
+
+	bool parent = (strcmp(name, "..") == 0);
+	char entryTime[MAXBUF];
+	milliTimeToShortHM_Date_Time(mtime, entryTime);
+	printfChunkedBody(body,
+					  "<tr>\n"
+					  "<td></td>\n"
+					  "<td><a href=\"%s%s\">%s</a></td>\n"
+					  "<td align=\"right\">%s</td>\n"
+					  "<td align=\"right\">%lld</td>\n"
+					  "<td align=\"right\">%s</td>\n"
+					  "<td></td>\n"
+					  "</tr>\n",
+					  parent ? "../" : name, (!parent && S_ISDIR(mode)) ? "/" : "",
+					  parent ? "Parent Directory" : name, entryTime, size, entryMode);
+}
+
+/**
+ * Write the end of a listing, with a link to the next page
+ * if there is one.
+ *
+ * @param body the listing body
+ * @param page the page of the listing
+ * @param next the cursor of the next page, or -1 if none
+ */
+static void writeListingFoot(ChunkedBody *body, const ListingPage *page, long long next) {
+	if (page->json) {
+		if (next >= 0) {
+			printfChunkedBody(body, "\n],\"next\":\"%lld\"}\n", next);
+		} else {
+			writeChunkedBody(body, "\n],\"next\":null}\n", 16);
+		}
+		return;
+	}
+	if (next >= 0) {
+		printfChunkedBody(body,
+						  "<tr><td colspan=\"5\"><a href=\"?limit=%ld&amp;cursor=%lld%s%s\">"
+						  "Next page</a></td></tr>\n",
+						  page->limit, next, (page->sort != ListingSort_None) ? "&amp;sort=" : "",
+						  listingSortNames[page->sort]);
+	}
+	const char *htmlLast = "<tr><td colspan=\"5\"><hr></td></tr>\n"
+						   "</table>\n"
+						   "</body>\n"
+						   "</html>\n";
+	writeChunkedBody(body, htmlLast, strlen(htmlLast));
+}
+
+/**
+ * Compare listing entries by name.
+ *
+ * @param e1 the first entry
+ * @param e2 the second entry
+ * @return <0, 0 or >0 if the first entry orders before, with or after the second
+ */
+static int compareEntryNames(const void *e1, const void *e2) {
+	return strcmp(((const ListingEntry*)e1)->name, ((const ListingEntry*)e2)->name);
+}
+
+/**
+ * Compare listing entries by modification time, then by name.
+ *
+ * @param e1 the first entry
+ * @param e2 the second entry
+ * @return <0, 0 or >0 if the first entry orders before, with or after the second
+ */
+static int compareEntryTimes(const void *e1, const void *e2) {
+	time_t t1 = ((const ListingEntry*)e1)->mtime, t2 = ((const ListingEntry*)e2)->mtime;
+	return (t1 < t2) ? -1 : (t1 > t2) ? 1 : compareEntryNames(e1, e2);
+}
+
+/**
+ * Compare listing entries by length, then by name.
+ *
+ * @param e1 the first entry
+ * @param e2 the second entry
+ * @return <0, 0 or >0 if the first entry orders before, with or after the second
+ */
+static int compareEntrySizes(const void *e1, const void *e2) {
+	long long s1 = ((const ListingEntry*)e1)->size, s2 = ((const ListingEntry*)e2)->size;
+	return (s1 < s2) ? -1 : (s1 > s2) ? 1 : compareEntryNames(e1, e2);
+}
+
+/**
+ * Write a page of sorted entries of a directory. Every name is
+ * read before the page is written, and the status of every entry
+ * if the order needs it. The cursor of a page is the position of
+ * its first entry in the order.
+ *
+ * @param dir the open directory
+ * @param page the page of the listing
+ * @param body the listing body
+ * @return the cursor of the next page, or -1 if none
+ */
+static long long writeSortedEntries(DIR *dir, const ListingPage *page, ChunkedBody *body) {
+	int dirFd = dirfd(dir);
+	bool statAll = (page->sort != ListingSort_Name);
+	size_t nentries = 0, capacity = LISTING_ENTRIES;
+	ListingEntry *entries = malloc(capacity * sizeof(ListingEntry));
+	struct dirent *dirEnt;
+	while ((entries != NULL) && ((dirEnt = readdir(dir)) != NULL)) {
+		if ((strcmp(dirEnt->d_name, ".") == 0) || (strcmp(dirEnt->d_name, "..") == 0)) {
+			continue;
+		}
+		struct stat sb;
+		if (statAll && (fstatat(dirFd, dirEnt->d_name, &sb, 0) != 0)) {
+			continue;  // removed since the directory was read
+		}
+		if (nentries == capacity) {
+			ListingEntry *more = realloc(entries, 2 * capacity * sizeof(ListingEntry));
+			if (more == NULL) {
+				break;
+			}
+			entries = more;
+			capacity *= 2;
+		}
+		ListingEntry *entry = &entries[nentries];
+		entry->name = strdup(dirEnt->d_name);
+		if (entry->name == NULL) {
+			break;
+		}
+		entry->mode = statAll ? sb.st_mode : 0;
+		entry->size = statAll ? (long long)sb.st_size : 0;
+		entry->mtime = statAll ? sb.st_mtim.tv_sec : 0;
+		nentries++;
+	}
+	if (entries == NULL) {
+		body->failed = true;
+		return -1;
+	}
+	qsort(entries, nentries, sizeof(ListingEntry),
+		  (page->sort == ListingSort_Mtime) ? compareEntryTimes :
+		  (page->sort == ListingSort_Size) ? compareEntrySizes : compareEntryNames);
+
+	long long next = -1;
+	size_t end = nentries;
+	if ((page->limit > 0) && (page->cursor + page->limit < (long long)nentries)) {
+		end = page->cursor + page->limit;
+		next = end;
+	}
+	bool first = true;
+	for (size_t i = page->cursor; (i < end) && !body->failed; i++) {
+		ListingEntry *entry = &entries[i];
+		struct stat sb;
+		if (entry->mode == 0) {
+			if (fstatat(dirFd, entry->name, &sb, 0) != 0) {
+				continue;  // removed since the directory was read
+			}
+			entry->mode = sb.st_mode;
+			entry->size = sb.st_size;
+			entry->mtime = sb.st_mtim.tv_sec;
+		}
+		writeListingEntry(body, page, entry->name, entry->mode, entry->size, entry->mtime, first);
+		first = false;
+	}
+	for (size_t i = 0; i < nentries; i++) {
+		free(entries[i].name);
+	}
+	free(entries);
+	return next;
+}
+
+/**
+ * Write a listing of a directory. Unsorted entries are written as
+ * they are read, and the cursor of a page is the position of its
+ * first entry in the directory stream, so entries of earlier pages
+ * are read and skipped.
+ *
+ * @param dir the open directory
+ * @param uri the request URI of the directory
+ * @param page the page of the listing
+ * @param body the listing body
+ * @param maxLen the maximum length of the listing, or 0 for no limit
+ * @return true if the whole listing was written
+ */
+static bool writeListing(DIR *dir, const char *uri, const ListingPage *page, ChunkedBody *body, long long maxLen) {
+	writeListingHead(body, uri, page);
+
+	// the parent directory comes first in HTML listings
+	int dirFd = dirfd(dir);
+	struct stat sb;
+	if (!page->json && (strcmp(uri, "/") != 0) && (fstatat(dirFd, "..", &sb, 0) == 0)) {
+		writeListingEntry(body, page, "..", sb.st_mode, sb.st_size, sb.st_mtim.tv_sec, true);
+	}
+
+	long long next = -1;
+	if (page->sort != ListingSort_None) {
+		next = writeSortedEntries(dir, page, body);
+	} else {
+		// entries are read relative to the open directory, without
+		// resolving the path of the directory for each one
+		long count = 0;
+		long long pos = 0;
+		struct dirent *dirEnt;
+		while (   !body->failed && ((maxLen == 0) || (body->nbytes <= maxLen))
+			   && ((dirEnt = readdir(dir)) != NULL)) {
+			if ((strcmp(dirEnt->d_name, ".") == 0) || (strcmp(dirEnt->d_name, "..") == 0)) {
+				continue;
+			}
+			if (pos >= page->cursor) {
+				if ((page->limit > 0) && (count == page->limit)) {
+					next = pos;  // first entry of next page
+					break;
+				}
+				if (fstatat(dirFd, dirEnt->d_name, &sb, 0) == 0) {
+					writeListingEntry(body, page, dirEnt->d_name, sb.st_mode, sb.st_size,
+									  sb.st_mtim.tv_sec, count == 0);
+					count++;
+				}
+			}
+			pos++;
+		}
+	}
+
+	writeListingFoot(body, page, next);
+	return !body->failed && ((maxLen == 0) || (body->nbytes <= maxLen));
+}
+
+/**
+ * Determines whether the cursor of a page is a valid offset in a
+ * directory: 0 for the first page, or the position of an entry,
+ * counted from the start of the directory stream in any order.
+ * The directory is rewound afterwards.
+ *
+ * @param dir the open directory
+ * @param page the page of the listing
+ * @return true if the cursor is valid
+ */
+bool isValidListingCursor(DIR *dir, const ListingPage *page) {
+	if (page->cursor == 0) {
+		return true;
+	}
+	long long nentries = 0;
+	struct dirent *dirEnt;
+	while ((nentries <= page->cursor) && ((dirEnt = readdir(dir)) != NULL)) {
+		if ((strcmp(dirEnt->d_name, ".") != 0) && (strcmp(dirEnt->d_name, "..") != 0)) {
+			nentries++;
+		}
+	}
+	rewinddir(dir);
+	return nentries > page->cursor;
+}
+
+/**
+ * Stream a listing of a directory to a response body.
+ *
+ * @param dir the open directory
+ * @param uri the request URI of the directory
+ * @param page the page, order and format of the listing
+ * @param body the response body
+ * @return true if the whole listing was written
+ */
+bool streamListing(DIR *dir, const char *uri, const ListingPage *page, ChunkedBody *body) {
+	return writeListing(dir, uri, page, body, 0);
+}
+
+/**
+ * Generate a listing of a directory in memory.
+ *
+ * @param dir the open directory
+ * @param uri the request URI of the directory
+ * @param page the page, order and format of the listing
+ * @param maxLen the maximum length of the listing, or 0 for no limit
+ * @param len output length of the listing
+ * @return the listing to free, or NULL if it is too long or out of memory
+ */
+char *renderListing(DIR *dir, const char *uri, const ListingPage *page, size_t maxLen, size_t *len) {
+	char *buf = NULL;
+	FILE *memStream = open_memstream(&buf, len);
+	if (memStream == NULL) {
+		return NULL;
+	}
+	ChunkedBody body;
+	beginChunkedBody(&body, memStream, false);
+	bool complete = writeListing(dir, uri, page, &body, maxLen) && endChunkedBody(&body, NULL);
+	if ((fclose(memStream) != 0) || !complete) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+/**
+ * Unlink an entry from the least-recently-used list of the locked cache.
+ *
+ * @param listing the entry
+ */
+static void unlinkLru(CachedListing *listing) {
+	if (listing->lru_prev != NULL) {
+		listing->lru_prev->lru_next = listing->lru_next;
+	} else {
+		cache.lru_head = listing->lru_next;
+	}
+	if (listing->lru_next != NULL) {
+		listing->lru_next->lru_prev = listing->lru_prev;
+	} else {
+		cache.lru_tail = listing->lru_prev;
+	}
+	listing->lru_prev = listing->lru_next = NULL;
+}
+
+/**
+ * Link an entry as most recently used in the locked cache.
+ *
+ * @param listing the entry
+ */
+static void linkLru(CachedListing *listing) {
+	listing->lru_prev = NULL;
+	listing->lru_next = cache.lru_head;
+	if (cache.lru_head != NULL) {
+		cache.lru_head->lru_prev = listing;
+	} else {
+		cache.lru_tail = listing;
+	}
+	cache.lru_head = listing;
+}
+
+/**
+ * Free an entry that is no longer cached or used.
+ *
+ * @param listing the entry
+ */
+static void freeCachedListing(CachedListing *listing) {
+	free(listing->body);
+	free(listing);
+}
+
+/**
+ * Remove an entry from the locked cache, dropping the reference
+ * of the cache. The entry is freed if no request is using it.
+ *
+ * @param listing the entry
+ */
+static void removeListing(CachedListing *listing) {
+	CachedListing **link = &cache.buckets[listing->hash % LISTING_CACHE_BUCKETS];
+	while (*link != listing) {
+		link = &(*link)->next;
+	}
+	*link = listing->next;
+	unlinkLru(listing);
+	cache.nbytes -= listing->len;
+	if (--listing->refs == 0) {
+		freeCachedListing(listing);
+	}
+}
+
+/**
+ * Find the entry for a path in the locked cache.
+ *
+ * @param path the resolved path
+ * @param hash the hash of the path
+ * @return the entry, or NULL if none
+ */
+static CachedListing *findListing(const char *path, size_t hash) {
+	CachedListing *listing = cache.buckets[hash % LISTING_CACHE_BUCKETS];
+	while ((listing != NULL) && ((listing->hash != hash) || (strcmp(listing->path, path) != 0))) {
+		listing = listing->next;
+	}
+	return listing;
+}
+
+/**
+ * Determines whether a cached listing is current for the status
+ * of its directory.
+ *
+ * @param listing the entry
+ * @param sb the status of the directory
+ * @return true if the listing can be used
+ */
+static bool isListingCurrent(const CachedListing *listing, const struct stat *sb) {
+	return    (listing->dev == sb->st_dev) && (listing->ino == sb->st_ino)
+		   && (listing->mtime.tv_sec == sb->st_mtim.tv_sec)
+		   && (listing->mtime.tv_nsec == sb->st_mtim.tv_nsec)
+		   && (   isContentWatched()
+			   || (monotonicMilliTime() - listing->listed < listing_cache_valid_ms));
+}
+
+/**
+ * Open the listing of a directory, using the cached listing while
+ * the directory has the same inode and modification time. The
+ * caller must close the entry with closeCachedListing().
+ *
+ * @param path the resolved path of the directory, ending with '/'
+ * @param uri the request URI of the directory
+ * @param sb the status of the directory
+ * @param cacheable true if the listing of the URI may be cached
+ * @return the entry, or NULL if the directory cannot be read
+ */
+CachedListing *openCachedListing(const char *path, const char *uri, const struct stat *sb, bool cacheable) {
+	size_t hash = hashCachedPath(path);
+	cacheable = cacheable && (cache.max_bytes > 0);
+	if (cacheable) {
+		pthread_mutex_lock(&cache.lock);
+		CachedListing *listing = findListing(path, hash);
+		if ((listing != NULL) && !isListingCurrent(listing, sb)) {
+			removeListing(listing);
+			listing = NULL;
+		}
+		if (listing != NULL) {
+			listing->refs++;
+			unlinkLru(listing);
+			linkLru(listing);
+		}
+		pthread_mutex_unlock(&cache.lock);
+		if (listing != NULL) {
+			STAT_INCR(listing_cache_hits);
+			return listing;
+		}
+		STAT_INCR(listing_cache_misses);
+	}
+
+	// read the directory without holding the lock
+	long long listed = monotonicMilliTime();
+	DIR *dir = opendir(path);
+	if (dir == NULL) {
+		return NULL;
+	}
+	size_t pathLen = strlen(path);
+	CachedListing *listing = malloc(sizeof(CachedListing) + pathLen + 1);
+	if (listing == NULL) {
+		closedir(dir);
+		return NULL;
+	}
+	// a listing longer than the cache is streamed instead
+	ListingPage page = { 0, 0, ListingSort_None, false };
+	listing->body = NULL;
+	if (cache.max_bytes > 0) {
+		listing->body = renderListing(dir, uri, &page, cache.max_bytes, &listing->len);
+	}
+	closedir(dir);
+	if (listing->body == NULL) {
+		listing->len = 0;
+	}
+	memcpy(listing->path, path, pathLen + 1);
+	snprintf(listing->contentLength, sizeof(listing->contentLength), "%zu", listing->len);
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	listing->modified = now.tv_sec;
+	cachedTimeToRFC_1123_Date_Time(now.tv_sec, listing->lastModified);
+	// entity tag of listing from the directory inode and when it was generated
+	snprintf(listing->etag, sizeof(listing->etag), "\"%llx-%llx\"",
+			 (unsigned long long)sb->st_ino,
+			 (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec);
+	listing->dev = sb->st_dev;
+	listing->ino = sb->st_ino;
+	listing->mtime = sb->st_mtim;
+	listing->listed = listed;
+	listing->hash = hash;
+	listing->refs = 1;
+	listing->next = listing->lru_prev = listing->lru_next = NULL;
+	if (!cacheable || (listing->len > cache.max_bytes)) {
+		return listing;
+	}
+
+	pthread_mutex_lock(&cache.lock);
+	if (listed <= cache.invalidated) {
+		// an entry of a directory changed while it was read
+		pthread_mutex_unlock(&cache.lock);
+		return listing;
+	}
+	CachedListing *stale = findListing(path, hash);
+	if (stale != NULL) {
+		removeListing(stale);
+	}
+	while ((cache.nbytes + listing->len > cache.max_bytes) && (cache.lru_tail != NULL)) {
+		removeListing(cache.lru_tail);
+	}
+	CachedListing **bucket = &cache.buckets[hash % LISTING_CACHE_BUCKETS];
+	listing->next = *bucket;
+	*bucket = listing;
+	linkLru(listing);
+	cache.nbytes += listing->len;
+	listing->refs++;
+	pthread_mutex_unlock(&cache.lock);
+	return listing;
+}
+
+/**
+ * Release an entry returned by openCachedListing(). The listing
+ * is freed once the entry is no longer cached or used.
+ *
+ * @param listing the entry
+ */
+void closeCachedListing(CachedListing *listing) {
+	pthread_mutex_lock(&cache.lock);
+	bool unused = (--listing->refs == 0);
+	pthread_mutex_unlock(&cache.lock);
+	if (unused) {
+		freeCachedListing(listing);
+	}
+}
+
+/**
+ * Remove the cached listing of the directory of a path after
+ * the path is created, changed or removed.
+ *
+ * @param path the resolved path of the directory entry
+ */
+void invalidateCachedListing(const char *path) {
+	// the directory path ends with '/', as in request URIs,
+	// and so may the path of a directory entry
+	char dir[PATH_MAX];
+	size_t dirLen = strlen(path);
+	if ((dirLen > 0) && (path[dirLen - 1] == '/')) {
+		dirLen--;
+	}
+	while ((dirLen > 0) && (path[dirLen - 1] != '/')) {
+		dirLen--;
+	}
+	if ((dirLen == 0) || (dirLen >= sizeof(dir))) {
+		return;
+	}
+	memcpy(dir, path, dirLen);
+	dir[dirLen] = '\0';
+
+	size_t hash = hashCachedPath(dir);
+	if (cache.max_bytes == 0) {
+		return;
+	}
+	pthread_mutex_lock(&cache.lock);
+	cache.invalidated = monotonicMilliTime();
+	CachedListing *listing = findListing(dir, hash);
+	if (listing != NULL) {
+		removeListing(listing);
+	}
+	pthread_mutex_unlock(&cache.lock);
+}
+
+/**
+ * Remove every cached listing, when changes cannot be matched
+ * to directories.
+ */
+void clearListingCache(void) {
+	pthread_mutex_lock(&cache.lock);
+	cache.invalidated = monotonicMilliTime();
+	while (cache.lru_tail != NULL) {
+		removeListing(cache.lru_tail);
+	}
+	pthread_mutex_unlock(&cache.lock);
+}
@@ -0,0 +1,150 @@
+/*
+ * listing_cache.h
+ *
+ * Functions that generate directory listings in memory and
+ * cache them by directory until the directory changes.
+ *
+ */
+
+#ifndef LISTING_CACHE_H_
+#define LISTING_CACHE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "time_util.h"
+#include "properties.h"
+#include "http_util.h"
+
+/** Definition of the orders of a listing */
+typedef enum ListingSort {
+	ListingSort_None,             /** order of the directory stream */
+	ListingSort_Name,             /** by name */
+	ListingSort_Mtime,            /** by modification time, then name */
+	ListingSort_Size              /** by length, then name */
+} ListingSort;
+
+/** Definition of the page, order and format of a listing */
+typedef struct ListingPage {
+	long limit;                   /** maximum entries, 0 for all */
+	long long cursor;             /** position of the first entry, 0 for the first page */
+	ListingSort sort;             /** order of the entries */
+	bool json;                    /** true for JSON, false for HTML */
+} ListingPage;
+
+/** Definition of a directory listing in memory */
+typedef struct CachedListing {
+	char *body;                   /** HTML listing, or NULL if streamed instead */
+	size_t len;                   /** length of listing */
+	char contentLength[24];       /** Content-Length header value */
+	char lastModified[RFC_1123_DATE_LEN];  /** Last-Modified header value */
+	char etag[64];                /** ETag header value */
+	time_t modified;              /** time the listing was generated */
+	dev_t dev;                    /** device of the directory */
+	ino_t ino;                    /** inode of the directory */
+	struct timespec mtime;        /** modification time of the directory */
+
+	long long listed;             /** monotonic ms when the directory was read */
+	int refs;                     /** references by cache and requests */
+	size_t hash;                  /** hash of path */
+	struct CachedListing *next;      /** next entry in hash bucket */
+	struct CachedListing *lru_prev;  /** more recently used entry */
+	struct CachedListing *lru_next;  /** less recently used entry */
+	char path[];                  /** resolved path of the directory */
+} CachedListing;
+
+/**
+ * Initialize the listing cache. Until called, or if the maximum
+ * is 0, every listing is generated for its request.
+ *
+ * @param max_bytes maximum bytes of listings in memory
+ * @param valid_ms milliseconds a listing is used before it is
+ *   generated again, unless file system watches invalidate it
+ * @return true if successful, false if out of memory
+ */
+bool initListingCache(size_t max_bytes, int valid_ms);
+
+/**
+ * Open the listing of a directory, using the cached listing while
+ * the directory has the same inode and modification time. A listing
+ * longer than the cache has no body, and is streamed instead. The
+ * caller must close the entry with closeCachedListing().
+ *
+ * @param path the resolved path of the directory, ending with '/'
+ * @param uri the request URI of the directory
+ * @param sb the status of the directory
+ * @param cacheable true if the listing of the URI may be cached
+ * @return the entry, or NULL if the directory cannot be read
+ */
+CachedListing *openCachedListing(const char *path, const char *uri, const struct stat *sb, bool cacheable);
+
+/**
+ * Parse the page, order and format of a listing from the query
+ * parameters "limit", "cursor" and "sort" of a request.
+ *
+ * @param query the query parameters
+ * @param page the page, with its format already set
+ * @return true if the parameters are valid
+ */
+bool parseListingPage(Properties *query, ListingPage *page);
+
+/**
+ * Determines whether the cursor of a page is a valid offset in a
+ * directory: 0 for the first page, or the position of an entry,
+ * counted from the start of the directory stream in any order.
+ * The directory is rewound afterwards.
+ *
+ * @param dir the open directory
+ * @param page the page of the listing
+ * @return true if the cursor is valid
+ */
+bool isValidListingCursor(DIR *dir, const ListingPage *page);
+
+/**
+ * Stream a listing of a directory to a response body.
+ *
+ * @param dir the open directory
+ * @param uri the request URI of the directory
+ * @param page the page, order and format of the listing
+ * @param body the response body
+ * @return true if the whole listing was written
+ */
+bool streamListing(DIR *dir, const char *uri, const ListingPage *page, ChunkedBody *body);
+
+/**
+ * Generate a listing of a directory in memory.
+ *
+ * @param dir the open directory
+ * @param uri the request URI of the directory
+ * @param page the page, order and format of the listing
+ * @param maxLen the maximum length of the listing, or 0 for no limit
+ * @param len output length of the listing
+ * @return the listing to free, or NULL if it is too long or out of memory
+ */
+char *renderListing(DIR *dir, const char *uri, const ListingPage *page, size_t maxLen, size_t *len);
+
+/**
+ * Release an entry returned by openCachedListing(). The listing
+ * is freed once the entry is no longer cached or used.
+ *
+ * @param listing the entry
+ */
+void closeCachedListing(CachedListing *listing);
+
+/**
+ * Remove the cached listing of the directory of a path after
+ * the path is created, changed or removed.
+ *
+ * @param path the resolved path of the directory entry
+ */
+void invalidateCachedListing(const char *path);
+
+/**
+ * Remove every cached listing, when changes cannot be matched
+ * to directories.
+ */
+void clearListingCache(void);
+
+#endif /* LISTING_CACHE_H_ */
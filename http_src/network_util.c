@@ -5,12 +5,25 @@
  *
  */
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/time.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+#include "time_util.h"
+
+/** maximum bytes moved by one sendfile call */
+#define SEND_FILE_MAX (1 << 30)
 
 /**
  * Connect to peer at host and port.
@@ -50,12 +63,14 @@ int get_peer_socket(const char *host, int port) {
 }
 
 /**
- * Get listener socket
+ * Open a listener socket on a port.
  *
  * @param port the port number
+ * @param reuseport true to share the port with other listeners
+ * @param incoming_cpu CPU whose connections the listener prefers, or -1
  * @return listener socket or 0 if unavailable
  */
-int get_listener_socket(int port) {
+static int open_listener_socket(int port, bool reuseport, int incoming_cpu) {
     // Creating internet socket stream file descriptor
     int listen_sock_fd = socket(AF_INET, SOCK_STREAM, 0);
     if (listen_sock_fd == 0) {
@@ -70,6 +85,31 @@ int get_listener_socket(int port) {
     	return 0;
     }
 
+    if (reuseport) {
+#if defined(SO_REUSEPORT)
+        // SO_REUSEPORT lets each listener bind the same port, and the
+        // kernel spreads incoming connections across their queues
+        if (setsockopt(listen_sock_fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(int)) < 0) {
+            close(listen_sock_fd);
+            return 0;
+        }
+#else
+        close(listen_sock_fd);
+        errno = ENOPROTOOPT;
+        return 0;
+#endif
+    }
+
+#if defined(SO_INCOMING_CPU)
+    // prefer this listener for connections whose packets the CPU
+    // receives; only a hint, so failure is not an error
+    if (incoming_cpu >= 0) {
+        setsockopt(listen_sock_fd, SOL_SOCKET, SO_INCOMING_CPU, &incoming_cpu, sizeof(int));
+    }
+#else
+    (void)incoming_cpu;
+#endif
+
     // internet socket address of any host address on specified port
     struct sockaddr_in address;
     socklen_t addrlen = sizeof(address);
@@ -94,6 +134,29 @@ int get_listener_socket(int port) {
 	return listen_sock_fd;
 }
 
+/**
+ * Get listener socket
+ *
+ * @param port the port number
+ * @return listener socket or 0 if unavailable
+ */
+int get_listener_socket(int port) {
+    return open_listener_socket(port, false, -1);
+}
+
+/**
+ * Get one of several listener sockets that share a port.
+ * The kernel balances new connections across them, so each
+ * can be accepted by its own thread without contention.
+ *
+ * @param port the port number
+ * @param incoming_cpu CPU whose connections the listener prefers, or -1
+ * @return listener socket or 0 if unavailable
+ */
+int get_reuseport_listener_socket(int port, int incoming_cpu) {
+    return open_listener_socket(port, true, incoming_cpu);
+}
+
 /**
  * Accept new peer connection on a listen socket.
  *
@@ -113,6 +176,175 @@ int accept_peer_connection(int listen_sock_fd) {
 	return 0;  // keeps compiler happy
 }
 
+/**
+ * Accept a pending peer connection on a non-blocking listen socket.
+ *
+ * @param listen_sock_fd the non-blocking listen socket
+ * @return the peer socket fd or 0 if no connection is pending
+ */
+int accept_pending_connection(int listen_sock_fd) {
+	for (;;) {  // until accepted or none pending
+		struct sockaddr_in peer_addr;
+		socklen_t peer_size = sizeof(peer_addr);
+		int peer_sock_fd = accept(listen_sock_fd, (struct sockaddr *)&peer_addr, &peer_size);
+		if (peer_sock_fd > 0) {
+			return peer_sock_fd;
+		}
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+			return 0;
+		}
+		if ((errno != EINTR) && (errno != ECONNABORTED)) {
+			perror("accept");
+			return 0;
+		}
+	}
+}
+
+/**
+ * Set or clear non-blocking mode for a socket.
+ *
+ * @param sock_fd the socket
+ * @param nonblocking true for non-blocking mode
+ * @return 0 if successful, -1 with errno set if error.
+ */
+int set_socket_nonblocking(int sock_fd, bool nonblocking) {
+	int flags = fcntl(sock_fd, F_GETFL, 0);
+	if (flags == -1) {
+		return -1;
+	}
+	flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	return fcntl(sock_fd, F_SETFL, flags);
+}
+
+/**
+ * Set or clear TCP no-delay mode for a socket, which sends
+ * small writes without waiting for earlier segments to be
+ * acknowledged.
+ *
+ * @param sock_fd the socket
+ * @param nodelay true for no-delay mode
+ * @return 0 if successful, -1 with errno set if error.
+ */
+int set_socket_nodelay(int sock_fd, bool nodelay) {
+	int optval = nodelay ? 1 : 0;
+	return setsockopt(sock_fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(int));
+}
+
+/**
+ * Set the timeouts of blocking receives and sends on a socket,
+ * after which they fail with EAGAIN if no bytes were moved.
+ *
+ * @param sock_fd the socket
+ * @param recv_timeout_ms receive timeout in milliseconds, 0 for none
+ * @param send_timeout_ms send timeout in milliseconds, 0 for none
+ * @return 0 if successful, -1 with errno set if error.
+ */
+int set_socket_timeouts(int sock_fd, int recv_timeout_ms, int send_timeout_ms) {
+	struct timeval tv = {
+		.tv_sec = recv_timeout_ms / 1000,
+		.tv_usec = (recv_timeout_ms % 1000) * 1000
+	};
+	if (setsockopt(sock_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0) {
+		return -1;
+	}
+	tv.tv_sec = send_timeout_ms / 1000;
+	tv.tv_usec = (send_timeout_ms % 1000) * 1000;
+	return setsockopt(sock_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * Wait until a socket has bytes to read or the peer closed it.
+ *
+ * @param sock_fd the socket
+ * @param timeout_ms milliseconds to wait, or -1 to wait indefinitely
+ * @return true if readable, false if timed out or error
+ */
+bool wait_socket_readable(int sock_fd, int timeout_ms) {
+	struct pollfd pfd = {.fd = sock_fd, .events = POLLIN};
+	int status;
+	while (((status = poll(&pfd, 1, timeout_ms)) == -1) && (errno == EINTR)) {}
+	return status > 0;
+}
+
+/**
+ * Wait until a socket has room to send more bytes.
+ *
+ * @param sock_fd the socket
+ * @param timeout_ms milliseconds to wait, or -1 to wait indefinitely
+ * @return true if writable, false if timed out or error
+ */
+bool wait_socket_writable(int sock_fd, int timeout_ms) {
+	struct pollfd pfd = {.fd = sock_fd, .events = POLLOUT};
+	int status;
+	while (((status = poll(&pfd, 1, timeout_ms)) == -1) && (errno == EINTR)) {}
+	return status > 0;
+}
+
+#if defined(__linux__)
+
+/**
+ * Send bytes of a file to a socket with sendfile, without
+ * copying them through user space. A partial send resumes
+ * once the socket is writable again, so the socket may be
+ * non-blocking; a transfer that is not done by the timeout
+ * ends early, however slowly the client reads.
+ *
+ * @param sock_fd the socket
+ * @param file_fd the file
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to send
+ * @param timeout_ms milliseconds the whole transfer may take, or -1 for no limit
+ * @return number of bytes sent, or -1 if the file cannot be sent
+ *   this way and nothing was sent
+ */
+long long send_file(int sock_fd, int file_fd, long long offset, long long nbytes, int timeout_ms) {
+	off_t off = (off_t)offset;
+	long long deadline = monotonicMilliTime() + timeout_ms;
+	long long nsent = 0;
+	while (nsent < nbytes) {
+		long long left = nbytes - nsent;
+		ssize_t n = sendfile(sock_fd, file_fd, &off, (left < SEND_FILE_MAX) ? (size_t)left : SEND_FILE_MAX);
+		if (n > 0) {
+			nsent += n;
+		} else if (n == 0) {
+			break;  // file is shorter than expected
+		} else if (errno == EINTR) {
+			continue;
+		} else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+			// socket buffer is full: resume when it drains
+			long long left = deadline - monotonicMilliTime();
+			if (   ((timeout_ms >= 0) && (left <= 0))
+				|| !wait_socket_writable(sock_fd, (timeout_ms >= 0) ? (int)left : -1)) {
+				break;
+			}
+		} else if ((nsent == 0) && ((errno == EINVAL) || (errno == ENOSYS))) {
+			return -1;  // file does not support sendfile
+		} else {
+			break;
+		}
+	}
+	return nsent;
+}
+
+#else
+
+/**
+ * Send bytes of a file to a socket with sendfile.
+ * Not available on this system.
+ *
+ * @param sock_fd the socket
+ * @param file_fd the file
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to send
+ * @param timeout_ms milliseconds the whole transfer may take, or -1 for no limit
+ * @return -1 since nothing was sent
+ */
+long long send_file(int sock_fd, int file_fd, long long offset, long long nbytes, int timeout_ms) {
+	return -1;
+}
+
+#endif
+
 /**
  * Get the local host and port for a socket.
  *
@@ -73,6 +73,17 @@ int get_peer_socket(const char *host, int port);
  */
 int get_listener_socket(int port) ;
 
+/**
+ * Get one of several listener sockets that share a port.
+ * The kernel balances new connections across them, so each
+ * can be accepted by its own thread without contention.
+ *
+ * @param port the port number
+ * @param incoming_cpu CPU whose connections the listener prefers, or -1
+ * @return listener socket or 0 if unavailable
+ */
+int get_reuseport_listener_socket(int port, int incoming_cpu);
+
 /**
  * Accept new peer connection on a listen socket.
  *
@@ -81,6 +92,80 @@ int get_listener_socket(int port) ;
  */
 int accept_peer_connection(int listen_sock_fd);
 
+/**
+ * Accept a pending peer connection on a non-blocking listen socket.
+ *
+ * @param listen_sock_fd the non-blocking listen socket
+ * @return the peer socket fd or 0 if no connection is pending
+ */
+int accept_pending_connection(int listen_sock_fd);
+
+/**
+ * Set or clear non-blocking mode for a socket.
+ *
+ * @param sock_fd the socket
+ * @param nonblocking true for non-blocking mode
+ * @return 0 if successful, -1 with errno set if error.
+ */
+int set_socket_nonblocking(int sock_fd, bool nonblocking);
+
+/**
+ * Set or clear TCP no-delay mode for a socket, which sends
+ * small writes without waiting for earlier segments to be
+ * acknowledged.
+ *
+ * @param sock_fd the socket
+ * @param nodelay true for no-delay mode
+ * @return 0 if successful, -1 with errno set if error.
+ */
+int set_socket_nodelay(int sock_fd, bool nodelay);
+
+/**
+ * Set the timeouts of blocking receives and sends on a socket,
+ * after which they fail with EAGAIN if no bytes were moved.
+ *
+ * @param sock_fd the socket
+ * @param recv_timeout_ms receive timeout in milliseconds, 0 for none
+ * @param send_timeout_ms send timeout in milliseconds, 0 for none
+ * @return 0 if successful, -1 with errno set if error.
+ */
+int set_socket_timeouts(int sock_fd, int recv_timeout_ms, int send_timeout_ms);
+
+/**
+ * Wait until a socket has bytes to read or the peer closed it.
+ *
+ * @param sock_fd the socket
+ * @param timeout_ms milliseconds to wait, or -1 to wait indefinitely
+ * @return true if readable, false if timed out or error
+ */
+bool wait_socket_readable(int sock_fd, int timeout_ms);
+
+/**
+ * Wait until a socket has room to send more bytes.
+ *
+ * @param sock_fd the socket
+ * @param timeout_ms milliseconds to wait, or -1 to wait indefinitely
+ * @return true if writable, false if timed out or error
+ */
+bool wait_socket_writable(int sock_fd, int timeout_ms);
+
+/**
+ * Send bytes of a file to a socket with sendfile, without
+ * copying them through user space. A partial send resumes
+ * once the socket is writable again, so the socket may be
+ * non-blocking; a transfer that is not done by the timeout
+ * ends early, however slowly the client reads.
+ *
+ * @param sock_fd the socket
+ * @param file_fd the file
+ * @param offset the file offset of the first byte
+ * @param nbytes the number of bytes to send
+ * @param timeout_ms milliseconds the whole transfer may take, or -1 for no limit
+ * @return number of bytes sent, or -1 if the file cannot be sent
+ *   this way and nothing was sent
+ */
+long long send_file(int sock_fd, int file_fd, long long offset, long long nbytes, int timeout_ms);
+
 /**
  * Get the local host and port for a socket.
  *
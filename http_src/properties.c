@@ -127,6 +127,31 @@ size_t findProperty(Properties* props, size_t propIndex, const char* name, char*
 	return SIZE_MAX;
 }
 
+/**
+ * Remove all properties with the specified name.
+ * Property comparison is case-independent.
+ *
+ * @param props the properties
+ * @param name prop name
+ * @return the number of properties removed
+ */
+size_t removeProperty(Properties* props, const char* name) {
+	size_t nremoved = 0;
+	size_t propIndex = 0;
+	while (propIndex < nProperties(props)) {
+		Property* prop = elementAtVArray(props->props, propIndex);
+		if (strcasecmp(name, prop->name) == 0) {
+			free(prop->name);
+			free(prop->val);
+			removeElementAtVArray(props->props, propIndex);
+			nremoved++;
+		} else {
+			propIndex++;
+		}
+	}
+	return nremoved;
+}
+
 /**
  * Return number of properties.
  * @param props the properties
@@ -64,6 +64,16 @@ bool getProperty(Properties* props, size_t propIndex, char* name, char* val);
  */
 size_t findProperty(Properties* props, size_t propIndex, const char* name, char* val);
 
+/**
+ * Remove all properties with the specified name.
+ * Property comparison is case-independent.
+ *
+ * @param props the properties
+ * @param name prop name
+ * @return the number of properties removed
+ */
+size_t removeProperty(Properties* props, const char* name);
+
 /**
  * Return number of properties.
  * @param props the properties
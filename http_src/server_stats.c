@@ -0,0 +1,67 @@
+/*
+ * server_stats.c
+ *
+ * Counters of server activity, updated by workers and
+ * event loops and reported on the server status URI.
+ *
+ */
+
+#include <stdio.h>
+#include "server_stats.h"
+#include "http_server.h"
+
+/** server counters */
+ServerStats server_stats;
+
+/** names of server counters in report order */
+static const struct {
+	const char *name;
+	atomic_llong *stat;
+} statNames[] = {
+	{"connections_accepted", &server_stats.connections_accepted},
+	{"connections_shed", &server_stats.connections_shed},
+	{"requests", &server_stats.requests},
+	{"requests_timed_out", &server_stats.requests_timed_out},
+	{"file_cache_hits", &server_stats.file_cache_hits},
+	{"file_cache_misses", &server_stats.file_cache_misses},
+	{"content_cache_hits", &server_stats.content_cache_hits},
+	{"content_cache_misses", &server_stats.content_cache_misses},
+	{"content_cache_evictions", &server_stats.content_cache_evictions},
+	{"compress_cache_hits", &server_stats.compress_cache_hits},
+	{"compress_cache_misses", &server_stats.compress_cache_misses},
+	{"listing_cache_hits", &server_stats.listing_cache_hits},
+	{"listing_cache_misses", &server_stats.listing_cache_misses},
+};
+
+/**
+ * Format the server counters as one "name value" line per counter.
+ * With several listeners, their accept counts follow the totals.
+ *
+ * @param buf the buffer for the counters
+ * @param size the size of the buffer
+ * @return the length of the formatted counters
+ */
+size_t formatServerStats(char *buf, size_t size) {
+	size_t len = 0;
+	size_t nstats = sizeof(statNames)/sizeof(statNames[0]);
+	size_t nlisteners = (server.listeners > 1) ? server.listeners : 0;
+	for (size_t i = 0; i < nstats + nlisteners; i++) {
+		int n;
+		if (i < nstats) {
+			long long val = atomic_load_explicit(statNames[i].stat, memory_order_relaxed);
+			n = snprintf(buf + len, size - len, "%s %lld\n", statNames[i].name, val);
+		} else {
+			// imbalance across listeners shows in their accept counts
+			size_t listener = i - nstats;
+			long long val = atomic_load_explicit(&server_stats.listener_accepted[listener],
+												 memory_order_relaxed);
+			n = snprintf(buf + len, size - len, "listener_%zu_accepted %lld\n", listener, val);
+		}
+		if ((n < 0) || ((size_t)n >= size - len)) {
+			break;
+		}
+		len += n;
+	}
+	buf[len] = '\0';
+	return len;
+}
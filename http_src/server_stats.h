@@ -0,0 +1,50 @@
+/*
+ * server_stats.h
+ *
+ * Counters of server activity, updated by workers and
+ * event loops and reported on the server status URI.
+ *
+ */
+
+#ifndef SERVER_STATS_H_
+#define SERVER_STATS_H_
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "http_server.h"
+
+/** Definition of server counters */
+typedef struct ServerStats {
+	atomic_llong connections_accepted;  /** connections accepted */
+	atomic_llong connections_shed;      /** connections refused while job queue full */
+	atomic_llong requests;              /** requests started */
+	atomic_llong requests_timed_out;    /** partial requests closed with 408 */
+	atomic_llong file_cache_hits;       /** files found valid in open file cache */
+	atomic_llong file_cache_misses;     /** files read from file system */
+	atomic_llong content_cache_hits;    /** bodies sent from memory */
+	atomic_llong content_cache_misses;  /** bodies not found in memory */
+	atomic_llong content_cache_evictions;  /** bodies evicted for space */
+	atomic_llong compress_cache_hits;   /** compressed variants found in cache */
+	atomic_llong compress_cache_misses; /** files compressed */
+	atomic_llong listing_cache_hits;    /** directory listings found in cache */
+	atomic_llong listing_cache_misses;  /** directory listings generated */
+	atomic_llong listener_accepted[MAX_LISTENERS];  /** connections accepted per listener */
+} ServerStats;
+
+/** external declaration of server counters */
+extern ServerStats server_stats;
+
+/** increment a server counter; counters are independent, so no ordering needed */
+#define STAT_INCR(stat) atomic_fetch_add_explicit(&server_stats.stat, 1, memory_order_relaxed)
+
+/**
+ * Format the server counters as one "name value" line per counter.
+ * With several listeners, their accept counts follow the totals.
+ *
+ * @param buf the buffer for the counters
+ * @param size the size of the buffer
+ * @return the length of the formatted counters
+ */
+size_t formatServerStats(char *buf, size_t size);
+
+#endif /* SERVER_STATS_H_ */
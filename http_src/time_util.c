@@ -5,8 +5,31 @@
  *
  */
 
+#include <stdatomic.h>
+#include <string.h>
 #include "time_util.h"
 
+/** number of seconds whose Date strings are kept for readers */
+#define DATE_SLOTS 4
+
+/** current date-time strings, indexed by second */
+static char dateSlots[DATE_SLOTS][RFC_1123_DATE_LEN];
+
+/** second of the published date-time string */
+static atomic_llong dateSecond = -1;
+
+/** second of the date-time string being published */
+static atomic_llong dateClaim = -1;
+
+/** number of recently formatted times cached per thread */
+#define MTIME_CACHE_SIZE 16
+
+/** per-thread formatted times, indexed by time */
+static __thread struct {
+	time_t timer;
+	char str[RFC_1123_DATE_LEN];
+} mtimeCache[MTIME_CACHE_SIZE];
+
 /**
  * Converts timer to a RFC-1123 formatted date-time string
  * of the form: Sat, 13 Apr 2019 19:03:32 GMT
@@ -15,11 +38,116 @@
  * @return pointer to the buffer
  */
 char *milliTimeToRFC_1123_Date_Time(time_t timer, char *buf) {
-	struct tm* tm_info = gmtime(&timer);
-	strftime(buf, 128, "%a, %d %b %Y %H:%M:%S GMT", tm_info);
+	struct tm tm_info;
+	gmtime_r(&timer, &tm_info);
+	strftime(buf, RFC_1123_DATE_LEN, "%a, %d %b %Y %H:%M:%S GMT", &tm_info);
 	return buf;
 }
 
+/**
+ * Copies the current time as a RFC-1123 formatted date-time
+ * string. The string is formatted once per second by the first
+ * thread to need it, and published for other threads to copy
+ * without locking. A slot is reused only DATE_SLOTS seconds
+ * after it is published, so readers copy a stable string.
+ *
+ * @param buf the buffer of at least RFC_1123_DATE_LEN bytes
+ * @return pointer to the buffer
+ */
+char *currentRFC_1123_Date_Time(char *buf) {
+	time_t now = time(NULL);
+	if (atomic_load_explicit(&dateSecond, memory_order_acquire) == now) {
+		memcpy(buf, dateSlots[now % DATE_SLOTS], RFC_1123_DATE_LEN);
+		return buf;
+	}
+
+	milliTimeToRFC_1123_Date_Time(now, buf);
+	// one thread publishes the string for the new second
+	long long claimed = atomic_load_explicit(&dateClaim, memory_order_relaxed);
+	if ((claimed != now) && atomic_compare_exchange_strong(&dateClaim, &claimed, now)) {
+		memcpy(dateSlots[now % DATE_SLOTS], buf, RFC_1123_DATE_LEN);
+		atomic_store_explicit(&dateSecond, now, memory_order_release);
+	}
+	return buf;
+}
+
+/**
+ * Converts timer to a RFC-1123 formatted date-time string,
+ * using a per-thread cache of recently formatted times such
+ * as the modification times of frequently requested files.
+ *
+ * @param timer the time
+ * @param buf the buffer of at least RFC_1123_DATE_LEN bytes
+ * @return pointer to the buffer
+ */
+char *cachedTimeToRFC_1123_Date_Time(time_t timer, char *buf) {
+	unsigned slot = (unsigned long long)timer % MTIME_CACHE_SIZE;
+	if ((mtimeCache[slot].timer != timer) || (mtimeCache[slot].str[0] == '\0')) {
+		milliTimeToRFC_1123_Date_Time(timer, mtimeCache[slot].str);
+		mtimeCache[slot].timer = timer;
+	}
+	memcpy(buf, mtimeCache[slot].str, RFC_1123_DATE_LEN);
+	return buf;
+}
+
+/**
+ * Returns the value of two decimal digits.
+ *
+ * @param s the digits
+ * @return the value, or -1 if not two digits
+ */
+static int twoDigits(const char *s) {
+	if ((s[0] < '0') || (s[0] > '9') || (s[1] < '0') || (s[1] > '9')) {
+		return -1;
+	}
+	return (s[0] - '0')*10 + (s[1] - '0');
+}
+
+/**
+ * Parses a RFC-1123 formatted date-time string, the preferred
+ * HTTP-date format (RFC 7231 7.1.1.1), without the locale and
+ * format handling of strptime(). The obsolete RFC 850 and
+ * asctime formats are not recognized.
+ *
+ * @param s the string
+ * @return the time, or -1 if the string is not a RFC-1123 date-time
+ */
+time_t parseRFC_1123_Date_Time(const char *s) {
+	// "Sun, 06 Nov 1994 08:49:37 GMT"
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	if (   (strlen(s) != RFC_1123_DATE_LEN - 1) || (s[3] != ',') || (s[4] != ' ')
+		|| (s[7] != ' ') || (s[11] != ' ') || (s[16] != ' ') || (s[19] != ':')
+		|| (s[22] != ':') || (strcmp(s+25, " GMT") != 0)) {
+		return -1;
+	}
+	int month = 0;
+	while ((month < 12) && (strncmp(s+8, months + 3*month, 3) != 0)) {
+		month++;
+	}
+	int day = twoDigits(s+5);
+	int century = twoDigits(s+12);
+	int year = twoDigits(s+14);
+	int hour = twoDigits(s+17);
+	int minute = twoDigits(s+20);
+	int second = twoDigits(s+23);
+	if (   (month == 12) || (day < 1) || (day > 31) || (century < 0) || (year < 0)
+		|| (hour < 0) || (hour > 23) || (minute < 0) || (minute > 59)
+		|| (second < 0) || (second > 60)) {
+		return -1;
+	}
+	year += century*100;
+
+	// days since the epoch of the proleptic Gregorian date,
+	// counting years from March so leap days fall at the end
+	int y = (month < 2) ? year - 1 : year;
+	int era = y / 400;
+	int yearOfEra = y - era*400;
+	int dayOfYear = (153*((month + 10) % 12) + 2)/5 + day - 1;
+	int dayOfEra = yearOfEra*365 + yearOfEra/4 - yearOfEra/100 + dayOfYear;
+	long long days = (long long)era*146097 + dayOfEra - 719468;
+	return (time_t)(days*86400 + hour*3600 + minute*60 + second);
+}
+
 /**
  * Converts timer to short formatted date-time string
  * of the form: 2015-11-18 08:43
@@ -29,7 +157,19 @@ char *milliTimeToRFC_1123_Date_Time(time_t timer, char *buf) {
  * @return pointer to the buffer
  */
 char *milliTimeToShortHM_Date_Time(time_t timer, char *buf) {
-	struct tm* tm_info = gmtime(&timer);
-	strftime(buf, 128, "%F %H:%M", tm_info);
+	struct tm tm_info;
+	gmtime_r(&timer, &tm_info);
+	strftime(buf, 128, "%F %H:%M", &tm_info);
 	return buf;
 }
+
+/**
+ * Returns milliseconds of the monotonic clock, which
+ * is not affected by changes to the system time.
+ * @return the monotonic time in milliseconds
+ */
+long long monotonicMilliTime(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
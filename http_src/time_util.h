@@ -10,6 +10,9 @@
 
 #include <time.h>
 
+/** size of a RFC-1123 date-time string and its terminator */
+#define RFC_1123_DATE_LEN 30
+
 /**
  * Converts timer to a RFC-1123 formatted date-time string.
  * @param timer the time
@@ -18,6 +21,39 @@
  */
 char *milliTimeToRFC_1123_Date_Time(time_t timer, char *buf);
 
+/**
+ * Copies the current time as a RFC-1123 formatted date-time
+ * string. The string is formatted once per second by the first
+ * thread to need it, and published for other threads to copy
+ * without locking.
+ *
+ * @param buf the buffer of at least RFC_1123_DATE_LEN bytes
+ * @return pointer to the buffer
+ */
+char *currentRFC_1123_Date_Time(char *buf);
+
+/**
+ * Converts timer to a RFC-1123 formatted date-time string,
+ * using a per-thread cache of recently formatted times such
+ * as the modification times of frequently requested files.
+ *
+ * @param timer the time
+ * @param buf the buffer of at least RFC_1123_DATE_LEN bytes
+ * @return pointer to the buffer
+ */
+char *cachedTimeToRFC_1123_Date_Time(time_t timer, char *buf);
+
+/**
+ * Parses a RFC-1123 formatted date-time string, the preferred
+ * HTTP-date format (RFC 7231 7.1.1.1), without the locale and
+ * format handling of strptime(). The obsolete RFC 850 and
+ * asctime formats are not recognized.
+ *
+ * @param s the string
+ * @return the time, or -1 if the string is not a RFC-1123 date-time
+ */
+time_t parseRFC_1123_Date_Time(const char *s);
+
 /**
  * Converts timer to short formatted date-time string
  * of the form: 2015-11-18 08:43
@@ -28,4 +64,11 @@ char *milliTimeToRFC_1123_Date_Time(time_t timer, char *buf);
  */
 char *milliTimeToShortHM_Date_Time(time_t timer, char *buf);
 
+/**
+ * Returns milliseconds of the monotonic clock, which
+ * is not affected by changes to the system time.
+ * @return the monotonic time in milliseconds
+ */
+long long monotonicMilliTime(void);
+
 #endif /* TIME_UTIL_H_ */
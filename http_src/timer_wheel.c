@@ -0,0 +1,232 @@
+/*
+ * timer_wheel.c
+ *
+ * Functions that implement a hierarchical timer wheel
+ * with constant time insertion and removal of timers.
+ *
+ * Level 0 has one slot per tick for the next 64 ticks. Each
+ * higher level has one slot per rotation of the level below,
+ * and its timers move down a level when the level below
+ * wraps around to the slot they fall in.
+ *
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "timer_wheel.h"
+
+/** index mask of a wheel level */
+#define TIMER_LEVEL_MASK (TIMER_LEVEL_SLOTS - 1)
+
+/**
+ * Initialize an empty slot list.
+ *
+ * @param slot the slot list head
+ */
+static void init_slot(Timer *slot) {
+	slot->prev = slot->next = slot;
+}
+
+/**
+ * Initialize an empty timer wheel.
+ *
+ * @param wheel the timer wheel
+ * @param now_ms the current monotonic time in milliseconds
+ */
+void timer_wheel_init(TimerWheel *wheel, long long now_ms) {
+	wheel->tick = now_ms / TIMER_TICK_MS;
+	wheel->ntimers = 0;
+	for (int level = 0; level < TIMER_LEVELS; level++) {
+		for (int i = 0; i < TIMER_LEVEL_SLOTS; i++) {
+			init_slot(&wheel->slots[level][i]);
+		}
+	}
+}
+
+/**
+ * Initialize a timer that is not pending.
+ *
+ * @param timer the timer
+ */
+void timer_init(Timer *timer) {
+	timer->prev = timer->next = NULL;
+	timer->expires = 0;
+}
+
+/**
+ * Returns true if the timer is pending on a wheel.
+ *
+ * @param timer the timer
+ * @return true if the timer is pending
+ */
+bool timer_pending(const Timer *timer) {
+	return timer->prev != NULL;
+}
+
+/**
+ * Link a timer into the slot for its expiry tick, choosing
+ * the lowest level whose span covers the ticks remaining.
+ *
+ * @param wheel the timer wheel
+ * @param timer the timer
+ */
+static void place_timer(TimerWheel *wheel, Timer *timer) {
+	long long delta = timer->expires - wheel->tick;
+	long long idx;
+	int level = 0;
+	if (delta < 0) {
+		// already due: expire with the next tick
+		idx = wheel->tick;
+	} else {
+		// clamp to the span of the wheel
+		long long max_delta = (1LL << (TIMER_LEVEL_BITS*TIMER_LEVELS)) - 1;
+		if (delta > max_delta) {
+			timer->expires = wheel->tick + max_delta;
+			delta = max_delta;
+		}
+		while (   (level < TIMER_LEVELS-1)
+			   && (delta >= (1LL << (TIMER_LEVEL_BITS*(level+1))))) {
+			level++;
+		}
+		idx = timer->expires >> (TIMER_LEVEL_BITS*level);
+	}
+
+	// append to circular slot list
+	Timer *slot = &wheel->slots[level][idx & TIMER_LEVEL_MASK];
+	timer->next = slot;
+	timer->prev = slot->prev;
+	slot->prev->next = timer;
+	slot->prev = timer;
+}
+
+/**
+ * Unlink a timer from its slot list.
+ *
+ * @param timer the timer
+ */
+static void unlink_timer(Timer *timer) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->prev = timer->next = NULL;
+}
+
+/**
+ * Add a timer to the wheel, or move it if already pending.
+ *
+ * @param wheel the timer wheel
+ * @param timer the timer
+ * @param expires_ms monotonic time in milliseconds when timer expires
+ */
+void timer_wheel_add(TimerWheel *wheel, Timer *timer, long long expires_ms) {
+	if (timer_pending(timer)) {
+		unlink_timer(timer);
+	} else {
+		wheel->ntimers++;
+	}
+	// round up so a timer never expires early
+	timer->expires = (expires_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+	place_timer(wheel, timer);
+}
+
+/**
+ * Remove a timer from the wheel if it is pending.
+ *
+ * @param wheel the timer wheel
+ * @param timer the timer
+ */
+void timer_wheel_remove(TimerWheel *wheel, Timer *timer) {
+	if (timer_pending(timer)) {
+		unlink_timer(timer);
+		wheel->ntimers--;
+	}
+}
+
+/**
+ * Move the timers of a slot down to the levels below.
+ *
+ * @param wheel the timer wheel
+ * @param level the level of the slot
+ * @param idx the index of the slot
+ * @return the index of the slot
+ */
+static int cascade_slot(TimerWheel *wheel, int level, int idx) {
+	Timer *slot = &wheel->slots[level][idx];
+	Timer *timer = slot->next;
+	init_slot(slot);
+	while (timer != slot) {
+		Timer *next = timer->next;
+		place_timer(wheel, timer);
+		timer = next;
+	}
+	return idx;
+}
+
+/**
+ * Remove the timers that expired by the current time.
+ *
+ * @param wheel the timer wheel
+ * @param now_ms the current monotonic time in milliseconds
+ * @return the expired timers linked by next, or NULL if none
+ */
+Timer *timer_wheel_expire(TimerWheel *wheel, long long now_ms) {
+	long long now_tick = now_ms / TIMER_TICK_MS;
+	Timer *expired = NULL;
+	Timer **tail = &expired;
+
+	while ((wheel->tick <= now_tick) && (wheel->ntimers > 0)) {
+		int idx = (int)(wheel->tick & TIMER_LEVEL_MASK);
+		if (idx == 0) {
+			// level 0 wrapped: move down the next slot of each level above
+			// until a level that did not wrap itself
+			for (int level = 1; level < TIMER_LEVELS; level++) {
+				int lidx = (int)((wheel->tick >> (TIMER_LEVEL_BITS*level)) & TIMER_LEVEL_MASK);
+				if (cascade_slot(wheel, level, lidx) != 0) {
+					break;
+				}
+			}
+		}
+
+		// every timer in the current slot is due
+		Timer *slot = &wheel->slots[0][idx];
+		while (slot->next != slot) {
+			Timer *timer = slot->next;
+			unlink_timer(timer);
+			wheel->ntimers--;
+			*tail = timer;
+			tail = &timer->next;
+		}
+		wheel->tick++;
+	}
+	if (wheel->ntimers == 0) {
+		// nothing to move down: skip the idle ticks
+		wheel->tick = now_tick + 1;
+	}
+	return expired;
+}
+
+/**
+ * Returns milliseconds until the wheel next needs to expire
+ * timers. This is the next tick with a timer in the lowest
+ * level, or the end of its rotation when timers of higher
+ * levels must move down.
+ *
+ * @param wheel the timer wheel
+ * @param now_ms the current monotonic time in milliseconds
+ * @return the milliseconds to wait, or -1 if no timers are pending
+ */
+int timer_wheel_timeout(TimerWheel *wheel, long long now_ms) {
+	if (wheel->ntimers == 0) {
+		return -1;
+	}
+	// stop at the next tick with a timer, or where level 0 wraps
+	// and timers of higher levels must move down
+	long long tick = wheel->tick;
+	if ((tick & TIMER_LEVEL_MASK) != 0) {
+		Timer *slot = &wheel->slots[0][tick & TIMER_LEVEL_MASK];
+		while ((slot->next == slot) && ((++tick & TIMER_LEVEL_MASK) != 0)) {
+			slot = &wheel->slots[0][tick & TIMER_LEVEL_MASK];
+		}
+	}
+	long long timeout = tick*TIMER_TICK_MS - now_ms;
+	return (timeout < 0) ? 0 : (int)timeout;
+}
@@ -0,0 +1,105 @@
+/*
+ * timer_wheel.h
+ *
+ * Functions that implement a hierarchical timer wheel
+ * with constant time insertion and removal of timers.
+ *
+ */
+
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** milliseconds per timer wheel tick */
+#define TIMER_TICK_MS 10
+
+/** bits of tick index per wheel level */
+#define TIMER_LEVEL_BITS 6
+
+/** slots per wheel level */
+#define TIMER_LEVEL_SLOTS (1 << TIMER_LEVEL_BITS)
+
+/** wheel levels: level n slots span 64^n ticks (up to 46 hours total) */
+#define TIMER_LEVELS 4
+
+/** get the structure that contains a timer */
+#define timer_entry(ptr, type, member) ((type*)((char*)(ptr) - offsetof(type, member)))
+
+/** Definition of a timer embedded in the structure it times */
+typedef struct Timer {
+	struct Timer *prev;           /** previous timer in slot or NULL if not pending */
+	struct Timer *next;           /** next timer in slot or expired list */
+	long long expires;            /** tick when timer expires */
+} Timer;
+
+/** Definition of a timer wheel */
+typedef struct TimerWheel {
+	long long tick;               /** next tick to expire */
+	size_t ntimers;               /** number of pending timers */
+	Timer slots[TIMER_LEVELS][TIMER_LEVEL_SLOTS];  /** list heads of slots */
+} TimerWheel;
+
+/**
+ * Initialize an empty timer wheel.
+ *
+ * @param wheel the timer wheel
+ * @param now_ms the current monotonic time in milliseconds
+ */
+void timer_wheel_init(TimerWheel *wheel, long long now_ms);
+
+/**
+ * Initialize a timer that is not pending.
+ *
+ * @param timer the timer
+ */
+void timer_init(Timer *timer);
+
+/**
+ * Returns true if the timer is pending on a wheel.
+ *
+ * @param timer the timer
+ * @return true if the timer is pending
+ */
+bool timer_pending(const Timer *timer);
+
+/**
+ * Add a timer to the wheel, or move it if already pending.
+ *
+ * @param wheel the timer wheel
+ * @param timer the timer
+ * @param expires_ms monotonic time in milliseconds when timer expires
+ */
+void timer_wheel_add(TimerWheel *wheel, Timer *timer, long long expires_ms);
+
+/**
+ * Remove a timer from the wheel if it is pending.
+ *
+ * @param wheel the timer wheel
+ * @param timer the timer
+ */
+void timer_wheel_remove(TimerWheel *wheel, Timer *timer);
+
+/**
+ * Remove the timers that expired by the current time.
+ *
+ * @param wheel the timer wheel
+ * @param now_ms the current monotonic time in milliseconds
+ * @return the expired timers linked by next, or NULL if none
+ */
+Timer *timer_wheel_expire(TimerWheel *wheel, long long now_ms);
+
+/**
+ * Returns milliseconds until the wheel next needs to expire
+ * timers. This is the next tick with a timer in the lowest
+ * level, or the end of its rotation when timers of higher
+ * levels must move down.
+ *
+ * @param wheel the timer wheel
+ * @param now_ms the current monotonic time in milliseconds
+ * @return the milliseconds to wait, or -1 if no timers are pending
+ */
+int timer_wheel_timeout(TimerWheel *wheel, long long now_ms);
+
+#endif /* TIMER_WHEEL_H_ */
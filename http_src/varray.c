@@ -6,6 +6,7 @@
  */
 #include "varray.h"
 
+#include <string.h>
 #include <strings.h>
 #include <stdio.h>
 
@@ -110,6 +111,26 @@ void* elementAtVArray(VArray* varray, size_t index) {
 	return (varray->bytes) + index*(varray->width);
 }
 
+/**
+ * Removes the element at the specified index, moving the
+ * elements after it down by one.
+ *
+ * @param varray the varray
+ * @param index the index
+ * @return true if the element was removed, false if no such element
+ */
+bool removeElementAtVArray(VArray* varray, size_t index) {
+	if (index >= varray->size) {
+		return false;
+	}
+
+	// move following elements down over the removed element
+	void* element = (varray->bytes) + index*(varray->width);
+	memmove(element, element + varray->width, (varray->size - index - 1)*(varray->width));
+	varray->size--;
+	return true;
+}
+
 /**
  * Gets number of elements in varray.
  *
@@ -39,6 +39,16 @@ void deleteVArray(VArray* varray);
  */
 void* elementAtVArray(VArray* varray, size_t index);
 
+/**
+ * Removes the element at the specified index, moving the
+ * elements after it down by one.
+ *
+ * @param varray the varray
+ * @param index the index
+ * @return true if the element was removed, false if no such element
+ */
+bool removeElementAtVArray(VArray* varray, size_t index);
+
 /**
  * Gets number of elements in varray.
  *
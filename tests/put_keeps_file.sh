@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# put_keeps_file.sh
+#
+# Check that a PUT whose body is refused part way leaves the
+# existing file intact, and that a PUT that succeeds replaces it
+# whole, without temporary files left behind.
+#
+# Usage: tests/put_keeps_file.sh
+#   SERVERS   the server binary (default: build/http_server)
+#
+BENCH_DIR=$(cd "$(dirname "$0")/../bench" && pwd)
+. "$BENCH_DIR/common.sh"
+require curl
+
+dir="$ROOT/content/_put_test"
+mkdir -p "$dir"
+trap 'stop_server; rm -rf "$WORK" "$dir"' EXIT
+failed=0
+
+# Print "ok" or "FAILED" for a check named $1 whose condition is $2.
+check() {
+	if [ "$2" = true ]; then
+		echo "ok     $1"
+	else
+		echo "FAILED $1"
+		failed=1
+	fi
+}
+
+# Print the status of a chunked PUT of file $1 to path $2.
+put_chunked() {
+	curl -s -o /dev/null -w '%{http_code}' -T "$1" -H "Transfer-Encoding: chunked" "$URL$2"
+}
+
+# a 1 KB limit, checked chunk by chunk as the body is read
+start_server "${SERVERS%% *}" "$(bench_conf put.conf MaxBodySize=1)"
+
+echo old > "$dir/file.txt"
+{ printf 'new!'; head -c 2048 /dev/zero | tr '\0' a; } > "$WORK/large"
+status=$(put_chunked "$WORK/large" /_put_test/file.txt)
+check "body over MaxBodySize is refused with 413" "$([ "$status" = 413 ] && echo true)"
+check "refused PUT leaves the old file intact" "$([ "$(cat "$dir/file.txt")" = old ] && echo true)"
+
+echo new > "$WORK/small"
+status=$(put_chunked "$WORK/small" /_put_test/file.txt)
+check "PUT within MaxBodySize replaces the file" \
+	"$([ "$status" = 200 ] && [ "$(cat "$dir/file.txt")" = new ] && echo true)"
+check "no temporary files are left" "$([ -z "$(ls -A "$dir" | grep -v '^file.txt$')" ] && echo true)"
+
+exit $failed
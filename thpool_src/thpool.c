@@ -73,6 +73,8 @@ typedef struct jobqueue{
 	job  *rear;                          /* pointer to rear  of queue */
 	bsem *has_jobs;                      /* flag as binary semaphore  */
 	int   len;                           /* number of jobs in queue   */
+	int   max_len;                       /* queue bound, 0 if none    */
+	job  *free_jobs;                     /* recycled job structures   */
 } jobqueue;
 
 
@@ -108,8 +110,9 @@ static void  thread_destroy(struct thread* thread_p);
 
 static int   jobqueue_init(jobqueue* jobqueue_p);
 static void  jobqueue_clear(jobqueue* jobqueue_p);
-static void  jobqueue_push(jobqueue* jobqueue_p, struct job* newjob_p);
+static int   jobqueue_push(jobqueue* jobqueue_p, void (*function_p)(void*), void* arg_p, int bounded);
 static struct job* jobqueue_pull(jobqueue* jobqueue_p);
+static void  jobqueue_recycle(jobqueue* jobqueue_p, struct job* job_p);
 static void  jobqueue_destroy(jobqueue* jobqueue_p);
 
 static void  bsem_init(struct bsem *bsem_p, int value);
@@ -127,6 +130,12 @@ static void  bsem_wait(struct bsem *bsem_p);
 
 /* Initialise thread pool */
 struct thpool_* thpool_init(int num_threads){
+	return thpool_init_bounded(num_threads, 0);
+}
+
+
+/* Initialise thread pool with a bounded job queue */
+struct thpool_* thpool_init_bounded(int num_threads, int max_jobs){
 
 	threads_on_hold   = 0;
 	threads_keepalive = 1;
@@ -151,6 +160,7 @@ struct thpool_* thpool_init(int num_threads){
 		free(thpool_p);
 		return NULL;
 	}
+	thpool_p->jobqueue.max_len = (max_jobs > 0) ? max_jobs : 0;
 
 	/* Make threads in pool */
 	thpool_p->threads = (struct thread**)malloc(num_threads * sizeof(struct thread *));
@@ -182,22 +192,25 @@ struct thpool_* thpool_init(int num_threads){
 
 /* Add work to the thread pool */
 int thpool_add_work(thpool_* thpool_p, void (*function_p)(void*), void* arg_p){
-	job* newjob;
-
-	newjob=(struct job*)malloc(sizeof(struct job));
-	if (newjob==NULL){
+	/* add job to queue */
+	if (jobqueue_push(&thpool_p->jobqueue, function_p, arg_p, 0) == -1){
 		err("thpool_add_work(): Could not allocate memory for new job\n");
 		return -1;
 	}
 
-	/* add function and argument */
-	newjob->function=function_p;
-	newjob->arg=arg_p;
+	return 0;
+}
+
 
+/* Add work to the thread pool unless the job queue is full */
+int thpool_try_add_work(thpool_* thpool_p, void (*function_p)(void*), void* arg_p){
 	/* add job to queue */
-	jobqueue_push(&thpool_p->jobqueue, newjob);
+	int status = jobqueue_push(&thpool_p->jobqueue, function_p, arg_p, 1);
+	if (status == -1){
+		err("thpool_try_add_work(): Could not allocate memory for new job\n");
+	}
 
-	return 0;
+	return status;
 }
 
 
@@ -275,6 +288,14 @@ int thpool_num_threads_working(thpool_* thpool_p){
 }
 
 
+int thpool_num_jobs_queued(thpool_* thpool_p){
+	pthread_mutex_lock(&thpool_p->jobqueue.rwmutex);
+	int len = thpool_p->jobqueue.len;
+	pthread_mutex_unlock(&thpool_p->jobqueue.rwmutex);
+	return len;
+}
+
+
 
 
 
@@ -373,8 +394,8 @@ static void* thread_do(struct thread* thread_p){
 			if (job_p) {
 				func_buff = job_p->function;
 				arg_buff  = job_p->arg;
+				jobqueue_recycle(&thpool_p->jobqueue, job_p);
 				func_buff(arg_buff);
-				free(job_p);
 			}
 
 			pthread_mutex_lock(&thpool_p->thcount_lock);
@@ -409,8 +430,10 @@ static void thread_destroy (thread* thread_p){
 /* Initialize queue */
 static int jobqueue_init(jobqueue* jobqueue_p){
 	jobqueue_p->len = 0;
+	jobqueue_p->max_len = 0;
 	jobqueue_p->front = NULL;
 	jobqueue_p->rear  = NULL;
+	jobqueue_p->free_jobs = NULL;
 
 	jobqueue_p->has_jobs = (struct bsem*)malloc(sizeof(struct bsem));
 	if (jobqueue_p->has_jobs == NULL){
@@ -439,11 +462,32 @@ static void jobqueue_clear(jobqueue* jobqueue_p){
 }
 
 
-/* Add (allocated) job to queue
+/* Add job to queue, reusing a recycled job if there is one.
+ * Returns 1 without adding if bounded and the queue is full,
+ * -1 if no job could be allocated.
  */
-static void jobqueue_push(jobqueue* jobqueue_p, struct job* newjob){
+static int jobqueue_push(jobqueue* jobqueue_p, void (*function_p)(void*), void* arg_p, int bounded){
 
 	pthread_mutex_lock(&jobqueue_p->rwmutex);
+	if (bounded && jobqueue_p->max_len && jobqueue_p->len >= jobqueue_p->max_len){
+		pthread_mutex_unlock(&jobqueue_p->rwmutex);
+		return 1;
+	}
+
+	job* newjob = jobqueue_p->free_jobs;
+	if (newjob != NULL){
+		jobqueue_p->free_jobs = newjob->prev;
+	} else {
+		newjob = (struct job*)malloc(sizeof(struct job));
+		if (newjob == NULL){
+			pthread_mutex_unlock(&jobqueue_p->rwmutex);
+			return -1;
+		}
+	}
+
+	/* add function and argument */
+	newjob->function = function_p;
+	newjob->arg = arg_p;
 	newjob->prev = NULL;
 
 	switch(jobqueue_p->len){
@@ -462,6 +506,7 @@ static void jobqueue_push(jobqueue* jobqueue_p, struct job* newjob){
 
 	bsem_post(jobqueue_p->has_jobs);
 	pthread_mutex_unlock(&jobqueue_p->rwmutex);
+	return 0;
 }
 
 
@@ -501,9 +546,23 @@ static struct job* jobqueue_pull(jobqueue* jobqueue_p){
 }
 
 
+/* Return a pulled job to the queue for reuse */
+static void jobqueue_recycle(jobqueue* jobqueue_p, struct job* job_p){
+	pthread_mutex_lock(&jobqueue_p->rwmutex);
+	job_p->prev = jobqueue_p->free_jobs;
+	jobqueue_p->free_jobs = job_p;
+	pthread_mutex_unlock(&jobqueue_p->rwmutex);
+}
+
+
 /* Free all queue resources back to the system */
 static void jobqueue_destroy(jobqueue* jobqueue_p){
 	jobqueue_clear(jobqueue_p);
+	while (jobqueue_p->free_jobs != NULL){
+		job* job_p = jobqueue_p->free_jobs;
+		jobqueue_p->free_jobs = job_p->prev;
+		free(job_p);
+	}
 	free(jobqueue_p->has_jobs);
 }
 
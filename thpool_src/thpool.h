@@ -67,6 +67,51 @@ threadpool thpool_init(int num_threads);
 int thpool_add_work(threadpool, void (*function_p)(void*), void* arg_p);
 
 
+/**
+ * @brief  Initialize threadpool with a bounded job queue
+ *
+ * Like thpool_init(), but thpool_try_add_work() refuses new work once
+ * max_jobs jobs are waiting in the queue. Jobs taken from the queue are
+ * recycled, so a queue that stays within its bound does not allocate.
+ *
+ * @example
+ *
+ *    ..
+ *    threadpool thpool = thpool_init_bounded(4, 256);
+ *    ..
+ *
+ * @param  num_threads   number of threads to be created in the threadpool
+ * @param  max_jobs      maximum number of jobs waiting in the queue,
+ *                       0 for no limit
+ * @return threadpool    created threadpool on success,
+ *                       NULL on error
+ */
+threadpool thpool_init_bounded(int num_threads, int max_jobs);
+
+
+/**
+ * @brief Add work to the job queue unless it is full
+ *
+ * Like thpool_add_work(), but refuses the work if the job queue already
+ * holds the maximum number of jobs given to thpool_init_bounded(), so the
+ * caller can shed load instead of queueing without bound.
+ *
+ * @example
+ *
+ *    ..
+ *    if (thpool_try_add_work(thpool, (void*)print_num, (void*)a) == 1) {
+ *       // queue full: drop the work
+ *    }
+ *    ..
+ *
+ * @param  threadpool    threadpool to which the work will be added
+ * @param  function_p    pointer to function to add as work
+ * @param  arg_p         pointer to an argument
+ * @return 0 on successs, 1 if the queue is full, -1 otherwise.
+ */
+int thpool_try_add_work(threadpool, void (*function_p)(void*), void* arg_p);
+
+
 /**
  * @brief Wait for all queued jobs to finish
  *
@@ -180,6 +225,17 @@ void thpool_destroy(threadpool);
 int thpool_num_threads_working(threadpool);
 
 
+/**
+ * @brief Show number of jobs waiting in the queue
+ *
+ * Jobs already taken by a thread are not counted.
+ *
+ * @param threadpool     the threadpool of interest
+ * @return integer       number of jobs waiting in the queue
+ */
+int thpool_num_jobs_queued(threadpool);
+
+
 #ifdef __cplusplus
 }
 #endif